@@ -0,0 +1,130 @@
+/*
+ * autotune.c - Evaluates the family of transpose functions of trans.c
+ *     (TRANS_VARIANTS) on the cache of the grader, and reports the best
+ *     one for each shape. The functions are run in this process, with
+ *     their memory accesses simulated by tracesim.c.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <getopt.h>
+#include "cachelab.h"
+#include "tracesim.h"
+
+/* Maximum array dimension */
+#define MAXN 256
+
+/* The cache of the grader: 1KB, direct mapped, 32 byte blocks */
+#define CACHE_S 5
+#define CACHE_E 1
+#define CACHE_B 5
+
+/* External function defined in trans.c */
+extern void registerVariants();
+
+/* External variables defined in cachelab.c */
+extern trans_func_t func_list[MAX_TRANS_FUNCS];
+extern int func_counter;
+
+static int A[MAXN][MAXN];
+static int B[MAXN][MAXN];
+
+/*
+ * is_correct - Check that B is the transpose of A
+ */
+static int is_correct(int M, int N, int A[N][M], int B[M][N])
+{
+    int i, j;
+    for (i = 0; i < N; i++)
+        for (j = 0; j < M; j++)
+            if (A[i][j] != B[j][i])
+                return 0;
+    return 1;
+}
+
+/*
+ * tune - Evaluate all variants on an N x M matrix, and return the index
+ *     of the one with the fewest misses, or -1 if none is correct
+ */
+static int tune(int M, int N, unsigned int *best_misses)
+{
+    int i, best = -1;
+
+    *best_misses = UINT_MAX;
+
+    printf("\n%dx%d (M=%d, N=%d)\n", M, N, M, N);
+    for (i = 0; i < func_counter; i++) {
+        initMatrix(M, N, (int (*)[M])A, (int (*)[N])B);
+        tracesim_run(&func_list[i], M, N, (int (*)[M])A, (int (*)[N])B, CACHE_S, CACHE_E, CACHE_B);
+        if (!is_correct(M, N, (int (*)[M])A, (int (*)[N])B)) {
+            printf("  %-32s incorrect\n", func_list[i].description);
+            continue;
+        }
+        printf("  %-32s misses:%u\n", func_list[i].description, func_list[i].num_misses);
+        if (func_list[i].num_misses < *best_misses) {
+            *best_misses = func_list[i].num_misses;
+            best = i;
+        }
+    }
+    return best;
+}
+
+/*
+ * usage - Print usage info
+ */
+static void usage(char *argv[])
+{
+    printf("Usage: %s [-h] [-M <rows> -N <cols>]\n", argv[0]);
+    printf("Options:\n");
+    printf("  -h          Print this help message.\n");
+    printf("  -M <rows>   Number of matrix rows (max %d)\n", MAXN);
+    printf("  -N <cols>   Number of matrix columns (max %d)\n", MAXN);
+    printf("Without -M and -N, the shapes of the grader are tuned:"
+           " 32x32, 64x64 and 61x67.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static const int shapes[][2] = { { 32, 32 }, { 64, 64 }, { 61, 67 } };
+    int best[3];
+    unsigned int misses[3];
+    int M = 0, N = 0, nshapes, i, c;
+
+    while ((c = getopt(argc, argv, "M:N:h")) != -1) {
+        switch (c) {
+        case 'M': M = atoi(optarg); break;
+        case 'N': N = atoi(optarg); break;
+        case 'h':
+            usage(argv);
+            exit(0);
+        default:
+            usage(argv);
+            exit(1);
+        }
+    }
+    if ((M == 0) != (N == 0) || M < 0 || N < 0 || M > MAXN || N > MAXN) {
+        printf("Error: Invalid matrix shape\n");
+        usage(argv);
+        exit(1);
+    }
+
+    registerVariants();
+    printf("Evaluating %d variants (s=%d, E=%d, b=%d)\n", func_counter, CACHE_S, CACHE_E, CACHE_B);
+    nshapes = (M != 0) ? 1 : 3;
+    for (i = 0; i < nshapes; i++)
+        best[i] = (M != 0) ? tune(M, N, &misses[i])
+                             : tune(shapes[i][0], shapes[i][1], &misses[i]);
+
+    printf("\nBest variants:\n");
+    for (i = 0; i < nshapes; i++) {
+        if (best[i] < 0) {
+            printf("  %dx%d: none is correct\n",
+                   M != 0 ? M : shapes[i][0], N != 0 ? N : shapes[i][1]);
+            continue;
+        }
+        printf("  %dx%d: %s, misses:%u\n",
+               M != 0 ? M : shapes[i][0], N != 0 ? N : shapes[i][1],
+               func_list[best[i]].description, misses[i]);
+    }
+    return 0;
+}
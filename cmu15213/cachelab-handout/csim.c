@@ -1,7 +1,563 @@
+/*
+ * csim.c - A cache simulator for valgrind lackey traces
+ *
+ * Simulates a cache with 2^s sets of E lines of 2^b bytes, with LRU
+ * replacement, and reports the hits, misses and evictions of the data
+ * accesses in the trace. Instruction loads ("I") are ignored, a modify
+ * ("M") is a load followed by a store to the same address, and the size
+ * of an access is ignored, as in csim-ref.
+ *
+ * The trace is mapped into memory and parsed in place by a hand-written
+ * parser, so large traces are simulated at memory speed instead of at
+ * the speed of fgets() and sscanf(). With -j, the sets are simulated by
+ * several threads.
+ */
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "cachelab.h"
 
-int main()
+/*
+ * The cache is a struct of arrays: the tags and the LRU ages of all lines,
+ * with the lines of set i at [i * E, (i + 1) * E). A set is filled from
+ * its first line, and fill[i] is the number of valid lines of set i. The
+ * age of a line is the time of its last access, so the least recently
+ * used line has the smallest age.
+ */
+typedef struct {
+    int s, E, b;
+    uint64_t *tags;
+    uint64_t *ages;
+    int *fill;
+    uint64_t clock;
+    unsigned long hits, misses, evictions;
+} cache_t;
+
+/* The outcome of an access, for the verbose output */
+enum { HIT = 0, MISS = 1, MISS_EVICT = 2 };
+
+static void cache_init(cache_t *c, int s, int E, int b)
+{
+    size_t nlines = ((size_t)1 << s) * E;
+    memset(c, 0, sizeof(*c));
+    c->s = s;
+    c->E = E;
+    c->b = b;
+    c->tags = malloc(nlines * sizeof(uint64_t));
+    c->ages = malloc(nlines * sizeof(uint64_t));
+    c->fill = calloc((size_t)1 << s, sizeof(int));
+    if (c->tags == NULL || c->ages == NULL || c->fill == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+}
+
+static void cache_free(cache_t *c)
+{
+    free(c->tags);
+    free(c->ages);
+    free(c->fill);
+}
+
+static inline int cache_access(cache_t *c, uint64_t addr)
+{
+    uint64_t block = addr >> c->b;
+    /* shifting by 64 is undefined, so the set index is masked instead */
+    size_t set = block & (((uint64_t)1 << c->s) - 1);
+    uint64_t tag = (c->s + c->b >= 64) ? 0 : addr >> (c->s + c->b);
+    uint64_t *tags = c->tags + set * c->E;
+    uint64_t *ages = c->ages + set * c->E;
+    int n = c->fill[set], i, victim;
+
+    c->clock++;
+    for (i = 0; i < n; i++) {
+        if (tags[i] == tag) {
+            ages[i] = c->clock;
+            c->hits++;
+            return HIT;
+        }
+    }
+
+    c->misses++;
+    if (n < c->E) {
+        tags[n] = tag;
+        ages[n] = c->clock;
+        c->fill[set] = n + 1;
+        return MISS;
+    }
+    victim = 0;
+    for (i = 1; i < n; i++) {
+        if (ages[i] < ages[victim])
+            victim = i;
+    }
+    tags[victim] = tag;
+    ages[victim] = c->clock;
+    c->evictions++;
+    return MISS_EVICT;
+}
+
+/*
+ * trace_t - A trace mapped into memory, with a cursor for the parser
+ */
+typedef struct {
+    const char *p, *end;
+} trace_t;
+
+/* One data access of the trace */
+typedef struct {
+    char op;
+    uint64_t addr;
+    unsigned size;
+} access_t;
+
+/* hex_val[c] is the value of the hex digit c, or 0xff for other chars */
+static unsigned char hex_val[256];
+
+static void init_hex_val(void)
+{
+    int c;
+    memset(hex_val, 0xff, sizeof(hex_val));
+    for (c = '0'; c <= '9'; c++)
+        hex_val[c] = c - '0';
+    for (c = 'a'; c <= 'f'; c++)
+        hex_val[c] = c - 'a' + 10;
+    for (c = 'A'; c <= 'F'; c++)
+        hex_val[c] = c - 'A' + 10;
+}
+
+/*
+ * next_access - Parse the next data access (" L/S/M addr,size") from the
+ *     trace, skipping the instruction loads and malformed lines. Return 0
+ *     at the end of the trace.
+ */
+static inline int next_access(trace_t *t, access_t *a)
 {
-    printSummary(0, 0, 0);
+    const char *p = t->p, *end = t->end;
+
+    while (p < end) {
+        const char *line = p;
+        unsigned char d;
+        uint64_t addr = 0;
+        unsigned size = 0;
+
+        while (p < end && *p == ' ')
+            p++;
+        if (p + 1 < end && (*p == 'L' || *p == 'S' || *p == 'M') && p[1] == ' ') {
+            a->op = *p;
+            p += 2;
+            while (p < end && *p == ' ')
+                p++;
+            if (p < end && hex_val[(unsigned char)*p] != 0xff) {
+                while (p < end && (d = hex_val[(unsigned char)*p]) != 0xff) {
+                    addr = (addr << 4) | d;
+                    p++;
+                }
+                if (p < end && *p == ',') {
+                    for (p++; p < end && *p >= '0' && *p <= '9'; p++)
+                        size = size * 10 + (*p - '0');
+                }
+                a->addr = addr;
+                a->size = size;
+                p = memchr(p, '\n', end - p);
+                t->p = (p == NULL) ? end : p + 1;
+                return 1;
+            }
+        }
+        /* not a data access, skip the line */
+        p = memchr(line, '\n', end - line);
+        p = (p == NULL) ? end : p + 1;
+    }
+    t->p = end;
+    return 0;
+}
+
+/*
+ * trace_open - Map the trace file into memory, exit on errors
+ */
+static void trace_open(trace_t *t, const char *path)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    void *m;
+
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        exit(1);
+    }
+    t->p = t->end = NULL;
+    if (st.st_size > 0) {
+        m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED) {
+            perror(path);
+            exit(1);
+        }
+        madvise(m, st.st_size, MADV_SEQUENTIAL);
+        t->p = m;
+        t->end = t->p + st.st_size;
+    }
+    close(fd);
+}
+
+/*
+ * Sweep mode: one pass over the trace simulates every geometry with s, b
+ * and E in the given ranges. For each (s, b), every set keeps its blocks
+ * in LRU order, and an access to the block at depth d of the stack hits
+ * exactly in the caches with E > d, so one histogram of the depths gives
+ * the hits of all associativities. The stacks are cut at Emax entries,
+ * as deeper blocks miss in all of them.
+ *
+ * For the evictions, a miss evicts iff the set already holds E blocks.
+ * This is always true for a block found at depth d >= E, and for a block
+ * not found, the set holds as many blocks as its stack (or more, if the
+ * stack is full, in which case all of the caches evict).
+ */
+typedef struct {
+    int s, b;
+    uint64_t *stack;       /* 2^s stacks of Emax blocks, most recent first */
+    int *depth;            /* number of blocks in each stack */
+    unsigned long *hist;   /* hist[d]: accesses found at depth d */
+    unsigned long *absent; /* absent[n]: accesses not found in a stack of n */
+} sweep_t;
+
+#define SWEEP_CHUNK 65536 /* accesses parsed at once, then run by all (s, b) */
+
+static void sweep_access(sweep_t *w, int Emax, uint64_t addr)
+{
+    uint64_t block = addr >> w->b;
+    size_t set = block & (((uint64_t)1 << w->s) - 1);
+    uint64_t *st = w->stack + set * Emax;
+    int n = w->depth[set], d;
+
+    for (d = 0; d < n; d++) {
+        if (st[d] == block)
+            break;
+    }
+    if (d < n) {
+        w->hist[d]++;
+    } else {
+        w->absent[n]++;
+        if (n < Emax)
+            w->depth[set] = ++n;
+        d = n - 1; /* the last block is pushed out if the stack is full */
+    }
+    memmove(st + 1, st, d * sizeof(uint64_t));
+    st[0] = block;
+}
+
+static void sweep(const char *file, int smin, int smax, int Emin, int Emax,
+                  int bmin, int bmax)
+{
+    int nsb = (smax - smin + 1) * (bmax - bmin + 1), i, E, k;
+    sweep_t *w = calloc(nsb, sizeof(sweep_t));
+    uint64_t *addrs = malloc(SWEEP_CHUNK * sizeof(uint64_t));
+    unsigned long total = 0, nmodify = 0;
+    trace_t trace;
+    access_t a;
+
+    if (w == NULL || addrs == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    for (i = 0; i < nsb; i++) {
+        w[i].s = smin + i / (bmax - bmin + 1);
+        w[i].b = bmin + i % (bmax - bmin + 1);
+        w[i].stack = malloc(((size_t)1 << w[i].s) * Emax * sizeof(uint64_t));
+        w[i].depth = calloc((size_t)1 << w[i].s, sizeof(int));
+        w[i].hist = calloc(Emax, sizeof(unsigned long));
+        w[i].absent = calloc(Emax + 1, sizeof(unsigned long));
+        if (w[i].stack == NULL || w[i].depth == NULL || w[i].hist == NULL ||
+            w[i].absent == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+    }
+
+    init_hex_val();
+    trace_open(&trace, file);
+    for (;;) {
+        int n = 0;
+        while (n < SWEEP_CHUNK && next_access(&trace, &a)) {
+            addrs[n++] = a.addr;
+            if (a.op == 'M')
+                nmodify++; /* the store hits at depth 0 in every cache */
+        }
+        if (n == 0)
+            break;
+        total += n;
+        for (i = 0; i < nsb; i++) {
+            for (k = 0; k < n; k++)
+                sweep_access(&w[i], Emax, addrs[k]);
+        }
+    }
+
+    printf("%4s %4s %4s %14s %14s %14s\n", "s", "E", "b", "hits", "misses", "evictions");
+    for (i = 0; i < nsb; i++) {
+        for (E = Emin; E <= Emax; E++) {
+            unsigned long hits = 0, evictions = 0;
+            for (k = 0; k < E; k++)
+                hits += w[i].hist[k];
+            for (k = E; k < Emax; k++)
+                evictions += w[i].hist[k];
+            for (k = E; k <= Emax; k++)
+                evictions += w[i].absent[k];
+            printf("%4d %4d %4d %14lu %14lu %14lu\n", w[i].s, E, w[i].b,
+                   hits + nmodify, total - hits, evictions);
+        }
+        free(w[i].stack);
+        free(w[i].depth);
+        free(w[i].hist);
+        free(w[i].absent);
+    }
+    free(w);
+    free(addrs);
+}
+
+/*
+ * Parallel mode: the sets are independent, so set i is simulated by worker
+ * i % n, which sees the accesses to its sets in the order of the trace.
+ * The trace is processed in windows of n chunks. In each window, worker t
+ * first parses chunk t and sorts its accesses into one bucket per worker.
+ * After a barrier, worker p runs bucket p of chunks 0, 1, ..., n - 1 in
+ * order. The workers share the arrays of the cache, but not the counters
+ * and the clock, which only has to order the accesses within a set.
+ */
+#define PAR_CHUNK (4 << 20) /* bytes of the trace parsed by a worker at once */
+
+typedef struct {
+    uint64_t *addrs;
+    size_t n, cap;
+} bucket_t;
+
+typedef struct {
+    cache_t cache;     /* a view of the shared cache with private counters */
+    bucket_t *buckets; /* accesses of the chunk, sorted by worker */
+    trace_t chunk;
+    unsigned long nmodify;
+} worker_t;
+
+static struct {
+    int n;
+    worker_t *w;
+    pthread_barrier_t start, parsed, done;
+    int finished;
+} par;
+
+static void par_round(int id)
+{
+    worker_t *w = &par.w[id];
+    uint64_t mask = ((uint64_t)1 << w->cache.s) - 1;
+    access_t a;
+    int t;
+    size_t k;
+
+    for (t = 0; t < par.n; t++)
+        w->buckets[t].n = 0;
+    while (next_access(&w->chunk, &a)) {
+        bucket_t *bk = &w->buckets[((a.addr >> w->cache.b) & mask) % par.n];
+        if (bk->n == bk->cap) {
+            bk->cap = bk->cap ? bk->cap * 2 : 4096;
+            bk->addrs = realloc(bk->addrs, bk->cap * sizeof(uint64_t));
+            if (bk->addrs == NULL) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        bk->addrs[bk->n++] = a.addr;
+        if (a.op == 'M')
+            w->nmodify++;
+    }
+    pthread_barrier_wait(&par.parsed);
+
+    for (t = 0; t < par.n; t++) {
+        bucket_t *bk = &par.w[t].buckets[id];
+        for (k = 0; k < bk->n; k++)
+            cache_access(&w->cache, bk->addrs[k]);
+    }
+    pthread_barrier_wait(&par.done);
+}
+
+static void *par_worker(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+    for (;;) {
+        pthread_barrier_wait(&par.start);
+        if (par.finished)
+            return NULL;
+        par_round(id);
+    }
+}
+
+static void par_simulate(cache_t *c, trace_t *trace, int n)
+{
+    pthread_t *tids = malloc(n * sizeof(pthread_t));
+    int t;
+
+    par.n = n;
+    par.w = calloc(n, sizeof(worker_t));
+    if (tids == NULL || par.w == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    pthread_barrier_init(&par.start, NULL, n);
+    pthread_barrier_init(&par.parsed, NULL, n);
+    pthread_barrier_init(&par.done, NULL, n);
+    for (t = 0; t < n; t++) {
+        par.w[t].cache = *c;
+        par.w[t].buckets = calloc(n, sizeof(bucket_t));
+        if (par.w[t].buckets == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        if (t > 0 && pthread_create(&tids[t], NULL, par_worker, (void *)(intptr_t)t) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+
+    /* the main thread is worker 0, and splits the windows at line ends */
+    while (trace->p < trace->end) {
+        for (t = 0; t < n; t++) {
+            const char *begin = trace->p, *end = begin;
+            if (trace->end - begin > PAR_CHUNK) {
+                end = memchr(begin + PAR_CHUNK, '\n', trace->end - begin - PAR_CHUNK);
+                end = (end == NULL) ? trace->end : end + 1;
+            } else {
+                end = trace->end;
+            }
+            par.w[t].chunk.p = begin;
+            par.w[t].chunk.end = end;
+            trace->p = end;
+        }
+        pthread_barrier_wait(&par.start);
+        par_round(0);
+    }
+    par.finished = 1;
+    pthread_barrier_wait(&par.start);
+
+    for (t = 0; t < n; t++) {
+        if (t > 0)
+            pthread_join(tids[t], NULL);
+        c->hits += par.w[t].cache.hits + par.w[t].nmodify;
+        c->misses += par.w[t].cache.misses;
+        c->evictions += par.w[t].cache.evictions;
+    }
+    for (t = 0; t < par.n; t++) {
+        int k;
+        for (k = 0; k < par.n; k++)
+            free(par.w[t].buckets[k].addrs);
+        free(par.w[t].buckets);
+    }
+    free(par.w);
+    free(tids);
+}
+
+/*
+ * parse_range - Parse "lo-hi" or "n" (for lo = hi = n), return 0 on errors
+ */
+static int parse_range(const char *str, int *lo, int *hi)
+{
+    char *end;
+    *lo = *hi = strtol(str, &end, 10);
+    if (*end == '-')
+        *hi = strtol(end + 1, &end, 10);
+    return end != str && *end == '\0' && *lo >= 0 && *lo <= *hi;
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-hva] [-j <num>] -s <num> -E <num> -b <num> -t <file>\n", prog);
+    printf("Options:\n");
+    printf("  -h         Print this help message.\n");
+    printf("  -v         Optional verbose flag.\n");
+    printf("  -s <num>   Number of set index bits.\n");
+    printf("  -E <num>   Number of lines per set.\n");
+    printf("  -b <num>   Number of block offset bits.\n");
+    printf("  -t <file>  Trace file.\n");
+    printf("  -a         Sweep mode: -s, -E and -b take ranges <lo>-<hi>, and all\n");
+    printf("             geometries in the ranges are simulated in one pass.\n");
+    printf("  -j <num>   Number of threads, which simulate disjoint sets.\n");
+    printf("\nExamples:\n");
+    printf("  linux>  %s -s 4 -E 1 -b 4 -t traces/yi.trace\n", prog);
+    printf("  linux>  %s -v -s 8 -E 2 -b 4 -t traces/yi.trace\n", prog);
+    printf("  linux>  %s -j 4 -s 10 -E 4 -b 6 -t traces/long.trace\n", prog);
+    printf("  linux>  %s -a -s 0-8 -E 1-16 -b 3-6 -t traces/long.trace\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *outcome[] = { " hit", " miss", " miss eviction" };
+    int s = -1, E = -1, b = -1, verbose = 0, sweep_mode = 0, nthreads = 1, opt, r;
+    int smax, Emax, bmax;
+    const char *file = NULL, *sarg = NULL, *Earg = NULL, *barg = NULL;
+    cache_t cache;
+    trace_t trace;
+    access_t a;
+
+    while ((opt = getopt(argc, argv, "hvaj:s:E:b:t:")) != -1) {
+        switch (opt) {
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        case 'v': verbose = 1; break;
+        case 'a': sweep_mode = 1; break;
+        case 'j': nthreads = atoi(optarg); break;
+        case 's': sarg = optarg; break;
+        case 'E': Earg = optarg; break;
+        case 'b': barg = optarg; break;
+        case 't': file = optarg; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (sarg == NULL || Earg == NULL || barg == NULL || file == NULL) {
+        printf("%s: Missing required command line argument\n", argv[0]);
+        usage(argv[0]);
+        return 1;
+    }
+    if (sweep_mode) {
+        if (!parse_range(sarg, &s, &smax) || !parse_range(Earg, &E, &Emax) ||
+            !parse_range(barg, &b, &bmax) || E == 0 || smax > 30 || bmax > 63) {
+            printf("%s: Invalid cache geometry\n", argv[0]);
+            return 1;
+        }
+        sweep(file, s, smax, E, Emax, b, bmax);
+        return 0;
+    }
+    s = atoi(sarg);
+    E = atoi(Earg);
+    b = atoi(barg);
+    if (s < 0 || E <= 0 || b < 0 || s > 30 || b > 63) {
+        printf("%s: Invalid cache geometry\n", argv[0]);
+        return 1;
+    }
+
+    init_hex_val();
+    trace_open(&trace, file);
+    cache_init(&cache, s, E, b);
+    /* the order of the verbose output is the one of the trace */
+    if (nthreads > (1 << s))
+        nthreads = 1 << s;
+    if (nthreads > 1 && !verbose)
+        par_simulate(&cache, &trace, nthreads); /* consumes the whole trace */
+    while (next_access(&trace, &a)) {
+        r = cache_access(&cache, a.addr);
+        if (a.op == 'M')
+            cache.hits++; /* the store always hits the block just loaded */
+        if (verbose) {
+            printf("%c %llx,%u%s%s \n", a.op, (unsigned long long)a.addr, a.size,
+                   outcome[r], a.op == 'M' ? " hit" : "");
+        }
+    }
+    printSummary(cache.hits, cache.misses, cache.evictions);
+    cache_free(&cache);
     return 0;
 }
@@ -2,6 +2,20 @@
  * test-trans.c - Checks the correctness and performance of all of the
  *     student's transpose functions and records the results for their
  *     official submitted version as well.
+ *
+ *     By default, the functions are evaluated with valgrind and csim-ref,
+ *     which give the official miss counts. With -f, they are run in this
+ *     process instead, on a trans.c instrumented to simulate its memory
+ *     accesses (see tracesim.c). This is much faster, but may be one
+ *     miss off the official counts.
+ *
+ *     The instrumentation of -f borrows the __tsan_* hooks which
+ *     -fsanitize=thread inserts. They are an internal interface of the
+ *     compiler, not a stable one: a compiler that calls other hooks fails
+ *     to link test-trans or leaves some accesses out, -fsanitize=thread
+ *     needs a 64-bit target, and test-trans can not be linked with the
+ *     real ThreadSanitizer runtime. Trust the default evaluation when the
+ *     two disagree by more than a miss.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,6 +26,7 @@
 #include <getopt.h>
 #include <sys/types.h>
 #include "cachelab.h"
+#include "tracesim.h"
 #include <sys/wait.h> // fir WEXITSTATUS
 #include <limits.h> // for INT_MAX
 
@@ -33,6 +48,10 @@ extern int func_counter;
 static int M = 0;
 static int N = 0;
 
+/* The matrices of the in-process evaluation, as in tracegen.c */
+static int A[MAXN][MAXN];
+static int B[MAXN][MAXN];
+
 /* The correctness and performance for the submitted transpose function */
 struct results {
     int funcid;
@@ -41,6 +60,58 @@ struct results {
 };
 static struct results results = {-1, 0, INT_MAX};
 
+/*
+ * validate - Check that B is the transpose of A
+ */
+static int validate(int fn, int M, int N, int A[N][M], int B[M][N])
+{
+    int i, j;
+    for (i = 0; i < N; i++) {
+        for (j = 0; j < M; j++) {
+            if (A[i][j] != B[j][i]) {
+                printf("Validation failed on function %d! Expected %d but got %d at B[%d][%d]\n",
+                       fn, A[i][j], B[j][i], j, i);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/*
+ * eval_perf_fast - Evaluate the performance of the registered transpose
+ *     functions by running them in this process
+ */
+void eval_perf_fast(unsigned int s, unsigned int E, unsigned int b)
+{
+    int i;
+
+    registerFunctions();
+
+    for (i = 0; i < func_counter; i++) {
+        if (strcmp(func_list[i].description, SUBMIT_DESCRIPTION) == 0)
+            results.funcid = i; /* remember which function is the submission */
+
+        printf("\nFunction %d (%d total)\nStep 1: Validating and simulating memory accesses (s=%d, E=%d, b=%d)\n",
+               i, func_counter, s, E, b);
+        initMatrix(M, N, (int (*)[M])A, (int (*)[N])B);
+        tracesim_run(&func_list[i], M, N, (int (*)[M])A, (int (*)[N])B, s, E, b);
+        if (!validate(i, M, N, (int (*)[M])A, (int (*)[N])B)) {
+            printf("Skipping performance evaluation for this function.\n");
+            continue;
+        }
+        func_list[i].correct = 1;
+        if (results.funcid == i)
+            results.correct = 1;
+
+        printf("func %u (%s): hits:%u, misses:%u, evictions:%u\n",
+               i, func_list[i].description, func_list[i].num_hits,
+               func_list[i].num_misses, func_list[i].num_evictions);
+        if (results.funcid == i)
+            results.misses = func_list[i].num_misses;
+    }
+}
+
 /* 
  * eval_perf - Evaluate the performance of the registered transpose functions
  */
@@ -164,9 +235,11 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b)
  * usage - Print usage info
  */
 void usage(char *argv[]){
-    printf("Usage: %s [-h] -M <rows> -N <cols>\n", argv[0]);
+    printf("Usage: %s [-hf] -M <rows> -N <cols>\n", argv[0]);
     printf("Options:\n");
     printf("  -h          Print this help message.\n");
+    printf("  -f          Evaluate in process, faster but may be one miss off.\n");
+    printf("              Needs a compiler with the __tsan_* hooks of tracesim.c.\n");
     printf("  -M <rows>   Number of matrix rows (max %d)\n", MAXN);
     printf("  -N <cols>   Number of  matrix columns (max %d)\n", MAXN);
     printf("Example: %s -M 8 -N 8\n", argv[0]);       
@@ -198,8 +271,9 @@ void sigalrm_handler(int signum){
 int main(int argc, char* argv[])
 {
     char c;
+    int fast = 0;
 
-    while ((c = getopt(argc,argv,"M:N:h")) != -1) {
+    while ((c = getopt(argc,argv,"M:N:hf")) != -1) {
         switch(c) {
         case 'M':
             M = atoi(optarg);
@@ -210,6 +284,9 @@ int main(int argc, char* argv[])
         case 'h':
             usage(argv);
             exit(0);
+        case 'f':
+            fast = 1;
+            break;
         default:
             usage(argv);
             exit(1);
@@ -243,7 +320,10 @@ int main(int argc, char* argv[])
     alarm(120);
 
     /* Check the performance of the student's transpose function */
-    eval_perf(5, 1, 5);
+    if (fast)
+        eval_perf_fast(5, 1, 5);
+    else
+        eval_perf(5, 1, 5);
   
     /* Emit the results for this particular test */
     if (results.funcid == -1) {
@@ -0,0 +1,137 @@
+/*
+ * tracesim.c - In-process cache simulation of the transpose functions
+ *
+ * trans.c is compiled with -fsanitize=thread, which makes the compiler
+ * insert a call to __tsan_read<n>() or __tsan_write<n>() before every load
+ * and store. Instead of linking the ThreadSanitizer runtime, the hooks are
+ * defined here, and feed the addresses to an LRU cache model while a
+ * transpose function runs. This replaces running tracegen under valgrind,
+ * filtering its trace and running csim-ref on it, which takes seconds, by
+ * a simulation which takes milliseconds.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "tracesim.h"
+
+/* The stack of the transpose function is this far below the caller */
+#define STACK_WINDOW (8 << 20)
+
+/* The cache, as in csim.c: the lines of set i are at [i * E, (i + 1) * E) */
+static struct {
+    unsigned int s, E, b;
+    uint64_t *tags;
+    uint64_t *ages; /* time of the last access, 0 for an invalid line */
+    uint64_t clock;
+    unsigned int hits, misses, evictions;
+} cache;
+
+/* The accesses are simulated only while this is set */
+static int tracing = 0;
+static uintptr_t stack_lo, stack_hi;
+
+/*
+ * The traces of tracegen run from the write of MARKER_START to the write
+ * of MARKER_END, which also include the loads of the arguments of the call
+ * to the transpose function. They are simulated too, so that the numbers
+ * are close to the ones of the valgrind traces.
+ */
+static volatile char marker_start, marker_end;
+static int trace_M, trace_N;
+
+static void cache_access(uintptr_t addr)
+{
+    uint64_t set = (addr >> cache.b) & (((uint64_t)1 << cache.s) - 1);
+    uint64_t tag = addr >> (cache.s + cache.b);
+    uint64_t *tags = &cache.tags[set * cache.E];
+    uint64_t *ages = &cache.ages[set * cache.E];
+    unsigned int i, victim = 0;
+
+    cache.clock++;
+    for (i = 0; i < cache.E; i++) {
+        if (ages[i] != 0 && tags[i] == tag) {
+            cache.hits++;
+            ages[i] = cache.clock;
+            return;
+        }
+        if (ages[i] < ages[victim])
+            victim = i;
+    }
+    cache.misses++;
+    if (ages[victim] != 0)
+        cache.evictions++;
+    tags[victim] = tag;
+    ages[victim] = cache.clock;
+}
+
+static inline void trace(void *addr)
+{
+    uintptr_t a = (uintptr_t)addr;
+    if (tracing && (a < stack_lo || a >= stack_hi))
+        cache_access(a);
+}
+
+/*
+ * The hooks called by the instrumented code. As in the valgrind traces,
+ * an access is simulated as one access to its first byte, whatever its
+ * size is.
+ */
+void __tsan_init(void) {}
+void __tsan_func_entry(void *pc) {}
+void __tsan_func_exit(void) {}
+
+#define TSAN_HOOKS(n)                                                   \
+    void __tsan_read##n(void *addr) { trace(addr); }                    \
+    void __tsan_write##n(void *addr) { trace(addr); }                   \
+    void __tsan_unaligned_read##n(void *addr) { trace(addr); }          \
+    void __tsan_unaligned_write##n(void *addr) { trace(addr); }
+TSAN_HOOKS(1)
+TSAN_HOOKS(2)
+TSAN_HOOKS(4)
+TSAN_HOOKS(8)
+TSAN_HOOKS(16)
+
+void __tsan_read_range(void *addr, unsigned long size) { trace(addr); }
+void __tsan_write_range(void *addr, unsigned long size) { trace(addr); }
+
+/*
+ * tracesim_run - Run a transpose function and simulate its accesses
+ */
+void tracesim_run(trans_func_t *trans, int M, int N, int A[N][M], int B[M][N],
+                  unsigned int s, unsigned int E, unsigned int b)
+{
+    size_t nlines = ((size_t)1 << s) * E;
+    char frame;
+
+    cache.s = s;
+    cache.E = E;
+    cache.b = b;
+    cache.tags = calloc(nlines, sizeof(uint64_t));
+    cache.ages = calloc(nlines, sizeof(uint64_t));
+    if (cache.tags == NULL || cache.ages == NULL) {
+        fprintf(stderr, "tracesim: out of memory\n");
+        exit(1);
+    }
+    cache.clock = 0;
+    cache.hits = cache.misses = cache.evictions = 0;
+
+    /* the frames of the transpose function are below this one */
+    stack_hi = (uintptr_t)&frame;
+    stack_lo = stack_hi - STACK_WINDOW;
+    trace_M = M;
+    trace_N = N;
+    tracing = 1;
+    cache_access((uintptr_t)&marker_start);
+    cache_access((uintptr_t)&trans->func_ptr);
+    cache_access((uintptr_t)&trace_M);
+    cache_access((uintptr_t)&trace_N);
+    (*trans->func_ptr)(M, N, A, B);
+    cache_access((uintptr_t)&marker_end);
+    tracing = 0;
+
+    trans->num_hits = cache.hits;
+    trans->num_misses = cache.misses;
+    trans->num_evictions = cache.evictions;
+    free(cache.tags);
+    free(cache.ages);
+}
@@ -0,0 +1,20 @@
+/*
+ * tracesim.h - In-process cache simulation of the transpose functions
+ */
+#ifndef TRACESIM_H
+#define TRACESIM_H
+
+#include "cachelab.h"
+
+/*
+ * tracesim_run - Run trans->func_ptr(M, N, A, B) and simulate its memory
+ *     accesses on a cache with 2^s sets of E lines of 2^b bytes. The
+ *     function must be compiled with -fsanitize=thread, which makes every
+ *     load and store call a hook in tracesim.c. The accesses to the stack
+ *     are ignored, as test-trans does with the valgrind traces. The results
+ *     are stored in the num_hits, num_misses and num_evictions of trans.
+ */
+void tracesim_run(trans_func_t *trans, int M, int N, int A[N][M], int B[M][N],
+                  unsigned int s, unsigned int E, unsigned int b);
+
+#endif /* TRACESIM_H */
@@ -12,6 +12,253 @@
 
 int is_transpose(int M, int N, int A[N][M], int B[M][N]);
 
+/*
+ * The kernels below are parameterized by the block size and the order in
+ * which the blocks are visited. The transpose functions of TRANS_VARIANTS
+ * are instances of them, and ./autotune evaluates all of them on the cache
+ * of the grader to find the best one for each shape.
+ */
+
+/*
+ * The lab allows at most 12 local int variables at any time, including the
+ * ones of the functions called. So each kind of tile has its own kernel,
+ * which visits all tiles itself with no int but ii and jj, and does not
+ * call another one.
+ */
+
+/*
+ * NEXT_TILE - Advance (ii, jj) to the next bh x bw tile, by rows of tiles,
+ *     or by columns of tiles if colmajor is set. All tiles are visited when
+ *     ii reaches N or jj reaches M.
+ */
+#define NEXT_TILE(bh, bw, colmajor)                                     \
+    do {                                                                \
+        if (colmajor) {                                                 \
+            ii += (bh);                                                 \
+            if (ii >= N) {                                              \
+                ii = 0;                                                 \
+                jj += (bw);                                             \
+            }                                                           \
+        } else {                                                        \
+            jj += (bw);                                                 \
+            if (jj >= M) {                                              \
+                jj = 0;                                                 \
+                ii += (bh);                                             \
+            }                                                           \
+        }                                                               \
+    } while (0)
+
+/*
+ * block_kernel - Transpose by bh x bw blocks. With diag set, the element
+ *     on the diagonal is written after the rest of its row: when A and B
+ *     are aligned, A[i][i] and B[i][i] map to the same set, and writing
+ *     B[i][i] would evict the row of A being read.
+ */
+static void block_kernel(int M, int N, int A[N][M], int B[M][N],
+                         int bh, int bw, int colmajor, int diag)
+{
+    int ii, jj, i, j, tmp, d;
+
+    for (ii = 0, jj = 0; ii < N && jj < M; ) {
+        for (i = ii; i < ii + bh && i < N; i++) {
+            d = 0;
+            for (j = jj; j < jj + bw && j < M; j++) {
+                if (diag && i == j) {
+                    tmp = A[i][j];
+                    d = 1;
+                } else {
+                    B[j][i] = A[i][j];
+                }
+            }
+            if (d)
+                B[i][i] = tmp;
+        }
+        NEXT_TILE(bh, bw, colmajor);
+    }
+}
+
+/*
+ * ROW8 - Transpose the 8 elements of row i of A at column jj, which are
+ *     read into registers before being written, so that the reads of a row
+ *     and the writes to B never evict each other. The last columns, when M
+ *     is not a multiple of 8, are transposed one by one.
+ */
+#define ROW8(i, jj)                                                     \
+    do {                                                                \
+        if ((jj) + 8 > M) {                                             \
+            for (j = (jj); j < M; j++)                                  \
+                B[j][i] = A[i][j];                                      \
+            break;                                                      \
+        }                                                               \
+        a0 = A[i][(jj)];                                                \
+        a1 = A[i][(jj) + 1];                                            \
+        a2 = A[i][(jj) + 2];                                            \
+        a3 = A[i][(jj) + 3];                                            \
+        a4 = A[i][(jj) + 4];                                            \
+        a5 = A[i][(jj) + 5];                                            \
+        a6 = A[i][(jj) + 6];                                            \
+        a7 = A[i][(jj) + 7];                                            \
+        B[(jj)][i] = a0;                                                \
+        B[(jj) + 1][i] = a1;                                            \
+        B[(jj) + 2][i] = a2;                                            \
+        B[(jj) + 3][i] = a3;                                            \
+        B[(jj) + 4][i] = a4;                                            \
+        B[(jj) + 5][i] = a5;                                            \
+        B[(jj) + 6][i] = a6;                                            \
+        B[(jj) + 7][i] = a7;                                            \
+    } while (0)
+
+/*
+ * row8_kernel - Transpose by bh x 8 blocks, by rows of 8 elements
+ */
+static void row8_kernel(int M, int N, int A[N][M], int B[M][N],
+                        int bh, int colmajor)
+{
+    int ii, jj, i, j, a0, a1, a2, a3, a4, a5, a6, a7;
+
+    for (ii = 0, jj = 0; ii < N && jj < M; ) {
+        for (i = ii; i < ii + bh && i < N; i++)
+            ROW8(i, jj);
+        NEXT_TILE(bh, 8, colmajor);
+    }
+}
+
+/*
+ * quarter_kernel - Transpose by 8x8 blocks, by 4x4 quarters. When a row
+ *     of B is 256 bytes, as for 64x64, rows j and j + 4 of B map to the
+ *     same sets. So the top half of A is transposed into the top half of
+ *     B, with the top right quarter parked in the top right quarter of B,
+ *     and then moved down while the bottom left quarter of A is transposed
+ *     into its place. The blocks cut by the edges of A are transposed by
+ *     rows of 8.
+ */
+static void quarter_kernel(int M, int N, int A[N][M], int B[M][N],
+                           int colmajor)
+{
+    int ii, jj, i, j, a0, a1, a2, a3, a4, a5, a6, a7;
+
+    for (ii = 0, jj = 0; ii < N && jj < M; ) {
+        if (ii + 8 > N || jj + 8 > M) {
+            for (i = ii; i < ii + 8 && i < N; i++)
+                ROW8(i, jj);
+            NEXT_TILE(8, 8, colmajor);
+            continue;
+        }
+        for (i = ii; i < ii + 4; i++) {
+            a0 = A[i][jj];
+            a1 = A[i][jj + 1];
+            a2 = A[i][jj + 2];
+            a3 = A[i][jj + 3];
+            a4 = A[i][jj + 4];
+            a5 = A[i][jj + 5];
+            a6 = A[i][jj + 6];
+            a7 = A[i][jj + 7];
+            B[jj][i] = a0;
+            B[jj + 1][i] = a1;
+            B[jj + 2][i] = a2;
+            B[jj + 3][i] = a3;
+            B[jj][i + 4] = a4;
+            B[jj + 1][i + 4] = a5;
+            B[jj + 2][i + 4] = a6;
+            B[jj + 3][i + 4] = a7;
+        }
+        for (j = jj; j < jj + 4; j++) {
+            a0 = B[j][ii + 4];
+            a1 = B[j][ii + 5];
+            a2 = B[j][ii + 6];
+            a3 = B[j][ii + 7];
+            a4 = A[ii + 4][j];
+            a5 = A[ii + 5][j];
+            a6 = A[ii + 6][j];
+            a7 = A[ii + 7][j];
+            B[j][ii + 4] = a4;
+            B[j][ii + 5] = a5;
+            B[j][ii + 6] = a6;
+            B[j][ii + 7] = a7;
+            B[j + 4][ii] = a0;
+            B[j + 4][ii + 1] = a1;
+            B[j + 4][ii + 2] = a2;
+            B[j + 4][ii + 3] = a3;
+        }
+        for (i = ii + 4; i < ii + 8; i++) {
+            a0 = A[i][jj + 4];
+            a1 = A[i][jj + 5];
+            a2 = A[i][jj + 6];
+            a3 = A[i][jj + 7];
+            B[jj + 4][i] = a0;
+            B[jj + 5][i] = a1;
+            B[jj + 6][i] = a2;
+            B[jj + 7][i] = a3;
+        }
+        NEXT_TILE(8, 8, colmajor);
+    }
+}
+
+/* The kinds of tiles of transpose_kernel() */
+enum { TILE_BLOCK, TILE_BLOCK_DIAG, TILE_ROW8, TILE_QUARTER };
+
+/*
+ * transpose_kernel - Transpose by bh x bw tiles of the given kind, visited
+ *     by rows of tiles, or by columns of tiles if colmajor is set. It has
+ *     no local variable, so the kernels keep all 12 of theirs.
+ */
+static void transpose_kernel(int M, int N, int A[N][M], int B[M][N],
+                             int tile, int bh, int bw, int colmajor)
+{
+    switch (tile) {
+    case TILE_BLOCK:      block_kernel(M, N, A, B, bh, bw, colmajor, 0); break;
+    case TILE_BLOCK_DIAG: block_kernel(M, N, A, B, bh, bw, colmajor, 1); break;
+    case TILE_ROW8:       row8_kernel(M, N, A, B, bh, colmajor); break;
+    case TILE_QUARTER:    quarter_kernel(M, N, A, B, colmajor); break;
+    }
+}
+
+/*
+ * TRANS_VARIANTS - The family of transpose functions: X(name, description,
+ *     tile, bh, bw, colmajor) defines trans_<name>(). The row8 and quarter
+ *     tiles are 8 columns wide, and the quarter tiles 8 rows high.
+ */
+#define TRANS_VARIANTS(X)                                               \
+    X(block_4x4,     "Blocked 4x4",             TILE_BLOCK, 4, 4, 0)    \
+    X(block_8x8,     "Blocked 8x8",             TILE_BLOCK, 8, 8, 0)    \
+    X(block_8x4,     "Blocked 8x4",             TILE_BLOCK, 8, 4, 0)    \
+    X(block_16x4,    "Blocked 16x4",            TILE_BLOCK, 16, 4, 0)   \
+    X(block_16x8,    "Blocked 16x8",            TILE_BLOCK, 16, 8, 0)   \
+    X(block_16x16,   "Blocked 16x16",           TILE_BLOCK, 16, 16, 0)  \
+    X(block_17x17,   "Blocked 17x17",           TILE_BLOCK, 17, 17, 0)  \
+    X(block_18x18,   "Blocked 18x18",           TILE_BLOCK, 18, 18, 0)  \
+    X(block_20x20,   "Blocked 20x20",           TILE_BLOCK, 20, 20, 0)  \
+    X(block_23x23,   "Blocked 23x23",           TILE_BLOCK, 23, 23, 0)  \
+    X(block_16x16_c, "Blocked 16x16, by cols",  TILE_BLOCK, 16, 16, 1)  \
+    X(block_17x17_c, "Blocked 17x17, by cols",  TILE_BLOCK, 17, 17, 1)  \
+    X(diag_4x4,      "Blocked 4x4, diagonal",   TILE_BLOCK_DIAG, 4, 4, 0)   \
+    X(diag_8x8,      "Blocked 8x8, diagonal",   TILE_BLOCK_DIAG, 8, 8, 0)   \
+    X(diag_16x16,    "Blocked 16x16, diagonal", TILE_BLOCK_DIAG, 16, 16, 0) \
+    X(diag_17x17,    "Blocked 17x17, diagonal", TILE_BLOCK_DIAG, 17, 17, 0) \
+    X(row8_4,        "Rows of 8, 4 high",       TILE_ROW8, 4, 8, 0)     \
+    X(row8_8,        "Rows of 8, 8 high",       TILE_ROW8, 8, 8, 0)     \
+    X(row8_16,       "Rows of 8, 16 high",      TILE_ROW8, 16, 8, 0)    \
+    X(row8_23,       "Rows of 8, 23 high",      TILE_ROW8, 23, 8, 0)    \
+    X(row8_32,       "Rows of 8, 32 high",      TILE_ROW8, 32, 8, 0)    \
+    X(row8_8_c,      "Rows of 8, 8 high, by cols",  TILE_ROW8, 8, 8, 1)     \
+    X(row8_16_c,     "Rows of 8, 16 high, by cols", TILE_ROW8, 16, 8, 1)    \
+    X(row8_23_c,     "Rows of 8, 23 high, by cols", TILE_ROW8, 23, 8, 1)    \
+    X(quarter,       "Quarters of 8x8",         TILE_QUARTER, 8, 8, 0)  \
+    X(quarter_c,     "Quarters of 8x8, by cols", TILE_QUARTER, 8, 8, 1)
+
+#define DEFINE_VARIANT(name, desc, tile, bh, bw, colmajor)              \
+    static char trans_##name##_desc[] = desc;                          \
+    static void trans_##name(int M, int N, int A[N][M], int B[M][N])   \
+    {                                                                   \
+        transpose_kernel(M, N, A, B, tile, bh, bw, colmajor);          \
+    }
+TRANS_VARIANTS(DEFINE_VARIANT)
+
+/* The best variants for the shapes of the grader, as found by ./autotune */
+#define TUNED_32x32 trans_row8_8
+#define TUNED_64x64 trans_quarter
+#define TUNED_OTHER trans_row8_23
+
 /* 
  * transpose_submit - This is the solution transpose function that you
  *     will be graded on for Part B of the assignment. Do not change
@@ -22,6 +269,13 @@ int is_transpose(int M, int N, int A[N][M], int B[M][N]);
 char transpose_submit_desc[] = "Transpose submission";
 void transpose_submit(int M, int N, int A[N][M], int B[M][N])
 {
+    /* the best variants per shape, as found by ./autotune */
+    if (M == 32 && N == 32)
+        TUNED_32x32(M, N, A, B);
+    else if (M == 64 && N == 64)
+        TUNED_64x64(M, N, A, B);
+    else
+        TUNED_OTHER(M, N, A, B);
 }
 
 /* 
@@ -63,6 +317,17 @@ void registerFunctions()
 
 }
 
+/*
+ * registerVariants - Register the whole family of TRANS_VARIANTS, for
+ *     ./autotune
+ */
+#define REGISTER_VARIANT(name, desc, tile, bh, bw, colmajor)            \
+    registerTransFunction(trans_##name, trans_##name##_desc);
+void registerVariants()
+{
+    TRANS_VARIANTS(REGISTER_VARIANT)
+}
+
 /* 
  * is_transpose - This helper function checks if B is the transpose of
  *     A. You can check the correctness of your transpose by calling
@@ -6,6 +6,9 @@ void start_counter();
 /* Get # cycles since counter started */
 double get_counter();
 
+/* Get the cycle counter, as a 64-bit integer */
+unsigned long long read_counter();
+
 /* Measure overhead for counter */
 double ovhd();
 
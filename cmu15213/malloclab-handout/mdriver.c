@@ -15,11 +15,17 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "clock.h"
 #include "config.h"
+#include "trace.h"
 
 /**********************
  * Constants and macros
@@ -30,6 +36,10 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Latency histograms: HIST_SUB buckets for each power of 2 of cycles */
+#define HIST_SUB      16
+#define HIST_BUCKETS  (64 * HIST_SUB)
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
 
@@ -44,13 +54,6 @@ typedef struct range_t {
     struct range_t *next;  /* next list element */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
-
 /* Holds the information for one trace file*/
 typedef struct {
     int sugg_heapsize;   /* suggested heap size (unused) */
@@ -60,6 +63,8 @@ typedef struct {
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void *map;           /* the mapping of a binary trace file, or NULL */
+    size_t map_len;      /* and its length */
 } trace_t;
 
 /* 
@@ -72,6 +77,36 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* The params of a thread replaying its part of a trace (see -T) */
+typedef struct {
+    trace_t *trace;
+    int id;                     /* the thread replays the ids id mod nthreads */
+    int nthreads;
+    pthread_barrier_t *start;
+    int errors;                 /* number of corrupted blocks found */
+} thread_t;
+
+/* The latencies of one type of request, in cycles */
+typedef struct {
+    unsigned long count;
+    unsigned long long max;
+    unsigned long buckets[HIST_BUCKETS];
+} hist_t;
+
+/* The heap at some point of a trace */
+typedef struct {
+    int op;          /* number of requests done */
+    long payload;    /* total payload of the allocated blocks */
+    long heapsize;   /* size of the heap */
+} sample_t;
+
+/* The profile of mm malloc on a trace (see -H, -S and -o) */
+typedef struct {
+    hist_t lat[3];      /* latencies of ALLOC, FREE and REALLOC requests */
+    sample_t *samples;  /* the fragmentation curve */
+    int num_samples;
+} prof_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
@@ -90,6 +125,15 @@ typedef struct {
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static int check_heap = 0; /* if set, call mm_check() after each request (-c) */
+static int max_threads = 0; /* if set, run the threaded benchmark (-T) */
+static int nr_arenas = 0;   /* arenas of the threaded benchmark, 0 for one
+                               per thread (-A) */
+static int print_prof = 0;  /* if set, print the latencies and fragmentation (-H) */
+static int sample_ops = 1000; /* sample the fragmentation every sample_ops
+                                 requests (-S) */
+static char *prof_file = NULL; /* write the profiles in this CSV or JSON file (-o) */
+static char *op_names[] = {"malloc", "free", "realloc"};
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
@@ -113,6 +157,7 @@ static void clear_ranges(range_t **ranges);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static void read_bin_trace(char *path, int fd, trace_t *trace);
 static void free_trace(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
@@ -124,6 +169,11 @@ static void eval_libc_speed(void *ptr);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_threads(char **tracefiles, int num_tracefiles);
+static void eval_mm_prof(trace_t *trace, prof_t *prof);
+static void print_profs(int n, char **tracefiles, prof_t *profs);
+static void write_profs(int n, char **tracefiles, prof_t *profs, stats_t *stats);
+static void free_profs(int n, prof_t *profs);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
@@ -145,6 +195,7 @@ int main(int argc, char **argv)
     range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
+    prof_t *mm_profs = NULL;   /* mm latencies and fragmentation for each trace */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
@@ -158,7 +209,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:hvVgalcT:A:HS:o:")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -184,6 +235,36 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'c': /* Check the heap after each request */
+            check_heap = 1;
+            break;
+        case 'T': /* Run the threaded benchmark with 1 to n threads */
+            max_threads = atoi(optarg);
+            if (max_threads < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'A': /* Number of arenas of the threaded benchmark */
+            nr_arenas = atoi(optarg);
+            if (nr_arenas < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'H': /* Print the latencies and fragmentation of each trace */
+            print_prof = 1;
+            break;
+        case 'S': /* Fragmentation sampling interval */
+            sample_ops = atoi(optarg);
+            if (sample_ops < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'o': /* Write the profiles of the traces to a file */
+            prof_file = strdup(optarg);
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -283,6 +364,9 @@ int main(int argc, char **argv)
     mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
     if (mm_stats == NULL)
 	unix_error("mm_stats calloc in main failed");
+    if ((print_prof || prof_file != NULL) &&
+	(mm_profs = (prof_t *)calloc(num_tracefiles, sizeof(prof_t))) == NULL)
+	unix_error("mm_profs calloc in main failed");
     
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
@@ -303,6 +387,8 @@ int main(int argc, char **argv)
 	    if (verbose > 1)
 		printf("and performance.\n");
 	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    if (mm_profs != NULL)
+		eval_mm_prof(trace, &mm_profs[i]);
 	}
 	free_trace(trace);
     }
@@ -314,6 +400,14 @@ int main(int argc, char **argv)
 	printf("\n");
     }
 
+    /* Display and save the latencies and fragmentation of mm malloc */
+    if (print_prof)
+	print_profs(num_tracefiles, tracefiles, mm_profs);
+    if (prof_file != NULL)
+	write_profs(num_tracefiles, tracefiles, mm_profs, mm_stats);
+    if (mm_profs != NULL)
+	free_profs(num_tracefiles, mm_profs);
+
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
      */
@@ -357,6 +451,12 @@ int main(int argc, char **argv)
 	printf("Terminated with %d errors\n", errors);
     }
 
+    /*
+     * Optionally evaluate the scaling of the mm package with threads
+     */
+    if (max_threads > 0 && errors == 0)
+	eval_mm_threads(tracefiles, num_tracefiles);
+
     if (autograder) {
 	printf("correct:%d\n", numcorrect);
 	printf("perfidx:%.0f\n", perfindex);
@@ -469,7 +569,8 @@ static void clear_ranges(range_t **ranges)
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_trace - read a trace file and store it in memory. Binary trace
+ *     files (see trace.h) are mapped by read_bin_trace().
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
@@ -480,6 +581,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
     unsigned index, size;
     unsigned max_index = 0;
     unsigned op_index;
+    uint32_t magic;
 
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
@@ -495,6 +597,13 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
     }
+    if (fread(&magic, sizeof(magic), 1, tracefile) == 1 && magic == TRACE_MAGIC) {
+	read_bin_trace(path, fileno(tracefile), trace);
+	fclose(tracefile);
+	return trace;
+    }
+    rewind(tracefile);
+    trace->map = NULL;
     fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
     fscanf(tracefile, "%d", &(trace->num_ids));     
     fscanf(tracefile, "%d", &(trace->num_ops));     
@@ -554,13 +663,67 @@ static trace_t *read_trace(char *tracedir, char *filename)
     return trace;
 }
 
+/*
+ * read_bin_trace - map the binary trace file open on fd and use its
+ *     requests in place. Only the arrays of blocks are allocated. The
+ *     requests are checked, so that a bad file cannot make the driver
+ *     write out of these arrays.
+ */
+static void read_bin_trace(char *path, int fd, trace_t *trace)
+{
+    struct stat st;
+    tracehdr_t *hdr;
+    int i;
+
+    if (fstat(fd, &st) < 0)
+	unix_error("fstat failed in read_bin_trace");
+    trace->map_len = st.st_size;
+    if ((trace->map = mmap(NULL, trace->map_len, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+	unix_error("mmap failed in read_bin_trace");
+    madvise(trace->map, trace->map_len, MADV_SEQUENTIAL);
+
+    hdr = trace->map;
+    if (trace->map_len < sizeof(tracehdr_t) || hdr->version != TRACE_VERSION ||
+	hdr->num_ops < 0 || hdr->num_ids < 0 ||
+	trace->map_len != sizeof(tracehdr_t) + (size_t)hdr->num_ops * sizeof(traceop_t)) {
+	sprintf(msg, "Bad binary trace header in %s", path);
+	app_error(msg);
+    }
+    trace->sugg_heapsize = hdr->sugg_heapsize; /* not used */
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;               /* not used */
+    trace->ops = (traceop_t *)(hdr + 1);
+
+    for (i = 0; i < trace->num_ops; i++) {
+	traceop_t *op = &trace->ops[i];
+	if (op->index < 0 || op->index >= trace->num_ids ||
+	    (op->type != ALLOC && op->type != FREE && op->type != REALLOC) ||
+	    (op->type != FREE && op->size < 0)) {
+	    sprintf(msg, "Bad request %d in binary trace %s", i, path);
+	    app_error(msg);
+	}
+    }
+
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in read_bin_trace");
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in read_bin_trace");
+}
+
 /*
  * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ *              to, all of which were allocated in read_trace(), or
+ *              unmap the binary trace file the requests are in.
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map != NULL)   /* free the three arrays... */
+	munmap(trace->map, trace->map_len);
+    else
+	free(trace->ops);
     free(trace->blocks);      
     free(trace->block_sizes);
     free(trace);              /* and the trace record itself... */
@@ -653,7 +816,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -678,6 +841,11 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 
+	/* Optionally check the consistency of the heap */
+	if (check_heap && !mm_check(0)) {
+	    malloc_error(tracenum, i, "mm_check found an inconsistent heap.");
+	    return 0;
+	}
     }
 
     /* As far as we know, this is a valid malloc package */
@@ -825,6 +993,405 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * hist_add - Add a latency of v cycles to the histogram h. The buckets
+ *     are exact below HIST_SUB cycles, and 1/HIST_SUB of a power of 2
+ *     wide above.
+ */
+static void hist_add(hist_t *h, unsigned long long v)
+{
+    int e, i;
+
+    if (v < HIST_SUB)
+	i = v;
+    else {
+	e = 63 - __builtin_clzll(v);
+	i = (e - 3) * HIST_SUB + ((v >> (e - 4)) & (HIST_SUB - 1));
+    }
+    h->buckets[i]++;
+    h->count++;
+    if (v > h->max)
+	h->max = v;
+}
+
+/*
+ * hist_percentile - The latency below which a fraction p of the requests
+ *     of the histogram h are, rounded up to the end of its bucket
+ */
+static unsigned long long hist_percentile(hist_t *h, double p)
+{
+    unsigned long rank = (unsigned long)(p * h->count + 0.999999), n = 0;
+    unsigned long long end;
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS; i++) {
+	n += h->buckets[i];
+	if (n >= rank && n > 0) {
+	    if (i < HIST_SUB)
+		end = i;
+	    else
+		end = ((unsigned long long)(HIST_SUB + i % HIST_SUB + 1)
+		       << (i / HIST_SUB - 1)) - 1;
+	    return end < h->max ? end : h->max;
+	}
+    }
+    return h->max;
+}
+
+/* frag - The fragmentation of the heap at the sample s */
+static double frag(sample_t *s)
+{
+    return s->heapsize > 0 ? 1.0 - (double)s->payload / s->heapsize : 0.0;
+}
+
+/*
+ * eval_mm_prof - Replay the trace once more, timing each request with the
+ *     cycle counter, less the overhead of reading it, and sampling the
+ *     payload and the size of the heap every sample_ops requests and at
+ *     the end.
+ */
+static void eval_mm_prof(trace_t *trace, prof_t *prof)
+{
+    int i, index, size;
+    long payload = 0;
+    unsigned long long t0, t1, ovhd = ~0ULL;
+    char *p;
+
+    for (i = 0; i < 100; i++) {
+	t0 = read_counter();
+	t1 = read_counter();
+	if (t1 - t0 < ovhd)
+	    ovhd = t1 - t0;
+    }
+
+    if ((prof->samples = malloc((trace->num_ops / sample_ops + 2) * sizeof(sample_t))) == NULL)
+	unix_error("malloc failed in eval_mm_prof");
+    prof->num_samples = 0;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_prof");
+
+    for (i = 0;  i <= trace->num_ops;  i++) {
+	if (i % sample_ops == 0 || i == trace->num_ops)
+	    prof->samples[prof->num_samples++] =
+		(sample_t){ i, payload, (long)mem_heapsize() };
+	if (i == trace->num_ops)
+	    break;
+
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	switch (trace->ops[i].type) {
+	case ALLOC: /* mm_malloc */
+	    t0 = read_counter();
+	    p = mm_malloc(size);
+	    t1 = read_counter();
+	    if (p == NULL)
+		app_error("mm_malloc failed in eval_mm_prof");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    payload += size;
+	    break;
+	case REALLOC: /* mm_realloc */
+	    t0 = read_counter();
+	    p = mm_realloc(trace->blocks[index], size);
+	    t1 = read_counter();
+	    if (p == NULL)
+		app_error("mm_realloc failed in eval_mm_prof");
+	    payload += size - (long)trace->block_sizes[index];
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+	case FREE: /* mm_free */
+	    t0 = read_counter();
+	    mm_free(trace->blocks[index]);
+	    t1 = read_counter();
+	    payload -= trace->block_sizes[index];
+	    break;
+	default:
+	    app_error("Nonexistent request type in eval_mm_prof");
+	}
+	hist_add(&prof->lat[trace->ops[i].type], t1 - t0 > ovhd ? t1 - t0 - ovhd : 0);
+    }
+}
+
+/*
+ * print_profs - Print the latency percentiles of each type of request,
+ *     and the average and largest fragmentation of the heap, per trace.
+ *     The samples without any allocated block, such as the first and the
+ *     last of a balanced trace, are left out of the fragmentation.
+ */
+static void print_profs(int n, char **tracefiles, prof_t *profs)
+{
+    int i, j, k, m;
+    hist_t *h;
+    double f, sum, max;
+
+    printf("Latency of mm malloc (cycles):\n");
+    printf("%5s %-8s%10s%9s%9s%9s%11s\n", "trace", "request", "count", "p50",
+	   "p99", "p99.9", "max");
+    for (i = 0; i < n; i++) {
+	for (j = 0; j < 3; j++) {
+	    h = &profs[i].lat[j];
+	    if (h->count == 0)
+		continue;
+	    printf("%5d %-8s%10lu%9llu%9llu%9llu%11llu\n", i, op_names[j],
+		   h->count, hist_percentile(h, 0.5), hist_percentile(h, 0.99),
+		   hist_percentile(h, 0.999), h->max);
+	}
+    }
+
+    printf("\nFragmentation of mm malloc (1 - payload/heap, every %d requests):\n",
+	   sample_ops);
+    printf("%5s %8s%7s%7s  %s\n", "trace", "samples", "avg", "max", "file");
+    for (i = 0; i < n; i++) {
+	if (profs[i].num_samples == 0)  /* invalid trace */
+	    continue;
+	sum = max = 0;
+	for (k = m = 0; k < profs[i].num_samples; k++) {
+	    if (profs[i].samples[k].payload == 0)
+		continue;
+	    f = frag(&profs[i].samples[k]);
+	    sum += f;
+	    max = f > max ? f : max;
+	    m++;
+	}
+	printf("%5d %8d%6.0f%%%6.0f%%  %s\n", i, m, m > 0 ? 100 * sum / m : 0.0,
+	       100 * max, tracefiles[i]);
+    }
+    printf("\n");
+}
+
+/* json_string - Write s as a JSON string */
+static void json_string(FILE *fp, char *s)
+{
+    putc('"', fp);
+    for (; *s != '\0'; s++) {
+	if (*s == '"' || *s == '\\')
+	    putc('\\', fp);
+	putc(*s, fp);
+    }
+    putc('"', fp);
+}
+
+/*
+ * write_profs - Write the profiles of the traces to prof_file, as JSON if
+ *     its name ends in .json, and as CSV otherwise. The CSV file has a
+ *     row per value: trace,series,x,value. The series are summary,
+ *     the request types (x is count, p50, p99, p99.9 or max), and
+ *     payload, heapsize and frag (x is the number of requests done).
+ */
+static void write_profs(int n, char **tracefiles, prof_t *profs, stats_t *stats)
+{
+    FILE *fp;
+    int i, j, k, json;
+    size_t len = strlen(prof_file);
+    static double pcts[] = {0.5, 0.99, 0.999};
+    static char *pct_names[] = {"p50", "p99", "p99.9"};
+    hist_t *h;
+    sample_t *s;
+
+    json = len >= 5 && strcmp(prof_file + len - 5, ".json") == 0;
+    if ((fp = fopen(prof_file, "w")) == NULL) {
+	sprintf(msg, "Could not open %s in write_profs", prof_file);
+	unix_error(msg);
+    }
+
+    if (json)
+	fprintf(fp, "{\"sample_ops\": %d, \"traces\": [", sample_ops);
+    else
+	fprintf(fp, "trace,series,x,value\n");
+    for (i = 0; i < n; i++) {
+	if (json) {
+	    fprintf(fp, "%s\n  {\"trace\": ", i > 0 ? "," : "");
+	    json_string(fp, tracefiles[i]);
+	    fprintf(fp, ", \"valid\": %s", stats[i].valid ? "true" : "false");
+	    if (!stats[i].valid) {
+		fprintf(fp, "}");
+		continue;
+	    }
+	    fprintf(fp, ", \"ops\": %.0f, \"util\": %.6f, \"kops\": %.0f,\n",
+		    stats[i].ops, stats[i].util, stats[i].ops / 1e3 / stats[i].secs);
+	    fprintf(fp, "   \"latency\": {");
+	    for (j = 0; j < 3; j++) {
+		h = &profs[i].lat[j];
+		fprintf(fp, "%s\"%s\": {\"count\": %lu", j > 0 ? ", " : "",
+			op_names[j], h->count);
+		for (k = 0; k < 3; k++)
+		    fprintf(fp, ", \"%s\": %llu", pct_names[k], hist_percentile(h, pcts[k]));
+		fprintf(fp, ", \"max\": %llu}", h->max);
+	    }
+	    fprintf(fp, "},\n   \"fragmentation\": [");
+	    for (k = 0; k < profs[i].num_samples; k++) {
+		s = &profs[i].samples[k];
+		fprintf(fp, "%s{\"op\": %d, \"payload\": %ld, \"heapsize\": %ld, \"frag\": %.6f}",
+			k > 0 ? ",\n     " : "\n     ", s->op, s->payload, s->heapsize, frag(s));
+	    }
+	    fprintf(fp, "]}");
+	} else {
+	    if (!stats[i].valid)
+		continue;
+	    fprintf(fp, "%s,summary,ops,%.0f\n", tracefiles[i], stats[i].ops);
+	    fprintf(fp, "%s,summary,util,%.6f\n", tracefiles[i], stats[i].util);
+	    fprintf(fp, "%s,summary,kops,%.0f\n", tracefiles[i],
+		    stats[i].ops / 1e3 / stats[i].secs);
+	    for (j = 0; j < 3; j++) {
+		h = &profs[i].lat[j];
+		fprintf(fp, "%s,%s,count,%lu\n", tracefiles[i], op_names[j], h->count);
+		for (k = 0; k < 3; k++)
+		    fprintf(fp, "%s,%s,%s,%llu\n", tracefiles[i], op_names[j],
+			    pct_names[k], hist_percentile(h, pcts[k]));
+		fprintf(fp, "%s,%s,max,%llu\n", tracefiles[i], op_names[j], h->max);
+	    }
+	    for (k = 0; k < profs[i].num_samples; k++) {
+		s = &profs[i].samples[k];
+		fprintf(fp, "%s,payload,%d,%ld\n", tracefiles[i], s->op, s->payload);
+		fprintf(fp, "%s,heapsize,%d,%ld\n", tracefiles[i], s->op, s->heapsize);
+		fprintf(fp, "%s,frag,%d,%.6f\n", tracefiles[i], s->op, frag(s));
+	    }
+	}
+    }
+    if (json)
+	fprintf(fp, "\n]}\n");
+    fclose(fp);
+}
+
+/*
+ * free_profs - Free the fragmentation samples and the profiles themselves
+ */
+static void free_profs(int n, prof_t *profs)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+	free(profs[i].samples);
+    free(profs);
+}
+
+/*
+ * eval_mm_thread - The thread function of eval_mm_threads(). It replays
+ *    the requests of the trace on the blocks with an id equal to the id of
+ *    the thread modulo the number of threads. The requests on a block are
+ *    replayed in order by a single thread, but those on different blocks
+ *    run in parallel. The first and last bytes of each block are tagged
+ *    with its id, and checked when it is freed or reallocated, to catch
+ *    blocks given to two threads.
+ */
+static void *eval_mm_thread(void *ptr)
+{
+    thread_t *t = ptr;
+    trace_t *trace = t->trace;
+    int i, index, size;
+    char *p;
+
+    pthread_barrier_wait(t->start);
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	if (index % t->nthreads != t->id)
+	    continue;
+	size = trace->ops[i].size;
+
+	if (trace->ops[i].type != ALLOC) {
+	    p = trace->blocks[index];
+	    if (p[0] != (char)index || p[trace->block_sizes[index] - 1] != (char)index)
+		t->errors++;
+	}
+	switch (trace->ops[i].type) {
+	case ALLOC: /* mm_malloc */
+	    if ((p = mm_malloc(size)) == NULL)
+		app_error("mm_malloc error in eval_mm_thread");
+	    break;
+	case REALLOC: /* mm_realloc */
+	    if ((p = mm_realloc(trace->blocks[index], size)) == NULL)
+		app_error("mm_realloc error in eval_mm_thread");
+	    break;
+	case FREE: /* mm_free */
+	    mm_free(trace->blocks[index]);
+	    continue;
+	default:
+	    app_error("Nonexistent request type in eval_mm_thread");
+	}
+	p[0] = p[size - 1] = (char)index;
+	trace->blocks[index] = p;
+	trace->block_sizes[index] = size;
+    }
+    return NULL;
+}
+
+/*
+ * eval_mm_threads - Measure the throughput of the mm package with 1 to
+ *    max_threads threads, which replay each trace together, and print
+ *    it with the lock statistics of the arenas. The total work is the
+ *    same for any number of threads, so the speedup is the ratio of the
+ *    times. The time of a trace is the best of 3 runs.
+ */
+static void eval_mm_threads(char **tracefiles, int num_tracefiles)
+{
+    int n, i, j, run, arenas, errs = 0;
+    double ops, secs, base_secs = 0, best, t0, t1;
+    unsigned long locks, contended, total_locks, total_contended;
+    struct timespec ts;
+    pthread_barrier_t start;
+    pthread_t *tids = malloc(max_threads * sizeof(pthread_t));
+    thread_t *threads = malloc(max_threads * sizeof(thread_t));
+    trace_t *trace;
+
+    if (tids == NULL || threads == NULL)
+	unix_error("malloc failed in eval_mm_threads");
+    printf("\nResults for mm malloc with threads (requests split by block id):\n");
+    printf("%7s%7s%9s%10s%9s%8s%10s%10s\n", "threads", "arenas", "ops", "secs",
+	   "Kops", "speedup", "locks", "contended");
+    for (n = 1; n <= max_threads; n++) {
+	arenas = (nr_arenas > 0 && nr_arenas < n) ? nr_arenas : n;
+	ops = secs = 0;
+	total_locks = total_contended = 0;
+	for (i = 0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    best = DBL_MAX;
+	    for (run = 0; run < 3; run++) {
+		mem_reset_brk();
+		if (mm_init_arenas(arenas) < 0)
+		    app_error("mm_init_arenas failed in eval_mm_threads");
+		pthread_barrier_init(&start, NULL, n + 1);
+		for (j = 0; j < n; j++) {
+		    threads[j] = (thread_t){ trace, j, n, &start, 0 };
+		    if (pthread_create(&tids[j], NULL, eval_mm_thread, &threads[j]) != 0)
+			unix_error("pthread_create failed in eval_mm_threads");
+		}
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		t0 = ts.tv_sec + ts.tv_nsec * 1e-9;
+		pthread_barrier_wait(&start);
+		for (j = 0; j < n; j++) {
+		    pthread_join(tids[j], NULL);
+		    errs += threads[j].errors;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		t1 = ts.tv_sec + ts.tv_nsec * 1e-9;
+		pthread_barrier_destroy(&start);
+		if (t1 - t0 < best)
+		    best = t1 - t0;
+		if (check_heap && !mm_check(0))
+		    malloc_error(i, trace->num_ops, "mm_check found an inconsistent heap after the threads.");
+	    }
+	    mm_lock_stats(&locks, &contended);
+	    total_locks += locks;
+	    total_contended += contended;
+	    ops += trace->num_ops;
+	    secs += best;
+	    free_trace(trace);
+	}
+	if (n == 1)
+	    base_secs = secs;
+	printf("%7d%7d%9.0f%10.6f%9.0f%8.2f%10lu%9.1f%%\n", n, arenas, ops, secs,
+	       (ops / 1e3) / secs, base_secs / secs, total_locks,
+	       total_locks ? 100.0 * total_contended / total_locks : 0.0);
+    }
+    if (errs > 0)
+	printf("ERROR: %d blocks were corrupted by another thread\n", errs);
+    free(tids);
+    free(threads);
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -1004,14 +1571,21 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValcH] [-f <file>] [-t <dir>] [-S <n>] [-o <file>] [-T <n> [-A <n>]]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-c         Check the heap with mm_check() after each request.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-H         Print the latencies and fragmentation of each trace.\n");
+    fprintf(stderr, "\t-S <n>     Sample the fragmentation every <n> requests.\n");
+    fprintf(stderr, "\t-o <file>  Write the latencies and fragmentation to a CSV\n");
+    fprintf(stderr, "\t           file, or a JSON one if <file> ends in .json.\n");
+    fprintf(stderr, "\t-T <n>     Measure the throughput with 1 to <n> threads.\n");
+    fprintf(stderr, "\t-A <n>     Use at most <n> arenas with -T, one per thread by default.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
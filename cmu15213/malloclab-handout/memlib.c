@@ -14,7 +14,8 @@
 #include "memlib.h"
 #include "config.h"
 
-/* private variables */
+/* private variables, mem_brk is only accessed atomically, so that
+   mem_sbrk() can be called by several threads */
 static char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
@@ -57,17 +58,37 @@ void mem_reset_brk()
  */
 void *mem_sbrk(int incr) 
 {
-    char *old_brk = mem_brk;
+    char *old_brk = __atomic_load_n(&mem_brk, __ATOMIC_RELAXED);
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
-	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
-	return (void *)-1;
-    }
-    mem_brk += incr;
+    do {
+	if ( (incr < 0) || ((old_brk + incr) > mem_max_addr)) {
+	    errno = ENOMEM;
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	    return (void *)-1;
+	}
+    } while (!__atomic_compare_exchange_n(&mem_brk, &old_brk, old_brk + incr, 0,
+					  __ATOMIC_RELAXED, __ATOMIC_RELAXED));
     return (void *)old_brk;
 }
 
+/*
+ * mem_sbrk_at - Extends the heap like mem_sbrk, but only if the break is
+ *    still at brk, so that a thread can grow the area it got from the
+ *    last mem_sbrk(). Returns brk, or (void *)-1 without an error message
+ *    if another thread has moved the break, or if it runs out of memory.
+ */
+void *mem_sbrk_at(void *brk, int incr)
+{
+    char *old_brk = brk;
+
+    if ( (incr < 0) || (((char *)brk + incr) > mem_max_addr))
+	return (void *)-1;
+    if (!__atomic_compare_exchange_n(&mem_brk, &old_brk, (char *)brk + incr, 0,
+				     __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	return (void *)-1;
+    return brk;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -81,7 +102,7 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return (void *)(__atomic_load_n(&mem_brk, __ATOMIC_RELAXED) - 1);
 }
 
 /*
@@ -89,7 +110,7 @@ void *mem_heap_hi()
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return (size_t)(__atomic_load_n(&mem_brk, __ATOMIC_RELAXED) - mem_start_brk);
 }
 
 /*
@@ -1,22 +1,66 @@
 /*
- * mm-naive.c - The fastest, least memory-efficient malloc package.
- * 
- * In this naive approach, a block is allocated by simply incrementing
- * the brk pointer.  A block is pure payload. There are no headers or
- * footers.  Blocks are never coalesced or reused. Realloc is
- * implemented directly using mm_malloc and mm_free.
+ * mm.c - A segregated-fit allocator with boundary tags.
  *
- * NOTE TO STUDENTS: Replace this header comment with your own header
- * comment that gives a high level description of your solution.
+ * Blocks: every block has a 4-byte header holding its size (a multiple
+ * of 8, including the header) and two flags: whether the block is
+ * allocated, and whether the previous block is allocated. Only free
+ * blocks have a footer, a copy of the header in their last word, which
+ * is read when the next block is freed and needs to coalesce backwards.
+ * The prev-alloc flag tells whether the footer exists, so allocated
+ * blocks use their whole size except the header for the payload.
+ *
+ *   allocated:  | hdr | payload ...                          |
+ *   free:       | hdr | next | prev | ...              | ftr |
+ *
+ * The payloads are 8-byte aligned, so the headers are at 4 mod 8, and
+ * the smallest block is 16 bytes.
+ *
+ * Free blocks: the blocks smaller than TREE_MIN are in NR_LIST doubly
+ * linked lists, one for each size, so that any block of the first
+ * nonempty list which is large enough is a best fit. The larger blocks
+ * are in a splay tree ordered by size, then by address, so that the best
+ * fit is found in O(log n) amortized time however many sizes there are.
+ * The two links of a free block are the next and previous blocks of its
+ * list, or the left and right children in the tree. They are 4-byte
+ * offsets from the start of the heap, rather than pointers, so that the
+ * smallest free block holds both of them on 32-bit and 64-bit hosts
+ * alike; offset 0 is the null link. Blocks are freed with immediate
+ * coalescing, and inserted at the head of their list.
+ *
+ * Heap:  | arenas | owner map | block | block | ... | epilogue hdr |
+ *
+ * The epilogue is a zero-sized allocated header, which ends the walks
+ * of the heap. There is no prologue: the first block is marked with an
+ * allocated previous block.
+ *
+ * mm_realloc() resizes in place when it can: it shrinks by splitting,
+ * grows into a free next block, or into the end of the heap by extending
+ * the heap just by the missing bytes.
+ *
+ * Arenas: the free lists and the tree are those of an arena, and
+ * mm_init_arenas(n) creates n arenas for multi-threaded programs; mm_init()
+ * creates one. The threads are spread over the arenas, and a thread
+ * allocates from its own arena, so that the threads rarely wait for each
+ * other. Each arena has a lock, which is not taken when there is a single
+ * arena. An arena grows its last chunk of heap in place if no one has
+ * extended the heap since, or else starts a new chunk, which is aligned
+ * to ARENA_PAGE so that the owner map tells the arena of any page of the
+ * heap. A block is freed in the arena of its page, by any thread.
+ *
+ * mm_check() checks the invariants of the heap and the lists, see
+ * mdriver -c.
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "mm.h"
 #include "memlib.h"
+#include "config.h"
 
 /*********************************************************
  * NOTE TO STUDENTS: Before you do anything else, please
@@ -41,70 +85,817 @@ team_t team = {
 /* rounds up to the nearest multiple of ALIGNMENT */
 #define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
 
+#define WSIZE     4       /* header, footer and link size */
+#define MIN_BLOCK 16      /* header, two links and footer */
+#define TREE_MIN  128     /* smallest block in the tree */
+#define NR_LIST   ((TREE_MIN - MIN_BLOCK) / ALIGNMENT) /* one per size */
 
-#define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
+#define MAX_ARENAS  64
+#define ARENA_PAGE  4096        /* granularity of the owner map */
+#define ARENA_CHUNK (64 << 10)  /* smallest extension with several arenas */
 
-/* 
- * mm_init - initialize the malloc package.
+/*
+ * Requests of at least this size are placed at the end of the free block
+ * they split, and the smaller ones at its start, so that blocks of
+ * different sizes do not interleave, and free blocks coalesce better.
  */
-int mm_init(void)
+#define PLACE_BACK 96
+
+/* Pack a size and the flags into a header */
+#define ALLOC      1
+#define PREV_ALLOC 2
+#define PACK(size, flags) ((uint32_t)(size) | (flags))
+
+/* Read and write a word at address p */
+#define GET(p)      (*(uint32_t *)(p))
+#define PUT(p, val) (*(uint32_t *)(p) = (val))
+
+/* Read the size and the flags of a header at address p */
+#define GET_SIZE(p)       (GET(p) & ~0x7)
+#define GET_ALLOC(p)      (GET(p) & ALLOC)
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+
+/* Given a block ptr bp, compute the address of its header and footer */
+#define HDRP(bp) ((char *)(bp) - WSIZE)
+#define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - 2 * WSIZE)
+
+/* Given a block ptr bp, compute the address of the next and previous
+   blocks; the previous one only if it is free */
+#define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)))
+#define PREV_BLKP(bp) ((char *)(bp) - GET_SIZE((char *)(bp) - 2 * WSIZE))
+
+/* The links of a free block, and the conversions between offsets and
+   block pointers */
+#define NEXT_FREE(bp) (((uint32_t *)(bp))[0])
+#define PREV_FREE(bp) (((uint32_t *)(bp))[1])
+#define LEFT(bp)      (((uint32_t *)(bp))[0])
+#define RIGHT(bp)     (((uint32_t *)(bp))[1])
+#define OFFSET(bp)    ((uint32_t)((char *)(bp) - heap_base))
+#define BLOCK(off)    (heap_base + (off))
+
+typedef struct {
+    uint32_t heads[NR_LIST];  /* heads of the free lists */
+    uint32_t root;            /* root of the tree */
+    uint32_t end;             /* epilogue of the last chunk, as a block */
+    pthread_mutex_t lock;
+    unsigned long nr_lock, nr_contended;
+} arena_t;
+
+static char *heap_base;   /* mem_heap_lo() */
+static char *heap_listp;  /* the first block */
+static arena_t *arenas;   /* at heap_base */
+static int nr_arenas;
+static uint8_t *owner;    /* arena of each page of the heap, if several */
+static unsigned int generation, next_home; /* to spread the threads */
+
+static __thread arena_t *cur;    /* the arena of the block being worked on */
+static __thread arena_t *home;   /* the arena of the thread */
+static __thread unsigned int home_generation;
+
+static void *extend_heap(size_t asize);
+static void *coalesce(void *bp);
+static void *place(void *bp, size_t asize);
+
+/*
+ * adjust - The block size for a payload of size bytes
+ */
+static inline size_t adjust(size_t size)
 {
+    size_t asize = ALIGN(size + WSIZE);
+    return asize < MIN_BLOCK ? MIN_BLOCK : asize;
+}
+
+/*
+ * size_class - The free list of a block of size bytes, below TREE_MIN
+ */
+static inline int size_class(size_t size)
+{
+    return (size - MIN_BLOCK) / ALIGNMENT;
+}
+
+/*
+ * set_prev_alloc - Set the prev-alloc flag of the block after bp
+ */
+static inline void set_prev_alloc(void *bp, int alloc)
+{
+    char *hp = HDRP(NEXT_BLKP(bp));
+    PUT(hp, alloc ? (GET(hp) | PREV_ALLOC) : (GET(hp) & ~PREV_ALLOC));
+}
+
+/*
+ * key_less - Compare the tree keys (size, offset) of two blocks
+ */
+static inline int key_less(size_t size1, uint32_t off1, size_t size2, uint32_t off2)
+{
+    return size1 < size2 || (size1 == size2 && off1 < off2);
+}
+
+/*
+ * splay - Top-down splay of the tree t on the key (size, off), and return
+ *     the new root, which is the node of the key if it is in the tree, or
+ *     else its predecessor or successor in the tree.
+ */
+static uint32_t splay(uint32_t t, size_t size, uint32_t off)
+{
+    uint32_t left_tree = 0, right_tree = 0, y;
+    uint32_t *left_hook = &left_tree;   /* right link of the max of the left tree */
+    uint32_t *right_hook = &right_tree; /* left link of the min of the right tree */
+
+    if (t == 0)
+        return 0;
+    for (;;) {
+        char *bp = BLOCK(t);
+        size_t tsize = GET_SIZE(HDRP(bp));
+        if (key_less(size, off, tsize, t)) {
+            if ((y = LEFT(bp)) == 0)
+                break;
+            if (key_less(size, off, GET_SIZE(HDRP(BLOCK(y))), y)) {
+                /* rotate right */
+                LEFT(bp) = RIGHT(BLOCK(y));
+                RIGHT(BLOCK(y)) = t;
+                t = y;
+                bp = BLOCK(t);
+                if (LEFT(bp) == 0)
+                    break;
+            }
+            /* link right */
+            *right_hook = t;
+            right_hook = &LEFT(bp);
+            t = LEFT(bp);
+        } else if (key_less(tsize, t, size, off)) {
+            if ((y = RIGHT(bp)) == 0)
+                break;
+            if (key_less(GET_SIZE(HDRP(BLOCK(y))), y, size, off)) {
+                /* rotate left */
+                RIGHT(bp) = LEFT(BLOCK(y));
+                LEFT(BLOCK(y)) = t;
+                t = y;
+                bp = BLOCK(t);
+                if (RIGHT(bp) == 0)
+                    break;
+            }
+            /* link left */
+            *left_hook = t;
+            left_hook = &RIGHT(bp);
+            t = RIGHT(bp);
+        } else {
+            break;
+        }
+    }
+    /* assemble */
+    *left_hook = LEFT(BLOCK(t));
+    *right_hook = RIGHT(BLOCK(t));
+    LEFT(BLOCK(t)) = left_tree;
+    RIGHT(BLOCK(t)) = right_tree;
+    return t;
+}
+
+/*
+ * tree_insert - Insert a free block in the tree
+ */
+static void tree_insert(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    uint32_t off = OFFSET(bp), t = splay(cur->root, size, off);
+
+    if (t == 0) {
+        LEFT(bp) = RIGHT(bp) = 0;
+    } else if (key_less(size, off, GET_SIZE(HDRP(BLOCK(t))), t)) {
+        LEFT(bp) = LEFT(BLOCK(t));
+        RIGHT(bp) = t;
+        LEFT(BLOCK(t)) = 0;
+    } else {
+        RIGHT(bp) = RIGHT(BLOCK(t));
+        LEFT(bp) = t;
+        RIGHT(BLOCK(t)) = 0;
+    }
+    cur->root = off;
+}
+
+/*
+ * tree_remove - Remove a free block from the tree
+ */
+static void tree_remove(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    uint32_t t = splay(cur->root, size, OFFSET(bp));
+
+    /* bp is the root now, join its subtrees */
+    if (LEFT(bp) == 0) {
+        cur->root = RIGHT(bp);
+    } else {
+        /* the max of the left tree becomes the root, with no right child */
+        t = splay(LEFT(bp), size, OFFSET(bp));
+        RIGHT(BLOCK(t)) = RIGHT(bp);
+        cur->root = t;
+    }
+}
+
+/*
+ * tree_fit - Return the smallest block of the tree of at least asize
+ *     bytes, the first one in memory among those of the same size, or NULL
+ */
+static void *tree_fit(size_t asize)
+{
+    uint32_t t = splay(cur->root, asize, 0);
+
+    cur->root = t;
+    if (t == 0)
+        return NULL;
+    if (GET_SIZE(HDRP(BLOCK(t))) >= asize)
+        return BLOCK(t);
+    /* the root is the predecessor, the successor is the min of its right */
+    for (t = RIGHT(BLOCK(t)); t != 0 && LEFT(BLOCK(t)) != 0; t = LEFT(BLOCK(t)))
+        ;
+    return t != 0 ? BLOCK(t) : NULL;
+}
+
+/*
+ * free_insert - Insert a free block at the head of its list, or in the tree
+ */
+static void free_insert(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    int c;
+    uint32_t head;
+
+    if (size >= TREE_MIN) {
+        tree_insert(bp);
+        return;
+    }
+    c = size_class(size);
+    head = cur->heads[c];
+    NEXT_FREE(bp) = head;
+    PREV_FREE(bp) = 0;
+    if (head != 0)
+        PREV_FREE(BLOCK(head)) = OFFSET(bp);
+    cur->heads[c] = OFFSET(bp);
+}
+
+/*
+ * free_remove - Remove a free block from its list, or from the tree
+ */
+static void free_remove(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    uint32_t next, prev;
+
+    if (size >= TREE_MIN) {
+        tree_remove(bp);
+        return;
+    }
+    next = NEXT_FREE(bp);
+    prev = PREV_FREE(bp);
+    if (prev != 0)
+        NEXT_FREE(BLOCK(prev)) = next;
+    else
+        cur->heads[size_class(size)] = next;
+    if (next != 0)
+        PREV_FREE(BLOCK(next)) = prev;
+}
+
+/*
+ * mark_free - Make bp a free block of size bytes, not in any list
+ */
+static inline void mark_free(void *bp, size_t size)
+{
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+    PUT(FTRP(bp), PACK(size, 0));
+    set_prev_alloc(bp, 0);
+}
+
+/*
+ * mm_init_arenas - Initialize the malloc package with n arenas.
+ */
+int mm_init_arenas(int n)
+{
+    size_t size;
+    int i;
+
+    if (n < 1 || n > MAX_ARENAS)
+        return -1;
+    /* arenas, owner map and epilogue, padded so that the payloads are aligned */
+    size = ALIGN(n * sizeof(arena_t) + (n > 1 ? MAX_HEAP / ARENA_PAGE : 0) + WSIZE);
+    if ((heap_base = mem_sbrk(size)) == (void *)-1)
+        return -1;
+    heap_listp = heap_base + size;
+    PUT(HDRP(heap_listp), PACK(0, PREV_ALLOC | ALLOC)); /* epilogue */
+
+    arenas = (arena_t *)heap_base;
+    nr_arenas = n;
+    owner = NULL;
+    memset(arenas, 0, n * sizeof(arena_t));
+    for (i = 0; i < n; i++) {
+        pthread_mutex_init(&arenas[i].lock, NULL);
+        /* arena 0 extends the empty chunk at heap_listp, the others start
+           with a new chunk */
+        arenas[i].end = (i == 0) ? OFFSET(heap_listp) : 0;
+    }
+    if (n > 1) {
+        owner = (uint8_t *)&arenas[n];
+        memset(owner, 0, MAX_HEAP / ARENA_PAGE);
+    }
+    /* the threads pick a new home arena */
+    __atomic_add_fetch(&generation, 1, __ATOMIC_RELAXED);
     return 0;
 }
 
-/* 
- * mm_malloc - Allocate a block by incrementing the brk pointer.
- *     Always allocate a block whose size is a multiple of the alignment.
+/*
+ * mm_init - initialize the malloc package with a single arena.
+ */
+int mm_init(void)
+{
+    return mm_init_arenas(1);
+}
+
+/*
+ * set_owner - Record that [lo, hi) belongs to the current arena
+ */
+static void set_owner(char *lo, char *hi)
+{
+    size_t page;
+
+    if (owner == NULL)
+        return;
+    for (page = (lo - heap_base) / ARENA_PAGE; page <= (hi - 1 - heap_base) / ARENA_PAGE; page++)
+        owner[page] = cur - arenas;
+}
+
+/*
+ * grow_chunk - Grow the chunk ending with the epilogue at end_bp by size
+ *     bytes if the heap ends there, and return the new free block, not
+ *     coalesced and not in a list, or NULL
+ */
+static void *grow_chunk(char *end_bp, size_t size)
+{
+    if (mem_sbrk_at(end_bp, size) == (void *)-1)
+        return NULL;
+    /* the old epilogue is the header of the new block */
+    PUT(HDRP(end_bp), PACK(size, GET_PREV_ALLOC(HDRP(end_bp))));
+    PUT(FTRP(end_bp), PACK(size, 0));
+    PUT(HDRP(NEXT_BLKP(end_bp)), PACK(0, ALLOC)); /* new epilogue */
+    cur->end = OFFSET(NEXT_BLKP(end_bp));
+    set_owner(end_bp, NEXT_BLKP(end_bp));
+    return end_bp;
+}
+
+/*
+ * new_chunk - Start a new chunk of the current arena with a free block of
+ *     size bytes, not in a list, and return it, or NULL
+ */
+static void *new_chunk(size_t size)
+{
+    char *brk, *bp;
+    size_t start;
+
+    do {
+        brk = (char *)mem_heap_hi() + 1;
+        start = ((brk - heap_base) + ARENA_PAGE - 1) / ARENA_PAGE * ARENA_PAGE;
+        /* padding, then the header at 4 mod 8, the block and the epilogue */
+        if (start + 2 * WSIZE + size > MAX_HEAP)
+            return NULL;
+    } while (mem_sbrk_at(brk, heap_base + start + 2 * WSIZE + size - brk) == (void *)-1);
+    bp = heap_base + start + 2 * WSIZE;
+    PUT(HDRP(bp), PACK(size, PREV_ALLOC));
+    PUT(FTRP(bp), PACK(size, 0));
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, ALLOC)); /* epilogue */
+    cur->end = OFFSET(NEXT_BLKP(bp));
+    set_owner(heap_base + start, NEXT_BLKP(bp));
+    return bp;
+}
+
+/*
+ * extend_heap - Extend the current arena with a free block of at least
+ *     asize bytes, insert it in its list and return it, or NULL. If the
+ *     last block of the arena is free and the heap ends there, the heap
+ *     is extended only by what this block misses.
+ */
+static void *extend_heap(size_t asize)
+{
+    char *end_bp = cur->end != 0 ? BLOCK(cur->end) : NULL, *bp = NULL;
+    size_t grow = asize;
+
+    if (end_bp != NULL && !GET_PREV_ALLOC(HDRP(end_bp)))
+        grow -= GET_SIZE(HDRP(PREV_BLKP(end_bp)));
+    /* with several arenas, grow by large steps, so that there are few chunks */
+    if (nr_arenas > 1 && grow < ARENA_CHUNK)
+        grow = ARENA_CHUNK;
+    if (end_bp != NULL)
+        bp = grow_chunk(end_bp, grow);
+    if (bp == NULL)
+        bp = new_chunk(grow > asize ? grow : asize);
+    if (bp == NULL) {
+        fprintf(stderr, "ERROR: mm_malloc: out of memory\n");
+        return NULL;
+    }
+    return coalesce(bp);
+}
+
+/*
+ * find_fit - Find the best fit, or NULL
+ */
+static void *find_fit(size_t asize)
+{
+    int c;
+
+    if (asize < TREE_MIN) {
+        for (c = size_class(asize); c < NR_LIST; c++) {
+            if (cur->heads[c] != 0)
+                return BLOCK(cur->heads[c]);
+        }
+    }
+    return tree_fit(asize);
+}
+
+/*
+ * place - Allocate asize bytes of the free block bp, which is not in a
+ *     list, and return the payload. The remainder, if large enough, is
+ *     split into a free block.
+ */
+static void *place(void *bp, size_t asize)
+{
+    size_t size = GET_SIZE(HDRP(bp)), rest = size - asize;
+    uint32_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    char *free_bp;
+
+    if (rest < MIN_BLOCK) {
+        PUT(HDRP(bp), PACK(size, prev_alloc | ALLOC));
+        set_prev_alloc(bp, 1);
+        return bp;
+    }
+    if (asize >= PLACE_BACK) {
+        /* free block first, then the allocated one */
+        free_bp = bp;
+        PUT(HDRP(free_bp), PACK(rest, prev_alloc));
+        PUT(FTRP(free_bp), PACK(rest, 0));
+        bp = NEXT_BLKP(free_bp);
+        PUT(HDRP(bp), PACK(asize, ALLOC));
+        set_prev_alloc(bp, 1);
+    } else {
+        PUT(HDRP(bp), PACK(asize, prev_alloc | ALLOC));
+        free_bp = NEXT_BLKP(bp);
+        PUT(HDRP(free_bp), PACK(rest, PREV_ALLOC));
+        PUT(FTRP(free_bp), PACK(rest, 0));
+        set_prev_alloc(free_bp, 0);
+    }
+    free_insert(free_bp);
+    return bp;
+}
+
+/*
+ * arena_lock - Lock arena a, and make it the current arena
+ */
+static void arena_lock(arena_t *a)
+{
+    cur = a;
+    if (nr_arenas == 1)
+        return;
+    if (pthread_mutex_trylock(&a->lock) != 0) {
+        pthread_mutex_lock(&a->lock);
+        a->nr_contended++;
+    }
+    a->nr_lock++;
+}
+
+static void arena_unlock(arena_t *a)
+{
+    if (nr_arenas > 1)
+        pthread_mutex_unlock(&a->lock);
+}
+
+/*
+ * home_arena - The arena of the calling thread, picked round-robin
+ */
+static arena_t *home_arena(void)
+{
+    unsigned int gen = __atomic_load_n(&generation, __ATOMIC_RELAXED);
+
+    if (home == NULL || home_generation != gen) {
+        home = &arenas[__atomic_fetch_add(&next_home, 1, __ATOMIC_RELAXED) % nr_arenas];
+        home_generation = gen;
+    }
+    return home;
+}
+
+/*
+ * owner_arena - The arena of the block bp
+ */
+static arena_t *owner_arena(void *bp)
+{
+    if (owner == NULL)
+        return &arenas[0];
+    return &arenas[owner[((char *)bp - heap_base) / ARENA_PAGE]];
+}
+
+/*
+ * mm_malloc - Allocate a block of at least size bytes from the best fit
+ *     of the arena of the thread, or from the end of the arena.
  */
 void *mm_malloc(size_t size)
 {
-    int newsize = ALIGN(size + SIZE_T_SIZE);
-    void *p = mem_sbrk(newsize);
-    if (p == (void *)-1)
-	return NULL;
-    else {
-        *(size_t *)p = size;
-        return (void *)((char *)p + SIZE_T_SIZE);
+    size_t asize;
+    char *bp;
+    arena_t *a;
+
+    if (size == 0 || size > 0x7ffffff0)
+        return NULL;
+    asize = adjust(size);
+    a = home_arena();
+    arena_lock(a);
+    if ((bp = find_fit(asize)) == NULL)
+        bp = extend_heap(asize);
+    if (bp != NULL) {
+        free_remove(bp);
+        bp = place(bp, asize);
     }
+    arena_unlock(a);
+    return bp;
 }
 
 /*
- * mm_free - Freeing a block does nothing.
+ * coalesce - Merge the free block bp, not in any list, with its free
+ *     neighbours, insert the result in its list and return it
+ */
+static void *coalesce(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    char *next = NEXT_BLKP(bp);
+
+    if (!GET_ALLOC(HDRP(next))) {
+        free_remove(next);
+        size += GET_SIZE(HDRP(next));
+    }
+    if (!prev_alloc) {
+        bp = PREV_BLKP(bp);
+        free_remove(bp);
+        size += GET_SIZE(HDRP(bp));
+    }
+    mark_free(bp, size);
+    free_insert(bp);
+    return bp;
+}
+
+/*
+ * mm_free - Free a block, and coalesce it with its free neighbours.
  */
 void mm_free(void *ptr)
 {
+    arena_t *a;
+
+    if (ptr == NULL)
+        return;
+    a = owner_arena(ptr);
+    arena_lock(a);
+    coalesce(ptr);
+    arena_unlock(a);
 }
 
 /*
- * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
+ * shrink - Make the allocated block bp asize bytes, and free the rest if
+ *     it is large enough for a block
  */
-void *mm_realloc(void *ptr, size_t size)
+static void shrink(void *bp, size_t asize)
 {
-    void *oldptr = ptr;
-    void *newptr;
-    size_t copySize;
-    
-    newptr = mm_malloc(size);
-    if (newptr == NULL)
-      return NULL;
-    copySize = *(size_t *)((char *)oldptr - SIZE_T_SIZE);
-    if (size < copySize)
-      copySize = size;
-    memcpy(newptr, oldptr, copySize);
-    mm_free(oldptr);
-    return newptr;
+    size_t size = GET_SIZE(HDRP(bp));
+    char *rest;
+
+    if (size - asize < MIN_BLOCK)
+        return;
+    PUT(HDRP(bp), PACK(asize, GET_PREV_ALLOC(HDRP(bp)) | ALLOC));
+    rest = NEXT_BLKP(bp);
+    PUT(HDRP(rest), PACK(size - asize, PREV_ALLOC));
+    mark_free(rest, size - asize);
+    coalesce(rest);
 }
 
+/*
+ * resize - Resize the allocated block bp of the current arena in place to
+ *     asize bytes, and return whether it could
+ */
+static int resize(char *bp, size_t asize)
+{
+    size_t oldsize = GET_SIZE(HDRP(bp)), nextsize;
+    char *next = NEXT_BLKP(bp), *more;
 
+    if (asize <= oldsize) {
+        shrink(bp, asize);
+        return 1;
+    }
+    nextsize = GET_SIZE(HDRP(next));
+    if (!GET_ALLOC(HDRP(next)) && GET_SIZE(HDRP(NEXT_BLKP(next))) == 0 &&
+        oldsize + nextsize < asize) {
+        /* the free last block is too small, extend it first */
+        if ((more = grow_chunk(NEXT_BLKP(next), asize - oldsize - nextsize)) == NULL)
+            return 0;
+        coalesce(more);
+        nextsize = GET_SIZE(HDRP(next));
+    }
+    if (!GET_ALLOC(HDRP(next)) && oldsize + nextsize >= asize) {
+        free_remove(next);
+        PUT(HDRP(bp), PACK(oldsize + nextsize, GET_PREV_ALLOC(HDRP(bp)) | ALLOC));
+        set_prev_alloc(bp, 1);
+        shrink(bp, asize);
+        return 1;
+    }
+    if (nextsize == 0 && grow_chunk(next, asize - oldsize) != NULL) {
+        /* the last block, the heap has grown under it */
+        PUT(HDRP(bp), PACK(asize, GET_PREV_ALLOC(HDRP(bp)) | ALLOC));
+        PUT(HDRP(NEXT_BLKP(bp)), PACK(0, PREV_ALLOC | ALLOC));
+        return 1;
+    }
+    return 0;
+}
 
+/*
+ * mm_realloc - Resize a block in place if possible: by splitting it, by
+ *     merging it with the free block after it, or by extending the heap
+ *     if it is the last block. Otherwise, move it to a new block.
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+    size_t oldsize;
+    char *newptr;
+    arena_t *a;
+    int done;
 
+    if (ptr == NULL)
+        return mm_malloc(size);
+    if (size == 0) {
+        mm_free(ptr);
+        return NULL;
+    }
+    if (size > 0x7ffffff0)
+        return NULL;
+    a = owner_arena(ptr);
+    arena_lock(a);
+    oldsize = GET_SIZE(HDRP(ptr));
+    done = resize(ptr, adjust(size));
+    arena_unlock(a);
+    if (done)
+        return ptr;
 
+    /* the new block may be in another arena, so the lock is not held */
+    if ((newptr = mm_malloc(size)) == NULL)
+        return NULL;
+    memcpy(newptr, ptr, oldsize - WSIZE);
+    mm_free(ptr);
+    return newptr;
+}
 
+/*
+ * mm_lock_stats - Get the number of times the locks of the arenas were
+ *     taken, and how many of them the lock was held by another thread
+ */
+void mm_lock_stats(unsigned long *locks, unsigned long *contended)
+{
+    int i;
 
+    *locks = *contended = 0;
+    for (i = 0; i < nr_arenas; i++) {
+        *locks += arenas[i].nr_lock;
+        *contended += arenas[i].nr_contended;
+    }
+}
 
+/*
+ * check_error - Report an inconsistency of the heap found by mm_check()
+ */
+static int check_error(void *bp, const char *msg)
+{
+    printf("mm_check: block %p: %s\n", bp, msg);
+    return 0;
+}
 
+/*
+ * check_tree - Check that the tree of arena a is ordered and holds free
+ *     blocks of at least TREE_MIN bytes of a, and subtract their number
+ *     from *nr_free. The
+ *     in-order walk is a Morris traversal, which threads the tree through
+ *     the unused right links temporarily instead of using a stack, since
+ *     a splay tree can be as deep as it has nodes.
+ */
+static int check_tree(arena_t *a, char *end, int *nr_free)
+{
+    uint32_t t = a->root, pred, last = 0;
+    size_t last_size = 0;
+    int ok = 1;
 
+    while (t != 0) {
+        char *bp = BLOCK(t);
+        if (ok && (bp < heap_listp || bp >= end)) {
+            /* do not follow the links any further */
+            return check_error(bp, "tree link out of the heap");
+        }
+        if (LEFT(bp) != 0) {
+            /* find the predecessor, and thread it to bp on the first visit */
+            for (pred = LEFT(bp); RIGHT(BLOCK(pred)) != 0 && RIGHT(BLOCK(pred)) != t;
+                 pred = RIGHT(BLOCK(pred)))
+                ;
+            if (RIGHT(BLOCK(pred)) == 0) {
+                RIGHT(BLOCK(pred)) = t;
+                t = LEFT(bp);
+                continue;
+            }
+            RIGHT(BLOCK(pred)) = 0; /* second visit, remove the thread */
+        }
+        /* visit bp, but keep walking to remove all threads */
+        if (ok && GET_ALLOC(HDRP(bp)))
+            ok = check_error(bp, "allocated block in the tree");
+        else if (ok && GET_SIZE(HDRP(bp)) < TREE_MIN)
+            ok = check_error(bp, "small block in the tree");
+        else if (ok && owner_arena(bp) != a)
+            ok = check_error(bp, "block of another arena in the tree");
+        else if (ok && last != 0 && !key_less(last_size, last, GET_SIZE(HDRP(bp)), t))
+            ok = check_error(bp, "tree is out of order");
+        last = t;
+        last_size = GET_SIZE(HDRP(bp));
+        (*nr_free)--;
+        t = RIGHT(bp);
+    }
+    return ok;
+}
 
+/*
+ * mm_check - Check the consistency of the heap, and print the blocks if
+ *     verbose is set. Return nonzero if and only if the heap is consistent.
+ *     It checks that
+ *      - the blocks are aligned, tile the chunks, which end with an
+ *        epilogue, and the chunks tile the heap,
+ *      - the prev-alloc flags and the footers match the blocks,
+ *      - no two free blocks are adjacent,
+ *      - the lists only hold free blocks of their size and arena, with
+ *        consistent links, the trees are ordered, and they hold all free
+ *        blocks of the heap.
+ *     With several arenas, no other thread may use the heap meanwhile.
+ */
+int mm_check(int verbose)
+{
+    char *bp = heap_listp, *end = (char *)mem_heap_hi() + 1;
+    int c, i, prev_alloc = 1, nr_free = 0;
+    uint32_t off, prev;
+    arena_t *a;
 
+    for (;;) {
+        size_t size = GET_SIZE(HDRP(bp));
+        int alloc = GET_ALLOC(HDRP(bp));
 
+        if (verbose)
+            printf("%p: size %zu, %s, arena %d\n", bp, size,
+                   alloc ? "allocated" : "free", (int)(owner_arena(bp) - arenas));
+        if ((uintptr_t)bp % ALIGNMENT != 0)
+            return check_error(bp, "payload is not aligned");
+        if ((GET_PREV_ALLOC(HDRP(bp)) != 0) != prev_alloc)
+            return check_error(bp, "prev-alloc flag does not match");
+        if (size == 0) {
+            if (!alloc)
+                return check_error(bp, "bad epilogue");
+            if (bp == end)
+                break;
+            /* the next chunk starts at the next page */
+            bp = BLOCK((OFFSET(bp) + ARENA_PAGE - 1) / ARENA_PAGE * ARENA_PAGE + 2 * WSIZE);
+            if (nr_arenas == 1 || bp > end)
+                return check_error(bp, "the chunks overrun the heap");
+            prev_alloc = 1;
+            continue;
+        }
+        if (size < MIN_BLOCK || bp + size > end)
+            return check_error(bp, "bad size");
+        if (!alloc) {
+            if (GET_SIZE(FTRP(bp)) != size || GET_ALLOC(FTRP(bp)))
+                return check_error(bp, "footer does not match the header");
+            if (!prev_alloc)
+                return check_error(bp, "two adjacent free blocks");
+            nr_free++;
+        }
+        prev_alloc = alloc;
+        bp += size;
+    }
 
+    for (i = 0; i < nr_arenas; i++) {
+        a = &arenas[i];
+        for (c = 0; c < NR_LIST; c++) {
+            prev = 0;
+            for (off = a->heads[c]; off != 0; off = NEXT_FREE(bp)) {
+                bp = BLOCK(off);
+                if (bp < heap_listp || bp >= end)
+                    return check_error(bp, "free list link out of the heap");
+                if (GET_ALLOC(HDRP(bp)))
+                    return check_error(bp, "allocated block in a free list");
+                if (GET_SIZE(HDRP(bp)) >= TREE_MIN || size_class(GET_SIZE(HDRP(bp))) != c)
+                    return check_error(bp, "free block in the wrong list");
+                if (owner_arena(bp) != a)
+                    return check_error(bp, "block of another arena in a free list");
+                if (PREV_FREE(bp) != prev)
+                    return check_error(bp, "bad prev link");
+                prev = off;
+                nr_free--;
+            }
+        }
+        if (!check_tree(a, end, &nr_free))
+            return 0;
+    }
+    if (nr_free != 0)
+        return check_error(heap_listp, "free lists and heap disagree on the free blocks");
+    return 1;
+}
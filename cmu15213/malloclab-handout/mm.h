@@ -4,6 +4,12 @@ extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern int mm_check(int verbose);
+
+/* Multi-threaded use: mm_init_arenas(n) is mm_init() with n arenas, and
+   the functions above may then be called by several threads at once */
+extern int mm_init_arenas(int n);
+extern void mm_lock_stats(unsigned long *locks, unsigned long *contended);
 
 
 /* 
@@ -0,0 +1,451 @@
+/*
+ * mmrecord.c - Records the malloc/free/realloc requests of a program as a
+ *     binary trace file (see trace.h)
+ *
+ * usage: MMRECORD_FILE=prog.bin LD_PRELOAD=/path/to/mmrecord.so prog ...
+ *
+ * A %p in MMRECORD_FILE is replaced by the pid, to get one trace per
+ * process when prog runs other programs.
+ *
+ * The library defines malloc, calloc, realloc, free and the aligned
+ * allocation functions, which call the ones of glibc and record the
+ * requests. calloc and the aligned functions are recorded as mallocs of
+ * the same size. The requests of all the threads go to a single trace,
+ * in an order in which they can be replayed.
+ *
+ * The ids of the trace are reused once their block is freed, so that
+ * num_ids is the largest number of blocks allocated at once rather than
+ * the number of allocations. The blocks still allocated at exit are freed
+ * at the end of the trace, so that it is balanced. Blocks allocated
+ * before the library is initialized, or larger than INT_MAX, are not
+ * recorded, and neither are the requests of a child after a fork().
+ *
+ * The header is written again after each batch of requests, so that the
+ * trace is valid, although not balanced, when the program is killed or
+ * the recording stops early.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "trace.h"
+
+/* The allocator of glibc */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+#define DEFAULT_FILE "mmrecord.bin"
+#define MAXPATH      4096
+#define BUFOPS       (1 << 16)  /* requests buffered before a write */
+#define MIN_SLOTS    (1 << 16)  /* initial size of the table of blocks */
+#define MIN_IDS      (1 << 12)  /* initial size of the stack of free ids */
+
+/* A live block: its address, its id in the trace and its size */
+typedef struct {
+    uintptr_t addr;     /* 0 for an empty slot */
+    int32_t id;
+    int32_t size;
+} slot_t;
+
+/* The state of the recorder, all protected by lock */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int recording = 0;
+static int fd = -1;
+static int write_failed = 0;
+static tracehdr_t hdr = { TRACE_MAGIC, TRACE_VERSION };
+static traceop_t buf[BUFOPS];
+static int nbuf = 0;
+static long live_bytes, peak_bytes;
+
+/* The live blocks, in an open addressing table with linear probing */
+static slot_t *slots;
+static size_t nslots, nlive;
+
+/* The ids of the freed blocks, to be reused */
+static int32_t *free_ids;
+static size_t nfree_ids, free_ids_cap;
+
+static void warn(const char *msg)
+{
+    write(2, "mmrecord: ", 10);
+    write(2, msg, strlen(msg));
+    write(2, "\n", 1);
+}
+
+/*
+ * The memory of the recorder is mapped directly, since it cannot use
+ * malloc. When it runs out, the recording stops.
+ */
+static void *map(size_t len)
+{
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        warn("out of memory, recording stopped");
+        recording = 0;
+        return NULL;
+    }
+    return p;
+}
+
+/* Write the header, with num_ops counting the requests in the file */
+static void write_header(void)
+{
+    hdr.sugg_heapsize = peak_bytes < INT_MAX ? peak_bytes : INT_MAX;
+    hdr.weight = 1;
+    if (pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+        warn("write failed");
+}
+
+static void flush(void)
+{
+    size_t len = nbuf * sizeof(traceop_t), done = 0;
+    ssize_t n;
+
+    while (done < len) {
+        if ((n = write(fd, (char *)buf + done, len - done)) < 0) {
+            if (errno == EINTR)
+                continue;
+            warn("write failed, recording stopped");
+            recording = 0;
+            write_failed = 1;
+            /* drop the request written in part */
+            done -= done % sizeof(traceop_t);
+            if (ftruncate(fd, sizeof(hdr) + (hdr.num_ops + done / sizeof(traceop_t)) *
+                          sizeof(traceop_t)) < 0)
+                warn("truncate failed");
+            break;
+        }
+        done += n;
+    }
+    hdr.num_ops += done / sizeof(traceop_t);
+    nbuf = 0;
+    write_header();
+}
+
+static void emit(int32_t type, int32_t id, int32_t size)
+{
+    buf[nbuf++] = (traceop_t){ type, id, size };
+    if (nbuf == BUFOPS)
+        flush();
+}
+
+/*
+ * The table of the live blocks
+ */
+static size_t hash(uintptr_t addr)
+{
+    return ((addr >> 4) * 0x9e3779b97f4a7c15ull) & (nslots - 1);
+}
+
+static slot_t *lookup(uintptr_t addr)
+{
+    size_t i;
+
+    for (i = hash(addr); slots[i].addr != 0; i = (i + 1) & (nslots - 1))
+        if (slots[i].addr == addr)
+            return &slots[i];
+    return NULL;
+}
+
+static void put(slot_t s)
+{
+    size_t i;
+
+    for (i = hash(s.addr); slots[i].addr != 0; i = (i + 1) & (nslots - 1))
+        ;
+    slots[i] = s;
+}
+
+/* Add a block, growing the table when it is half full */
+static int insert(uintptr_t addr, int32_t id, int32_t size)
+{
+    slot_t *old = slots;
+    size_t i, n = nslots;
+
+    if (2 * (nlive + 1) > nslots) {
+        if ((slots = map(2 * n * sizeof(slot_t))) == NULL) {
+            slots = old;
+            return 0;
+        }
+        nslots = 2 * n;
+        for (i = 0; i < n; i++)
+            if (old[i].addr != 0)
+                put(old[i]);
+        munmap(old, n * sizeof(slot_t));
+    }
+    put((slot_t){ addr, id, size });
+    nlive++;
+    return 1;
+}
+
+/* Remove the slot s, and move back the slots after it which probed past it */
+static void remove_slot(slot_t *s)
+{
+    size_t i = s - slots, j = i, k;
+
+    for (;;) {
+        j = (j + 1) & (nslots - 1);
+        if (slots[j].addr == 0)
+            break;
+        k = hash(slots[j].addr);
+        if (i < j ? (k <= i || k > j) : (k <= i && k > j)) {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+    slots[i].addr = 0;
+    nlive--;
+}
+
+/*
+ * The ids of the trace
+ */
+static int32_t new_id(void)
+{
+    if (nfree_ids > 0)
+        return free_ids[--nfree_ids];
+    return hdr.num_ids < INT32_MAX ? hdr.num_ids++ : -1;
+}
+
+static void release_id(int32_t id)
+{
+    int32_t *old = free_ids;
+
+    if (nfree_ids == free_ids_cap) {
+        if ((free_ids = map(2 * free_ids_cap * sizeof(int32_t))) == NULL) {
+            free_ids = old;
+            return;
+        }
+        memcpy(free_ids, old, nfree_ids * sizeof(int32_t));
+        munmap(old, free_ids_cap * sizeof(int32_t));
+        free_ids_cap *= 2;
+    }
+    free_ids[nfree_ids++] = id;
+}
+
+/*
+ * The records of the requests. A block is removed from the table before
+ * it is given back to glibc, and added after glibc returned it, so that
+ * an address is never in the table twice when glibc reuses it.
+ */
+static void record_alloc(void *p, size_t size)
+{
+    int32_t id;
+
+    if (p == NULL || size > INT_MAX)
+        return;
+    pthread_mutex_lock(&lock);
+    if (recording && (id = new_id()) >= 0 && insert((uintptr_t)p, id, size)) {
+        emit(ALLOC, id, size > 0 ? size : 1);
+        live_bytes += size;
+        if (live_bytes > peak_bytes)
+            peak_bytes = live_bytes;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+static void record_free(void *p)
+{
+    slot_t *s;
+
+    if (p == NULL)
+        return;
+    pthread_mutex_lock(&lock);
+    if (recording && (s = lookup((uintptr_t)p)) != NULL) {
+        emit(FREE, s->id, 0);
+        live_bytes -= s->size;
+        release_id(s->id);
+        remove_slot(s);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/* Remove the block p before glibc reallocates it, and return its slot */
+static slot_t forget(void *p)
+{
+    slot_t *s, old = { 0, -1, 0 };
+
+    pthread_mutex_lock(&lock);
+    if (recording && (s = lookup((uintptr_t)p)) != NULL) {
+        old = *s;
+        remove_slot(s);
+    }
+    pthread_mutex_unlock(&lock);
+    return old;
+}
+
+/* Record the reallocation of the block old to q */
+static void record_realloc(slot_t old, void *q, size_t size)
+{
+    if (old.id < 0) {           /* not recorded, as if it were new */
+        record_alloc(q, size);
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    if (!recording)
+        ;
+    else if (q == NULL)         /* failed, old is still allocated */
+        insert(old.addr, old.id, old.size);
+    else if (size > INT_MAX) {
+        emit(FREE, old.id, 0);
+        live_bytes -= old.size;
+        release_id(old.id);
+    } else if (insert((uintptr_t)q, old.id, size)) {
+        emit(REALLOC, old.id, size);
+        live_bytes += (long)size - old.size;
+        if (live_bytes > peak_bytes)
+            peak_bytes = live_bytes;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * The allocation functions
+ */
+void *malloc(size_t size)
+{
+    void *p = __libc_malloc(size);
+    record_alloc(p, size);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p = __libc_calloc(nmemb, size);
+    record_alloc(p, nmemb * size);  /* no overflow if p != NULL */
+    return p;
+}
+
+void free(void *p)
+{
+    record_free(p);
+    __libc_free(p);
+}
+
+void *realloc(void *p, size_t size)
+{
+    slot_t old;
+    void *q;
+
+    if (p == NULL)
+        return malloc(size);
+    if (size == 0) {
+        free(p);
+        return NULL;
+    }
+    old = forget(p);
+    q = __libc_realloc(p, size);
+    record_realloc(old, q, size);
+    return q;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    void *p = __libc_memalign(alignment, size);
+    record_alloc(p, size);
+    return p;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *p;
+
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    if ((p = memalign(alignment, size)) == NULL)
+        return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+/*
+ * The recording runs from the load of the library to the exit of the
+ * program. A fork() takes the lock, so that the child does not inherit
+ * it locked, and the child stops recording.
+ */
+static void prepare(void) { pthread_mutex_lock(&lock); }
+static void parent(void) { pthread_mutex_unlock(&lock); }
+static void child(void)
+{
+    recording = 0;
+    fd = -1;
+    pthread_mutex_unlock(&lock);
+}
+
+/* Copy the name of the trace file in path, with the pid in place of %p */
+static void trace_path(char *path)
+{
+    const char *name = getenv("MMRECORD_FILE");
+    char pid[16];
+    int n = 0;
+
+    if (name == NULL)
+        name = DEFAULT_FILE;
+    snprintf(pid, sizeof(pid), "%d", (int)getpid());
+    for (; *name != '\0' && n < MAXPATH - 16; name++) {
+        if (name[0] == '%' && name[1] == 'p') {
+            n += sprintf(path + n, "%s", pid);
+            name++;
+        } else
+            path[n++] = *name;
+    }
+    path[n] = '\0';
+}
+
+__attribute__((constructor))
+static void mmrecord_init(void)
+{
+    static char path[MAXPATH];
+
+    trace_path(path);
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        warn("cannot create the trace file");
+        return;
+    }
+    pthread_atfork(prepare, parent, child);
+    if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+        warn("write failed");
+        return;
+    }
+    nslots = MIN_SLOTS;
+    free_ids_cap = MIN_IDS;
+    recording = 1;
+    if ((slots = map(nslots * sizeof(slot_t))) == NULL ||
+        (free_ids = map(free_ids_cap * sizeof(int32_t))) == NULL)
+        recording = 0;
+}
+
+/* Free the live blocks at the end of the trace, and write the header */
+__attribute__((destructor))
+static void mmrecord_fini(void)
+{
+    size_t i;
+
+    pthread_mutex_lock(&lock);
+    if (fd >= 0) {
+        if (slots != NULL && !write_failed)
+            for (i = 0; i < nslots; i++)
+                if (slots[i].addr != 0)
+                    emit(FREE, slots[i].id, 0);
+        flush();
+        close(fd);
+    }
+    recording = 0;
+    fd = -1;
+    pthread_mutex_unlock(&lock);
+}
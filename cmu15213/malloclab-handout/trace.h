@@ -0,0 +1,40 @@
+/*
+ * trace.h - The binary format of the trace files
+ *
+ * A binary trace holds the same information as a text .rep trace: a
+ * header followed by the requests, each stored as a traceop_t. mdriver
+ * maps the file in memory and uses the requests in place, without
+ * parsing them. The numbers are in the byte order of the host.
+ *
+ * Binary traces are made from text ones by tracecvt, and recorded from
+ * a running program by mmrecord.so.
+ */
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+#include <stdint.h>
+
+#define TRACE_MAGIC   0x5254414d  /* "MATR" in little endian */
+#define TRACE_VERSION 1
+
+/* The types of request */
+enum {ALLOC, FREE, REALLOC};
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    int32_t type;   /* type of request */
+    int32_t index;  /* index for free() to use later */
+    int32_t size;   /* byte size of alloc/realloc request */
+} traceop_t;
+
+/* The header of a binary trace file, followed by num_ops traceop_t */
+typedef struct {
+    uint32_t magic;         /* TRACE_MAGIC */
+    uint32_t version;       /* TRACE_VERSION */
+    int32_t sugg_heapsize;  /* suggested heap size (unused) */
+    int32_t num_ids;        /* number of alloc/realloc ids */
+    int32_t num_ops;        /* number of requests */
+    int32_t weight;         /* weight for this trace (unused) */
+} tracehdr_t;
+
+#endif /* __TRACE_H_ */
@@ -0,0 +1,140 @@
+/*
+ * tracecvt.c - Converts trace files between the text .rep format and the
+ *     binary format of trace.h
+ *
+ * usage: tracecvt [-d] <infile> <outfile>
+ *
+ * Without -d, the text trace infile is converted to a binary one. With
+ * -d, the binary trace infile is dumped as a text one.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define MAXLINE 1024
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tracecvt [-d] <infile> <outfile>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-d         Dump a binary trace as a text one.\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+}
+
+static void error(char *msg, char *path)
+{
+    fprintf(stderr, "tracecvt: %s: %s\n", path, msg);
+    exit(1);
+}
+
+/*
+ * text_to_bin - Convert the text trace in to a binary one. The header is
+ *     written last, with the number of requests actually read.
+ */
+static void text_to_bin(FILE *in, char *inpath, FILE *out, char *outpath)
+{
+    tracehdr_t hdr = { TRACE_MAGIC, TRACE_VERSION };
+    traceop_t op;
+    char line[MAXLINE], type;
+    int index, size, max_index = -1, n;
+
+    if (fscanf(in, "%d %d %d %d", &hdr.sugg_heapsize, &hdr.num_ids,
+               &hdr.num_ops, &hdr.weight) != 4)
+        error("bad header", inpath);
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+        error("write failed", outpath);
+
+    hdr.num_ops = 0;
+    while (fgets(line, MAXLINE, in) != NULL) {
+        n = sscanf(line, " %c %d %d", &type, &index, &size);
+        if (n <= 0)
+            continue;   /* blank line */
+        if (n < 2 || index < 0 || (type != 'f' && (n < 3 || size < 0)))
+            error("bad request", inpath);
+        switch (type) {
+        case 'a': op = (traceop_t){ ALLOC, index, size }; break;
+        case 'r': op = (traceop_t){ REALLOC, index, size }; break;
+        case 'f': op = (traceop_t){ FREE, index, 0 }; break;
+        default:
+            error("bad request type", inpath);
+        }
+        if (fwrite(&op, sizeof(op), 1, out) != 1)
+            error("write failed", outpath);
+        if (index > max_index)
+            max_index = index;
+        hdr.num_ops++;
+    }
+    if (max_index >= hdr.num_ids)
+        error("request id out of range", inpath);
+
+    rewind(out);
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+        error("write failed", outpath);
+}
+
+/*
+ * bin_to_text - Dump the binary trace in as a text one
+ */
+static void bin_to_text(FILE *in, char *inpath, FILE *out)
+{
+    tracehdr_t hdr;
+    traceop_t op;
+    int i;
+
+    if (fread(&hdr, sizeof(hdr), 1, in) != 1 || hdr.magic != TRACE_MAGIC ||
+        hdr.version != TRACE_VERSION)
+        error("not a binary trace", inpath);
+    fprintf(out, "%d\n%d\n%d\n%d\n", hdr.sugg_heapsize, hdr.num_ids,
+            hdr.num_ops, hdr.weight);
+    for (i = 0; i < hdr.num_ops; i++) {
+        if (fread(&op, sizeof(op), 1, in) != 1)
+            error("truncated trace", inpath);
+        switch (op.type) {
+        case ALLOC: fprintf(out, "a %d %d\n", op.index, op.size); break;
+        case REALLOC: fprintf(out, "r %d %d\n", op.index, op.size); break;
+        case FREE: fprintf(out, "f %d\n", op.index); break;
+        default:
+            error("bad request type", inpath);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int c, dump = 0;
+    FILE *in, *out;
+
+    while ((c = getopt(argc, argv, "dh")) != EOF) {
+        switch (c) {
+        case 'd':
+            dump = 1;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (argc - optind != 2) {
+        usage();
+        exit(1);
+    }
+
+    if ((in = fopen(argv[optind], dump ? "rb" : "r")) == NULL)
+        error("cannot open", argv[optind]);
+    if ((out = fopen(argv[optind + 1], dump ? "w" : "wb")) == NULL)
+        error("cannot create", argv[optind + 1]);
+    if (dump)
+        bin_to_text(in, argv[optind], out);
+    else
+        text_to_bin(in, argv[optind], out, argv[optind + 1]);
+    fclose(in);
+    if (fclose(out) != 0)
+        error("write failed", argv[optind + 1]);
+    return 0;
+}
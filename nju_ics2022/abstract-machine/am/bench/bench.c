@@ -0,0 +1,103 @@
+#include <am.h>
+#include <klib.h>
+#include <klib-macros.h>
+
+// Measure the round trip of a trap into the kernel and back,
+// the time is in nanoseconds.
+
+#define ROUNDS 100000
+
+static Context *ctx[2];
+static int cur = 0;
+static bool do_switch = false;
+static volatile int nr_syscall = 0;
+
+static Context *on_event(Event ev, Context *c) {
+  switch (ev.event) {
+    case EVENT_YIELD:
+      if (do_switch) {
+        ctx[cur] = c;
+        cur = !cur;
+        return ctx[cur];
+      }
+      break;
+    case EVENT_SYSCALL:
+      nr_syscall ++;
+      c->GPRx = c->GPR1 + 1;
+      break;
+    case EVENT_IRQ_TIMER: break;
+    default: panic("unexpected event");
+  }
+  return c;
+}
+
+static void print_num(uint64_t x, int width) {
+  char buf[24];
+  int i = 0;
+  do { buf[i ++] = '0' + x % 10; x /= 10; } while (x != 0);
+  for (; width > i; width --) putch(' ');
+  while (i > 0) putch(buf[-- i]);
+}
+
+static void report(const char *name, uint64_t us) {
+  putstr(name);
+  print_num(us * 1000 / ROUNDS, 8);
+  putstr(" ns\n");
+}
+
+static uint64_t uptime() { return io_read(AM_TIMER_UPTIME).us; }
+
+static void bench_yield() {
+  uint64_t start = uptime();
+  for (int i = 0; i < ROUNDS; i ++) yield();
+  report("yield            ", uptime() - start);
+}
+
+#ifdef __ARCH_NATIVE
+// the same instructions as the system calls of the applications, which step
+// over the red zone, where the call to the gate pushes the return address
+static uintptr_t native_syscall(uintptr_t a0) {
+  register uintptr_t rdi asm("rdi") = a0;
+  uintptr_t ret;
+  asm volatile ("lea -128(%%rsp), %%rsp; call *0x100000; lea 128(%%rsp), %%rsp"
+      : "=a"(ret), "+r"(rdi) : : "rsi", "rdx", "rcx", "r8", "r9", "r10", "r11", "memory");
+  return ret;
+}
+
+static void bench_syscall() {
+  uint64_t start = uptime();
+  for (int i = 0; i < ROUNDS; i ++) assert(native_syscall(i) == i + 1);
+  report("syscall (kernel) ", uptime() - start);
+  assert(nr_syscall == ROUNDS);
+}
+#endif
+
+static uint8_t stack[8192];
+
+static void thread(void *arg) {
+  while (1) yield();
+}
+
+static void bench_switch() {
+  ctx[1] = kcontext(RANGE(stack, stack + sizeof(stack)), thread, NULL);
+  do_switch = true;
+  uint64_t start = uptime();
+  // every round switches to the thread and back
+  for (int i = 0; i < ROUNDS; i ++) yield();
+  report("context switch x2", uptime() - start);
+  do_switch = false;
+}
+
+int main(const char *args) {
+  ioe_init();
+  cte_init(on_event);
+  putstr("trap               latency\n");
+  bench_yield();
+#ifdef __ARCH_NATIVE
+  bench_syscall();
+#endif
+  bench_switch();
+  iset(true);
+  bench_yield();
+  return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef __AMGPU_H__
+#define __AMGPU_H__
+
+// The render tree of GPU_RENDER, also used by the devices which composite it
+// (see gpu-render.h), so it only depends on <stdint.h>.
+
+// The render tree and the textures are in the video memory (GPU_MEMCPY).
+// A texture pixel is 0xTTRRGGBB, where TT is the transparency and the colors
+// are premultiplied by the opacity, so the plain 0x00RRGGBB pixels are opaque.
+// Drawing `s' over `d' gives s + d * T(s) / 255 for all four channels,
+// saturated to 255 in case the colors are not premultiplied.
+#define AM_GPU_TEXTURE  1
+#define AM_GPU_SUBTREE  2
+#define AM_GPU_NULL     0xffffffff
+
+typedef uint32_t gpuptr_t;
+
+struct gpu_texturedesc {
+  uint16_t w, h;
+  gpuptr_t pixels;
+} __attribute__((packed));
+
+struct gpu_canvas {
+  uint16_t type, w, h, x1, y1, w1, h1;
+  gpuptr_t sibling;
+  union {
+    gpuptr_t child;
+    struct gpu_texturedesc texture;
+  };
+} __attribute__((packed));
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef __GPU_RENDER_H__
+#define __GPU_RENDER_H__
+
+// The compositor of the render tree (see amgpu.h), shared by the devices
+// with 2D acceleration: native AM and NEMU. The tree comes from the guest,
+// so a malformed one is reported to the caller instead of trusted.
+// The includer provides <stdint.h>, <stdbool.h> and memcpy().
+
+#include "amgpu.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define GPU_MAX_NODE 4096 // also bounds the recursion for malformed trees
+
+typedef struct {
+  uint8_t *vmem;     // the video memory, filled by GPU_MEMCPY
+  uint32_t vmemsz;
+  // canvases of subtrees and the column maps of scaling, reset for each render
+  uint8_t *scratch, *scratch_head, *scratch_end;
+  int nr_node;
+} GPURender;
+
+// NULL if [ptr, ptr + size) is out of the video memory
+static inline void *gpu_vmem_ptr(GPURender *g, gpuptr_t ptr, uint64_t size) {
+  return (ptr <= g->vmemsz && size <= g->vmemsz - ptr ? g->vmem + ptr : NULL);
+}
+
+static inline void *gpu_scratch_alloc(GPURender *g, uint64_t size) {
+  size = (size + 15) & ~(uint64_t)15;
+  if (size > (uint64_t)(g->scratch_end - g->scratch_head)) return NULL;
+  void *ret = g->scratch_head;
+  g->scratch_head += size;
+  return ret;
+}
+
+#define GPU_LANES 0x00ff00ff00ff00ffull
+static inline uint64_t gpu_spread(uint32_t p) { // one channel in each 16-bit lane
+  return (p & 0x00ff00ff) | ((uint64_t)(p & 0xff00ff00) << 24);
+}
+
+static inline uint32_t gpu_blend(uint32_t d, uint32_t s) {
+  uint32_t t = s >> 24;
+  if (t == 0) return s;
+  // x / 255 == (x + (x >> 8)) >> 8 after adding 128 for rounding,
+  // which is exact for x <= 255 * 255
+  uint64_t x = gpu_spread(d) * t + 0x0080008000800080ull;
+  x = ((x + ((x >> 8) & GPU_LANES)) >> 8) & GPU_LANES;
+  x += gpu_spread(s & 0x00ffffff);
+  x = (x | ((x >> 8) & 0x0001000100010001ull) * 0xff) & GPU_LANES; // saturate
+  return (uint32_t)x | (uint32_t)(x >> 24);
+}
+
+static inline void gpu_blend_row(uint32_t *dst, const uint32_t *src, int n) {
+  int i = 0;
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128(), round = _mm_set1_epi16(128);
+  const __m128i rgb = _mm_set1_epi32(0x00ffffff);
+  for (; i + 4 <= n; i += 4) {
+    __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i t = _mm_srli_epi32(s, 24);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(t, zero)) == 0xffff) {
+      _mm_storeu_si128((__m128i *)(dst + i), s); // opaque, the common case
+      continue;
+    }
+    // spread the transparency of each pixel to its four 16-bit lanes
+    t = _mm_or_si128(t, _mm_slli_epi32(t, 16));
+    __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+    __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi32(t, t));
+    __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi32(t, t));
+    lo = _mm_add_epi16(lo, round);
+    hi = _mm_add_epi16(hi, round);
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+    __m128i out = _mm_adds_epu8(_mm_and_si128(s, rgb), _mm_packus_epi16(lo, hi));
+    _mm_storeu_si128((__m128i *)(dst + i), out);
+  }
+#endif
+  for (; i < n; i ++) dst[i] = gpu_blend(dst[i], src[i]);
+}
+
+// draw `cv' into the canvas `px' of pw * ph pixels, false if the tree is malformed
+static inline bool gpu_render_node(GPURender *g, const struct gpu_canvas *cv,
+    uint32_t *px, int pw, int ph) {
+  if (++ g->nr_node > GPU_MAX_NODE) return false;
+  uint8_t *scratch_mark = g->scratch_head;
+  uint32_t *local;
+  int w, h;
+  switch (cv->type) {
+    case AM_GPU_TEXTURE:
+      w = cv->texture.w; h = cv->texture.h;
+      if (cv->texture.pixels % sizeof(uint32_t) != 0) return false;
+      local = gpu_vmem_ptr(g, cv->texture.pixels, (uint64_t)w * h * sizeof(uint32_t));
+      if (local == NULL) return false;
+      break;
+    case AM_GPU_SUBTREE:
+      w = cv->w; h = cv->h;
+      local = gpu_scratch_alloc(g, (uint64_t)w * h * sizeof(uint32_t));
+      if (local == NULL) return false;
+      for (int i = 0; i < w * h; i ++) local[i] = 0xff000000; // transparent
+      for (gpuptr_t ch = cv->child; ch != AM_GPU_NULL; ) {
+        struct gpu_canvas child;
+        const void *p = gpu_vmem_ptr(g, ch, sizeof(child));
+        if (p == NULL) return false;
+        memcpy(&child, p, sizeof(child));
+        if (!gpu_render_node(g, &child, local, w, h)) return false;
+        ch = child.sibling;
+      }
+      break;
+    default: return false;
+  }
+
+  // scale the local canvas (w * h) to (x1, y1) - (x1 + w1, y1 + h1) of px
+  int x1 = cv->x1, y1 = cv->y1, w1 = cv->w1, h1 = cv->h1;
+  if (w1 > pw - x1) w1 = pw - x1; // clip to px
+  if (h1 > ph - y1) h1 = ph - y1;
+  if (w > 0 && h > 0 && w1 > 0 && h1 > 0) {
+    uint32_t *row = NULL, *xmap = NULL;
+    if (w != cv->w1) {
+      row = gpu_scratch_alloc(g, w1 * sizeof(uint32_t));
+      xmap = gpu_scratch_alloc(g, w1 * sizeof(uint32_t));
+      if (row == NULL || xmap == NULL) return false;
+      for (int i = 0; i < w1; i ++) xmap[i] = i * w / cv->w1;
+    }
+    for (int j = 0; j < h1; j ++) {
+      const uint32_t *src = local + w * (j * h / cv->h1);
+      if (row != NULL) {
+        for (int i = 0; i < w1; i ++) row[i] = src[xmap[i]];
+        src = row;
+      }
+      gpu_blend_row(px + pw * (y1 + j) + x1, src, w1);
+    }
+  }
+  g->scratch_head = scratch_mark;
+  return true;
+}
+
+// composite the tree at `root' into the frame buffer `fb' of w * h pixels,
+// false if the tree is malformed, the frame is then partially drawn
+static inline bool gpu_render(GPURender *g, gpuptr_t root, uint32_t *fb, int w, int h) {
+  struct gpu_canvas cv;
+  const void *p = gpu_vmem_ptr(g, root, sizeof(cv));
+  if (p == NULL) return false;
+  memcpy(&cv, p, sizeof(cv));
+  g->scratch_head = g->scratch;
+  g->nr_node = 0;
+  return gpu_render_node(g, &cv, fb, w, h);
+}
+
+#endif
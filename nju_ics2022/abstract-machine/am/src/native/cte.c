@@ -1,13 +1,20 @@
-#include <sys/time.h>
+#include <sys/syscall.h>
 #include <string.h>
+#include <time.h>
 #include "platform.h"
 
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
 #define TIMER_HZ 100
-#define SYSCALL_INSTR_LEN 7
 
 static Context* (*user_handler)(Event, Context*) = NULL;
 
 void __am_kcontext_start();
+void __am_yield_gate();
+void __am_sigreturn(ucontext_t *uc) __attribute__((noreturn));
+extern uint8_t __am_gate_begin, __am_gate_end;
 void __am_switch(Context *c);
 int __am_in_userspace(void *addr);
 void __am_pmem_protect();
@@ -15,6 +22,8 @@ void __am_pmem_unprotect();
 
 void __am_panic_on_return() { panic("should not reach here\n"); }
 
+static void iret(Context *c) __attribute__((noreturn));
+
 static void irq_handle(Context *c) {
   c->vm_head = thiscpu->vm_head;
   c->ksp = thiscpu->ksp;
@@ -29,21 +38,106 @@ static void irq_handle(Context *c) {
   assert(c != NULL);
 
   __am_switch(c);
+  iret(c);
+}
+
+// The saved FPU state is kept in the context, since the one in the signal
+// frame is overwritten by the next signal. Only the legacy part (x87 and SSE)
+// is kept, the software reserved bytes are cleared to tell the kernel.
+#define FP_SW_RESERVED_OFFSET 464
+
+static void save_fpregs(Context *c, const ucontext_t *uc) {
+  if (uc->uc_mcontext.fpregs == NULL) return;
+  memcpy(&c->uc.__fpregs_mem, uc->uc_mcontext.fpregs, sizeof(c->uc.__fpregs_mem));
+  memset((uint8_t *)&c->uc.__fpregs_mem + FP_SW_RESERVED_OFFSET, 0,
+      sizeof(c->uc.__fpregs_mem) - FP_SW_RESERVED_OFFSET);
+  c->uc.uc_mcontext.fpregs = &c->uc.__fpregs_mem;
+}
+
+// Restore the context with rt_sigreturn directly, which loads all registers
+// and the signal mask at once, without delivering another signal.
+static void iret(Context *c) {
+  thiscpu->ksp = c->ksp;
+  if (__am_in_userspace((void *)c->uc.uc_mcontext.gregs[REG_RIP])) __am_pmem_protect();
+
+  // the context may be saved on another CPU, which has another signal stack
+  c->uc.uc_stack.ss_sp = thiscpu->sigstack;
+  c->uc.uc_stack.ss_size = sizeof(thiscpu->sigstack);
+  c->uc.uc_stack.ss_flags = 0;
+
+  // The context may be copied, and fxrstor requires 16-byte alignment, so a
+  // misaligned FPU state is restored from an aligned copy. The copy is on
+  // this stack, which rt_sigreturn reads before it switches to the context.
+  struct _libc_fpstate fpregs __attribute__((aligned(16)));
+  if (c->uc.uc_mcontext.fpregs != NULL) {
+    c->uc.uc_mcontext.fpregs = &c->uc.__fpregs_mem;
+    if ((uintptr_t)&c->uc.__fpregs_mem % 16 != 0) {
+      memcpy(&fpregs, &c->uc.__fpregs_mem, sizeof(fpregs));
+      c->uc.uc_mcontext.fpregs = &fpregs;
+    }
+  }
+  __am_sigreturn(&c->uc);
+}
+
+// The context is put below the red zone of `sp', and (c + 8) % 16 == 0
+// as if irq_handle(c) were called, which also aligns c->uc.__fpregs_mem.
+static Context *context_at(uintptr_t sp) {
+  sp -= sizeof(Context);
+  if ((sp + 8) % 16 != 0) sp -= 8;
+  return (void *)sp;
+}
+
+// The registers saved by the gates in trap.S, on the stack of the caller.
+typedef struct {
+  uint64_t sigmask;
+  uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
+  uint64_t rbp, rdi, rsi, rdx, rcx, rbx, rax, rflags;
+  uint64_t is_syscall;
+  uint64_t rip; // pushed by the call to the gate
+} TrapFrame;
+
+// Yield and system calls enter the kernel with a call to a gate instead of
+// a signal. The gate saves the registers and disables interrupts, then asks
+// for the place of the context, which is on the kernel stack if the call is
+// from user space, and moves the stack there.
+Context *__am_gate_context(TrapFrame *tf) {
+  uintptr_t sp = __am_in_userspace((void *)tf->rip) ? thiscpu->ksp : (uintptr_t)tf;
+  return context_at(sp);
+}
+
+void __am_gate_entry(TrapFrame *tf, Context *c) {
+  if (__am_in_userspace((void *)tf->rip)) __am_pmem_unprotect();
+
+  // the segment registers and flags of the example context are valid
+  __am_get_example_uc(c);
+  greg_t *gregs = c->uc.uc_mcontext.gregs;
+  gregs[REG_R8 ] = tf->r8;  gregs[REG_R9 ] = tf->r9;
+  gregs[REG_R10] = tf->r10; gregs[REG_R11] = tf->r11;
+  gregs[REG_R12] = tf->r12; gregs[REG_R13] = tf->r13;
+  gregs[REG_R14] = tf->r14; gregs[REG_R15] = tf->r15;
+  gregs[REG_RDI] = tf->rdi; gregs[REG_RSI] = tf->rsi;
+  gregs[REG_RBP] = tf->rbp; gregs[REG_RBX] = tf->rbx;
+  gregs[REG_RDX] = tf->rdx; gregs[REG_RAX] = tf->rax;
+  gregs[REG_RCX] = tf->rcx;
+  gregs[REG_EFL] = tf->rflags;
+  gregs[REG_RIP] = tf->rip;
+  gregs[REG_RSP] = (uintptr_t)(&tf->rip + 1);
+  memcpy(&c->uc.uc_sigmask, &tf->sigmask, sizeof(tf->sigmask));
 
-  // magic call to restore context
-  void (*p)(Context *c) = (void *)(uintptr_t)0x100008;
-  p(c);
-  __am_panic_on_return();
+  thiscpu->ev = (Event) {0};
+  thiscpu->ev.event = (tf->is_syscall ? EVENT_SYSCALL : EVENT_YIELD);
+  irq_handle(c);
 }
 
 static void setup_stack(uintptr_t event, ucontext_t *uc) {
   void *rip = (void *)uc->uc_mcontext.gregs[REG_RIP];
   extern uint8_t _start, _etext;
   int trap_from_user = __am_in_userspace(rip);
-  int signal_safe = IN_RANGE(rip, RANGE(&_start, &_etext)) || trap_from_user ||
-    // Hack here: "+13" points to the instruction after syscall. This is the
-    // instruction which will trigger the pending signal if interrupt is enabled.
-    (rip == (void *)&sigprocmask + 13);
+  // A pending interrupt is delivered right after the system call in iset(),
+  // which is also in AM.
+  int signal_safe = (IN_RANGE(rip, RANGE(&_start, &_etext)) &&
+      // the gates are on the stack of the caller before they disable interrupts
+      !IN_RANGE(rip, RANGE(&__am_gate_begin, &__am_gate_end))) || trap_from_user;
 
   if (((event == EVENT_IRQ_IODEV) || (event == EVENT_IRQ_TIMER)) && !signal_safe) {
     // Shared libraries contain code which are not reenterable.
@@ -58,19 +152,12 @@ static void setup_stack(uintptr_t event, ucontext_t *uc) {
 
   if (trap_from_user) __am_pmem_unprotect();
 
-  // skip the instructions causing SIGSEGV for syscall
-  if (event == EVENT_SYSCALL) { rip += SYSCALL_INSTR_LEN; }
-  uc->uc_mcontext.gregs[REG_RIP] = (uintptr_t)rip;
-
   // switch to kernel stack if we were previously in user space
-  uintptr_t rsp = trap_from_user ? thiscpu->ksp : uc->uc_mcontext.gregs[REG_RSP];
-  rsp -= sizeof(Context);
-  // keep (rsp + 8) % 16 == 0 to support SSE
-  if ((rsp + 8) % 16 != 0) rsp -= 8;
-  Context *c = (void *)rsp;
+  Context *c = context_at(trap_from_user ? thiscpu->ksp : uc->uc_mcontext.gregs[REG_RSP]);
 
   // save the context on the stack
   c->uc = *uc;
+  save_fpregs(c, uc);
 
   // disable interrupt
   __am_get_intr_sigmask(&uc->uc_sigmask);
@@ -81,14 +168,6 @@ static void setup_stack(uintptr_t event, ucontext_t *uc) {
   uc->uc_mcontext.gregs[REG_RSP] = (uintptr_t)c;
 }
 
-static void iret(ucontext_t *uc) {
-  Context *c = (void *)uc->uc_mcontext.gregs[REG_RDI];
-  // restore the context
-  *uc = c->uc;
-  thiscpu->ksp = c->ksp;
-  if (__am_in_userspace((void *)uc->uc_mcontext.gregs[REG_RIP])) __am_pmem_protect();
-}
-
 static void sig_handler(int sig, siginfo_t *info, void *ucontext) {
   thiscpu->ev = (Event) {0};
   thiscpu->ev.event = EVENT_ERROR;
@@ -97,12 +176,6 @@ static void sig_handler(int sig, siginfo_t *info, void *ucontext) {
     case SIGUSR2: thiscpu->ev.event = EVENT_YIELD; break;
     case SIGVTALRM: thiscpu->ev.event = EVENT_IRQ_TIMER; break;
     case SIGSEGV:
-      if (info->si_code == SEGV_ACCERR) {
-        switch ((uintptr_t)info->si_addr) {
-          case 0x100000: thiscpu->ev.event = EVENT_SYSCALL; break;
-          case 0x100008: iret(ucontext); return;
-        }
-      }
       if (__am_in_userspace(info->si_addr)) {
         assert(thiscpu->ev.event == EVENT_ERROR);
         thiscpu->ev.event = EVENT_PAGEFAULT;
@@ -125,7 +198,7 @@ static void sig_handler(int sig, siginfo_t *info, void *ucontext) {
   setup_stack(thiscpu->ev.event, ucontext);
 }
 
-// signal handlers are inherited across fork()
+// signal handlers are shared by threads and inherited across fork()
 static void install_signal_handler() {
   struct sigaction s;
   memset(&s, 0, sizeof(s));
@@ -143,15 +216,24 @@ static void install_signal_handler() {
   assert(ret == 0);
 }
 
-// setitimer() are inherited across fork(), should be called again from children
+// Each CPU has its own timer, which counts the CPU time of the calling thread
+// and sends the interrupt to this thread only. Should be called on every CPU.
 void __am_init_timer_irq() {
   iset(0);
 
-  struct itimerval it = {};
+  struct sigevent sev = {};
+  sev.sigev_notify = SIGEV_THREAD_ID;
+  sev.sigev_signo = SIGVTALRM;
+  sev.sigev_notify_thread_id = syscall(SYS_gettid);
+  timer_t timer;
+  int ret = timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &timer);
+  assert(ret == 0);
+
+  struct itimerspec it = {};
   it.it_value.tv_sec = 0;
-  it.it_value.tv_usec = 1000000 / TIMER_HZ;
+  it.it_value.tv_nsec = 1000000000 / TIMER_HZ;
   it.it_interval = it.it_value;
-  int ret = setitimer(ITIMER_VIRTUAL, &it, NULL);
+  ret = timer_settime(timer, 0, &it, NULL);
   assert(ret == 0);
 }
 
@@ -181,19 +263,29 @@ Context* kcontext(Area kstack, void (*entry)(void *), void *arg) {
 }
 
 void yield() {
-  raise(SIGUSR2);
+  __am_yield_gate();
+}
+
+// Change the signal mask of the calling thread with the system call directly.
+// The pending interrupts are delivered right after the syscall instruction,
+// so it is in AM instead of the shared libraries, see setup_stack().
+static void thread_sigmask(int how, const sigset_t *set, sigset_t *oldset) {
+  long ret;
+  register long sigsetsize asm("r10") = _NSIG / 8;
+  asm volatile ("syscall"
+      : "=a"(ret)
+      : "0"((long)SYS_rt_sigprocmask), "D"((long)how), "S"(set), "d"(oldset), "r"(sigsetsize)
+      : "rcx", "r11", "memory");
+  assert(ret == 0);
 }
 
 bool ienabled() {
   sigset_t set;
-  int ret = sigprocmask(0, NULL, &set);
-  assert(ret == 0);
+  thread_sigmask(0, NULL, &set);
   return __am_is_sigmask_sti(&set);
 }
 
 void iset(bool enable) {
   extern sigset_t __am_intr_sigmask;
-  // NOTE: sigprocmask does not supported in multithreading
-  int ret = sigprocmask(enable ? SIG_UNBLOCK : SIG_BLOCK, &__am_intr_sigmask, NULL);
-  assert(ret == 0);
+  thread_sigmask(enable ? SIG_UNBLOCK : SIG_BLOCK, &__am_intr_sigmask, NULL);
 }
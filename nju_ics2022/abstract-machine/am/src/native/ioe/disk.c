@@ -1,41 +1,144 @@
 #include <am.h>
 #include <stdlib.h>
-#include <stdio.h>
-#include <assert.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../platform.h"
 
 #define BLKSZ 512
+#define READ_AHEAD_MAX (1 << 20)
 
+// The disk image is mapped with MAP_SHARED, so block I/O is a memcpy().
+// With `diskasync=1', the requests are served by a worker thread, and
+// DISK_STATUS.ready is false until all requests issued are done.
 static int disk_size = 0;
-static FILE *fp = NULL;
+static uint8_t *disk = NULL;
+static size_t disk_bytes = 0;
+// sequential reads are detected to read ahead up to `ahead_end'
+static uint32_t next_blkno = 0;
+static size_t ahead_end = 0;
+
+static bool async = false;
+static pthread_t worker;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; // for the producers
+static pthread_mutex_t sleep_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static bool sleeping = false; // protected by `sleep_lock'
+#define NR_REQ 64
+#define SPIN 20000 // the worker spins for a while before sleeping
+static int spin = 0;  // but not on a single host CPU
+static AM_DISK_BLKIO_T reqs[NR_REQ];
+static atomic_uint req_head = 0, req_tail = 0;
 
 void __am_disk_init() {
   const char *diskimg = getenv("diskimg");
   if (diskimg) {
-    fp = fopen(diskimg, "r+");
-    if (fp) {
-      fseek(fp, 0, SEEK_END);
-      disk_size = (ftell(fp) + 511) / 512;
-      rewind(fp);
+    int fd = open(diskimg, O_RDWR);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+      disk_size = (st.st_size + BLKSZ - 1) / BLKSZ;
+      disk_bytes = (size_t)disk_size * BLKSZ;
+      // extend a partial block at the end, or the writes past the end of
+      // the file to the last page would not reach the file
+      if (disk_bytes != st.st_size) {
+        int ret = ftruncate(fd, disk_bytes);
+        assert(ret == 0);
+      }
+      disk = mmap(NULL, disk_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      assert(disk != MAP_FAILED);
     }
+    if (fd >= 0) close(fd);
   }
+  const char *s = getenv("diskasync");
+  async = (s != NULL && atoi(s) != 0);
+  spin = (sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN : 0);
 }
 
 void __am_disk_config(AM_DISK_CONFIG_T *cfg) {
-  cfg->present = (fp != NULL);
+  cfg->present = (disk != NULL);
   cfg->blksz = BLKSZ;
   cfg->blkcnt = disk_size;
 }
 
 void __am_disk_status(AM_DISK_STATUS_T *stat) {
-  stat->ready = 1;
+  stat->ready = (atomic_load(&req_head) == atomic_load(&req_tail));
+  // the guest is likely to poll, let the worker run if it shares the host CPU
+  if (!stat->ready) sched_yield();
+}
+
+static void do_blkio(const AM_DISK_BLKIO_T *io) {
+  assert(io->blkno >= 0 && io->blkcnt >= 0 && io->blkno + io->blkcnt <= disk_size);
+  uint8_t *p = disk + (size_t)io->blkno * BLKSZ;
+  size_t size = (size_t)io->blkcnt * BLKSZ;
+  if (io->write) {
+    memcpy(p, io->buf, size);
+    return;
+  }
+  size_t off = (size_t)io->blkno * BLKSZ;
+  if (io->blkno == next_blkno && off + size * 2 > ahead_end && ahead_end < disk_bytes) {
+    // sequential read near the end of the window, move the window forward,
+    // so that there is one madvise() for many requests
+    size_t pgmask = sysconf(_SC_PAGESIZE) - 1;
+    size_t start = (off + size > ahead_end ? off + size : ahead_end) & ~pgmask;
+    ahead_end = start + READ_AHEAD_MAX;
+    if (ahead_end > disk_bytes) ahead_end = disk_bytes;
+    madvise(disk + start, ahead_end - start, MADV_WILLNEED);
+  }
+  next_blkno = io->blkno + io->blkcnt;
+  memcpy(io->buf, p, size);
+}
+
+static void *worker_main(void *arg) {
+  sigset_t set;
+  sigfillset(&set);
+  pthread_sigmask(SIG_BLOCK, &set, NULL); // interrupts are for the CPUs
+  while (1) {
+    unsigned head = atomic_load(&req_head);
+    for (int i = 0; head == atomic_load(&req_tail); i ++) {
+      if (i < spin) { asm volatile ("pause"); continue; }
+      pthread_mutex_lock(&sleep_lock);
+      sleeping = true;
+      while (head == atomic_load(&req_tail)) pthread_cond_wait(&cond, &sleep_lock);
+      sleeping = false;
+      pthread_mutex_unlock(&sleep_lock);
+    }
+    do_blkio(&reqs[head % NR_REQ]);
+    atomic_store(&req_head, head + 1);
+  }
+  return NULL;
 }
 
 void __am_disk_blkio(AM_DISK_BLKIO_T *io) {
-  if (fp) {
-    fseek(fp, io->blkno * BLKSZ, SEEK_SET);
-    int ret;
-    if (io->write) ret = fwrite(io->buf, io->blkcnt * BLKSZ, 1, fp);
-    else ret = fread(io->buf, io->blkcnt * BLKSZ, 1, fp);
-    assert(ret == 1);
+  if (disk == NULL) return;
+  // the worker does not follow the CPUs forked for VME
+  if (!async || __am_vme_enabled()) {
+    do_blkio(io);
+    return;
+  }
+
+  // a context switch while holding the lock may deadlock
+  bool intr = ienabled();
+  iset(false);
+  pthread_mutex_lock(&lock);
+  static bool worker_started = false;
+  if (!worker_started) {
+    int ret = pthread_create(&worker, NULL, worker_main, NULL);
+    assert(ret == 0);
+    worker_started = true;
   }
+  unsigned tail = atomic_load(&req_tail);
+  while (tail - atomic_load(&req_head) == NR_REQ) sched_yield(); // full
+  reqs[tail % NR_REQ] = *io;
+  atomic_store(&req_tail, tail + 1);
+  pthread_mutex_lock(&sleep_lock);
+  if (sleeping) pthread_cond_signal(&cond);
+  pthread_mutex_unlock(&sleep_lock);
+  pthread_mutex_unlock(&lock);
+  iset(intr);
 }
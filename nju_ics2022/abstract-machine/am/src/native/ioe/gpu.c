@@ -1,6 +1,14 @@
 #include <am.h>
+#include <klib-macros.h>
 #include <SDL2/SDL.h>
 #include <fenv.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <gpu-render.h>
 
 //#define MODE_800x600
 #ifdef MODE_800x600
@@ -12,6 +20,7 @@
 #endif
 
 #define FPS   60
+#define VMEM_SIZE (4 << 20)
 
 #define RMASK 0x00ff0000
 #define GMASK 0x0000ff00
@@ -37,16 +46,31 @@ void __am_gpu_init() {
       W * 2, H * 2,
 #endif
       SDL_WINDOW_OPENGL);
-  surface = SDL_CreateRGBSurface(SDL_SWSURFACE, W, H, 32,
-      RMASK, GMASK, BMASK, AMASK);
+  // with `fbimg', the frame buffer is a shared mapping of that file,
+  // so that other programs can watch or dump the screen
+  const char *fbimg = getenv("fbimg");
+  if (fbimg != NULL) {
+    int fd = open(fbimg, O_RDWR | O_CREAT, 0644);
+    assert(fd >= 0);
+    int ret = ftruncate(fd, W * H * sizeof(uint32_t));
+    assert(ret == 0);
+    void *fb = mmap(NULL, W * H * sizeof(uint32_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    assert(fb != MAP_FAILED);
+    close(fd);
+    surface = SDL_CreateRGBSurfaceFrom(fb, W, H, 32, W * sizeof(uint32_t),
+        RMASK, GMASK, BMASK, AMASK);
+  } else {
+    surface = SDL_CreateRGBSurface(SDL_SWSURFACE, W, H, 32,
+        RMASK, GMASK, BMASK, AMASK);
+  }
   SDL_AddTimer(1000 / FPS, texture_sync, NULL);
 }
 
 void __am_gpu_config(AM_GPU_CONFIG_T *cfg) {
   *cfg = (AM_GPU_CONFIG_T) {
-    .present = true, .has_accel = false,
+    .present = true, .has_accel = true,
     .width = W, .height = H,
-    .vmemsz = 0
+    .vmemsz = VMEM_SIZE
   };
 }
 
@@ -64,3 +88,20 @@ void __am_gpu_fbdraw(AM_GPU_FBDRAW_T *ctl) {
   SDL_BlitSurface(s, NULL, surface, &rect);
   SDL_FreeSurface(s);
 }
+
+// 2D acceleration: the render tree in vmem is composited into the surface
+static uint8_t vmem[VMEM_SIZE] __attribute__((aligned(16)));
+static uint8_t vbuf[VMEM_SIZE] __attribute__((aligned(16)));
+static GPURender gpu = {
+  .vmem = vmem, .vmemsz = VMEM_SIZE, .scratch = vbuf, .scratch_end = vbuf + VMEM_SIZE,
+};
+
+void __am_gpu_memcpy(AM_GPU_MEMCPY_T *params) {
+  void *dest = gpu_vmem_ptr(&gpu, params->dest, params->size);
+  panic_on(dest == NULL, "GPU: out of video memory");
+  memcpy(dest, params->src, params->size);
+}
+
+void __am_gpu_render(AM_GPU_RENDER_T *ren) {
+  panic_on(!gpu_render(&gpu, ren->root, surface->pixels, W, H), "GPU: malformed render tree");
+}
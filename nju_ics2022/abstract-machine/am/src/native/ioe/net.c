@@ -0,0 +1,97 @@
+#include <am.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// The packets go to a peer (NEMU or another native AM) through a
+// SOCK_SEQPACKET Unix socket given by the environment variable `nic', which
+// is the same protocol as the NIC of NEMU. The first one listens on the path,
+// and the second one connects to it. Without `nic', the packets are looped back.
+
+#define LOOPBACK_NR_PKT 64
+
+static bool is_loopback = true;
+static int listen_fd = -1, peer_fd = -1;
+static struct { void *data; int len; } loopback[LOOPBACK_NR_PKT];
+static uint32_t loopback_head = 0, loopback_tail = 0;
+
+void __am_net_init() {
+  const char *path = getenv("nic");
+  if (path == NULL || path[0] == '\0') return;
+  is_loopback = false;
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  assert(strlen(path) < sizeof(addr.sun_path));
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0);
+  assert(fd >= 0);
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+    peer_fd = fd;
+    return;
+  }
+  unlink(path);
+  int ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+  assert(ret == 0);
+  ret = listen(fd, 1);
+  assert(ret == 0);
+  listen_fd = fd;
+}
+
+static bool peer_ready() {
+  if (peer_fd < 0 && listen_fd >= 0) {
+    peer_fd = accept(listen_fd, NULL, NULL);
+    if (peer_fd >= 0) fcntl(peer_fd, F_SETFL, O_NONBLOCK);
+  }
+  return peer_fd >= 0;
+}
+
+void __am_net_config(AM_NET_CONFIG_T *cfg) {
+  cfg->present = true;
+}
+
+void __am_net_status(AM_NET_STATUS_T *stat) {
+  stat->tx_len = 0; // packets are sent at once
+  stat->rx_len = 0;
+  if (is_loopback) {
+    if (loopback_head != loopback_tail) {
+      stat->rx_len = loopback[loopback_head % LOOPBACK_NR_PKT].len;
+    }
+  } else if (peer_ready()) {
+    // the size of the next packet, without receiving it
+    ssize_t n = recv(peer_fd, NULL, 0, MSG_PEEK | MSG_TRUNC);
+    if (n > 0) stat->rx_len = n;
+    else if (n == 0) { close(peer_fd); peer_fd = -1; } // the peer has gone
+  }
+}
+
+void __am_net_tx(AM_NET_TX_T *tx) {
+  int len = tx->buf.end - tx->buf.start;
+  if (is_loopback) {
+    if (loopback_tail - loopback_head == LOOPBACK_NR_PKT) return; // dropped
+    void *data = malloc(len);
+    assert(data != NULL);
+    memcpy(data, tx->buf.start, len);
+    loopback[loopback_tail % LOOPBACK_NR_PKT].data = data;
+    loopback[loopback_tail % LOOPBACK_NR_PKT].len = len;
+    loopback_tail ++;
+  } else if (peer_ready()) {
+    send(peer_fd, tx->buf.start, len, MSG_NOSIGNAL); // dropped if the peer is slow
+  }
+}
+
+void __am_net_rx(AM_NET_RX_T *rx) {
+  int size = rx->buf.end - rx->buf.start;
+  if (is_loopback) {
+    if (loopback_head == loopback_tail) return;
+    typeof(loopback[0]) *p = &loopback[loopback_head % LOOPBACK_NR_PKT];
+    memcpy(rx->buf.start, p->data, (p->len < size ? p->len : size));
+    free(p->data);
+    loopback_head ++;
+  } else if (peer_ready()) {
+    recv(peer_fd, rx->buf.start, size, 0);
+  }
+}
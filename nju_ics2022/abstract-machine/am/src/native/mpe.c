@@ -1,13 +1,24 @@
 #include <stdatomic.h>
+#include <pthread.h>
 #include "platform.h"
 
 int __am_mpe_init = 0;
 extern bool __am_has_ioe;
 void __am_ioe_init();
 
-bool mpe_init(void (*entry)()) {
-  __am_mpe_init = 1;
+static void (*cpu_entry)() = NULL;
+
+static void *cpu_thread(void *arg) {
+  __am_init_cpu((intptr_t)arg);
+  __am_init_timer_irq();
+  cpu_entry();
+  panic("MP entry should not return\n");
+}
 
+// The address spaces with VME are mappings in the host, which can not be
+// different among threads. In this case every CPU is still a process, and
+// only pmem and the data sections are shared.
+static void start_cpu_processes(void (*entry)()) {
   int sync_pipe[2];
   assert(0 == pipe(sync_pipe));
 
@@ -32,7 +43,27 @@ bool mpe_init(void (*entry)()) {
     assert(write(sync_pipe[1], "+", 1) == 1);
   }
   close(sync_pipe[0]); close(sync_pipe[1]);
-  
+}
+
+bool mpe_init(void (*entry)()) {
+  __am_mpe_init = 1;
+
+  if (__am_vme_enabled()) {
+    start_cpu_processes(entry);
+  } else {
+    // initialize the devices before the other CPUs can access them
+    if (__am_has_ioe) {
+      __am_ioe_init();
+    }
+
+    cpu_entry = entry;
+    for (int i = 1; i < cpu_count(); i++) {
+      pthread_t tid;
+      int ret = pthread_create(&tid, NULL, cpu_thread, (void *)(intptr_t)i);
+      assert(ret == 0);
+    }
+  }
+
   entry();
   panic("MP entry should not return\n");
 }
@@ -3,6 +3,7 @@
 #include <sys/auxv.h>
 #include <dlfcn.h>
 #include <elf.h>
+#include <sys/syscall.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include "platform.h"
@@ -16,7 +17,8 @@ static void *pmem = NULL;
 static ucontext_t uc_example = {};
 static void *(*memcpy_libc)(void *, const void *, size_t) = NULL;
 sigset_t __am_intr_sigmask = {};
-__am_cpu_t *__am_cpu_struct = NULL;
+__thread __am_cpu_t *__am_cpu_struct = NULL;
+static pid_t cpu0_tid = 0;
 int __am_ncpu = 0;
 int __am_pgsize = 0;
 
@@ -56,6 +58,18 @@ static void setup_sigaltstack() {
   assert(ret == 0);
 }
 
+// allocate the private per-cpu structure for the calling thread
+void __am_init_cpu(int cpuid) {
+  thiscpu = mmap(NULL, sizeof(*thiscpu), PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert(thiscpu != (void *)-1);
+  thiscpu->cpuid = cpuid;
+  thiscpu->vm_head = NULL;
+  thiscpu->vm_mapped = NULL;
+  thiscpu->vm_gen = 0;
+  setup_sigaltstack();
+}
+
 int main(const char *args);
 
 static void init_platform() __attribute__((constructor));
@@ -70,17 +84,19 @@ static void init_platform() {
   assert(pmem != (void *)-1);
 
   // allocate private per-cpu structure
-  thiscpu = mmap(NULL, sizeof(*thiscpu), PROT_READ | PROT_WRITE,
-      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-  assert(thiscpu != (void *)-1);
-  thiscpu->cpuid = 0;
-  thiscpu->vm_head = NULL;
+  __am_init_cpu(0);
+  cpu0_tid = syscall(SYS_gettid);
 
-  // create trap page to receive syscall and yield by SIGSEGV
+  // create trap page for syscalls, `call *0x100000' jumps to the gate,
+  // see trap.S for the red zone of the caller
   int sys_pgsz = sysconf(_SC_PAGESIZE);
-  void *ret = mmap(TRAP_PAGE_START, sys_pgsz, PROT_NONE,
+  void *ret = mmap(TRAP_PAGE_START, sys_pgsz, PROT_READ | PROT_WRITE,
       MAP_SHARED | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
   assert(ret != (void *)-1);
+  extern void __am_syscall_gate();
+  *(void **)TRAP_PAGE_START = __am_syscall_gate;
+  int ret2 = mprotect(TRAP_PAGE_START, sys_pgsz, PROT_READ);
+  assert(ret2 == 0);
 
   // save the address of memcpy() in glibc, since it may be linked with klib
   memcpy_libc = dlsym(RTLD_NEXT, "memcpy");
@@ -90,7 +106,6 @@ static void init_platform() {
   Elf64_Phdr *phdr = (void *)getauxval(AT_PHDR);
   int phnum = (int)getauxval(AT_PHNUM);
   int i;
-  int ret2;
   for (i = 0; i < phnum; i ++) {
     if (phdr[i].p_type == PT_LOAD && (phdr[i].p_flags & PF_W)) {
       // allocate temporary memory
@@ -117,7 +132,8 @@ static void init_platform() {
       ret2 = munmap(vaddr_align, size);
       assert(ret2 == 0);
 
-      // map the sections again with MAP_SHARED, which will be shared across fork()
+      // map the sections again with MAP_SHARED, which will be shared across fork(),
+      // used by the CPUs when VME is enabled
       ret = mmap_libc(vaddr_align, size, PROT_READ | PROT_WRITE | PROT_EXEC,
           MAP_SHARED | MAP_FIXED | MAP_ANONYMOUS, -1, 0);
       assert(ret == vaddr_align);
@@ -142,9 +158,6 @@ static void init_platform() {
   ret2 = sigaddset(&__am_intr_sigmask, SIGUSR1);
   assert(ret2 == 0);
 
-  // setup alternative signal stack
-  setup_sigaltstack();
-
   // save the context template
   save_example_context();
   uc_example.uc_mcontext.fpregs = NULL; // clear the FPU context
@@ -171,26 +184,28 @@ static void init_platform() {
 }
 
 void __am_exit_platform(int code) {
-  // let Linux clean up other resource
+  // let Linux clean up other resource, exit() also terminates the other
+  // CPUs if they are threads, but not if they are processes
   extern int __am_mpe_init;
-  if (__am_mpe_init && cpu_count() > 1) kill(0, SIGKILL);
+  if (__am_mpe_init && cpu_count() > 1 && __am_vme_enabled()) kill(0, SIGKILL);
   exit(code);
 }
 
-void __am_pmem_map(void *va, void *pa, int prot) {
+// map [va, va + size) to [pa, pa + size) with a single mmap()
+void __am_pmem_map(void *va, void *pa, size_t size, int prot) {
   // translate AM prot to mmap prot
   int mmap_prot = PROT_NONE;
   // we do not support executable bit, so mark
   // all readable pages executable as well
   if (prot & MMAP_READ) mmap_prot |= PROT_READ | PROT_EXEC;
   if (prot & MMAP_WRITE) mmap_prot |= PROT_WRITE;
-  void *ret = mmap(va, __am_pgsize, mmap_prot,
+  void *ret = mmap(va, size, mmap_prot,
       MAP_SHARED | MAP_FIXED, pmem_fd, (uintptr_t)(pa - pmem));
   assert(ret != (void *)-1);
 }
 
-void __am_pmem_unmap(void *va) {
-  int ret = munmap(va, __am_pgsize);
+void __am_pmem_unmap(void *va, size_t size) {
+  int ret = munmap(va, size);
   assert(ret == 0);
 }
 
@@ -206,8 +221,9 @@ int __am_is_sigmask_sti(sigset_t *s) {
   return !sigismember(s, SIGVTALRM);
 }
 
+// the interrupts of devices are routed to CPU #0
 void __am_send_kbd_intr() {
-  kill(getpid(), SIGUSR1);
+  syscall(SYS_tgkill, getpid(), cpu0_tid, SIGUSR1);
 }
 
 void __am_pmem_protect() {
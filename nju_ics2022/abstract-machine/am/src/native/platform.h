@@ -11,18 +11,22 @@ void __am_get_example_uc(Context *r);
 void __am_get_intr_sigmask(sigset_t *s);
 int __am_is_sigmask_sti(sigset_t *s);
 void __am_init_timer_irq();
-void __am_pmem_map(void *va, void *pa, int prot);
-void __am_pmem_unmap(void *va);
+void __am_pmem_map(void *va, void *pa, size_t size, int prot);
+void __am_pmem_unmap(void *va, size_t size);
+void __am_init_cpu(int cpuid);
+int __am_vme_enabled();
 
-// per-cpu structure
+// per-cpu structure, each CPU is a host thread (or a process with VME)
 typedef struct {
   void *vm_head;
+  void *vm_mapped; // the address space whose pages are mapped in the host
+  uint64_t vm_gen; // and its generation
   uintptr_t ksp;
   int cpuid;
   Event ev; // similar to cause register in mips/riscv
-  uint8_t sigstack[32768];
+  uint8_t sigstack[65536]; // SIGSTKSZ is larger with AVX-512 and AMX
 } __am_cpu_t;
-extern __am_cpu_t *__am_cpu_struct;
+extern __thread __am_cpu_t *__am_cpu_struct;
 #define thiscpu __am_cpu_struct
 
 #endif
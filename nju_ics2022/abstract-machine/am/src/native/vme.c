@@ -1,122 +1,209 @@
-#define _GNU_SOURCE
-#include <search.h>
+#include <stdatomic.h>
 #include "platform.h"
 
 #define USER_SPACE RANGE(0x40000000, 0xc0000000)
 
-typedef struct PageMap {
-  void *va;
-  void *pa;
-  struct PageMap *next;
-  int prot;
-  int is_mapped;
-  char key[32];  // used for hsearch_r()
-} PageMap;
-
+// Each address space has a radix page table indexed by the virtual page
+// number, like the one of a real MMU. The tables are pages from pgalloc(),
+// and a leaf entry holds the physical address and the protection.
+typedef uintptr_t PTE;
+#define PTE_V    0x100 // valid, the low bits of an aligned pa are free
+#define PTE_PROT (MMAP_READ | MMAP_WRITE)
+#define PTE_PA(pte) ((void *)((pte) & ~(uintptr_t)(__am_pgsize - 1)))
+
+// The generation tells an address space from an earlier one whose VMHead
+// was at the same address, since the pages of VMHeads are reused, and
+// changes with every map(), so that the other CPUs which have mapped the
+// address space in the host map it again. The generations are unique.
 typedef struct VMHead {
-  PageMap *head;
-  struct hsearch_data hash;
+  PTE *root;
   int nr_page;
+  uint64_t gen;
 } VMHead;
 
-#define list_foreach(p, head) \
-  for (p = (PageMap *)(head); p != NULL; p = p->next)
-
 extern int __am_pgsize;
 static int vme_enable = 0;
 static void* (*pgalloc)(int) = NULL;
 static void (*pgfree)(void *) = NULL;
 
+// the geometry of the page tables, which depends on the page size
+static int pt_bits, pt_levels;
+#define PT_NR_ENTRY (1 << pt_bits)
+#define PT_IDX(vpn, level) (((vpn) >> ((level) * pt_bits)) & (PT_NR_ENTRY - 1))
+
+// The pages of released page tables and VMHeads are kept here, since the
+// kernels may not implement pgfree(). It is in the shared data section, and
+// the pages are in pmem, so it also works for the CPUs as processes.
+typedef struct FreePage { struct FreePage *next; } FreePage;
+static FreePage *free_pages = NULL;
+static int free_lock = 0;
+static _Atomic uint64_t vm_generation = 0;
+
+static uint64_t new_generation() {
+  return atomic_fetch_add(&vm_generation, 1) + 1;
+}
+
+static void *page_alloc() {
+  while (atomic_xchg(&free_lock, 1));
+  FreePage *p = free_pages;
+  if (p != NULL) free_pages = p->next;
+  atomic_xchg(&free_lock, 0);
+  if (p == NULL) p = pgalloc(__am_pgsize);
+  assert(p != NULL);
+  memset(p, 0, __am_pgsize);
+  return p;
+}
+
+static void page_free(void *page) {
+  FreePage *p = page;
+  while (atomic_xchg(&free_lock, 1));
+  p->next = free_pages;
+  free_pages = p;
+  atomic_xchg(&free_lock, 0);
+}
+
 bool vme_init(void* (*pgalloc_f)(int), void (*pgfree_f)(void*)) {
   pgalloc = pgalloc_f;
   pgfree = pgfree_f;
+
+  uintptr_t nr_vpn = (USER_SPACE.end - USER_SPACE.start) / __am_pgsize;
+  pt_bits = __builtin_ctz(__am_pgsize / sizeof(PTE));
+  for (pt_levels = 1; (nr_vpn - 1) >> (pt_levels * pt_bits) != 0; pt_levels ++);
+
   vme_enable = 1;
   return true;
 }
 
+// return the leaf entry of `vpn', and allocate the missing tables if `alloc'
+static PTE *pt_walk(VMHead *h, uintptr_t vpn, bool alloc) {
+  PTE *table = h->root;
+  for (int level = pt_levels - 1; level > 0; level --) {
+    PTE *next = &table[PT_IDX(vpn, level)];
+    if (*next == 0) {
+      if (!alloc) return NULL;
+      *next = (PTE)page_alloc();
+    }
+    table = (PTE *)*next;
+  }
+  return &table[PT_IDX(vpn, 0)];
+}
+
 void protect(AddrSpace *as) {
   assert(as != NULL);
-  VMHead *h = pgalloc(__am_pgsize); // used as head of the list
-  assert(h != NULL);
-  memset(h, 0, sizeof(*h));
-  int max_pg = (USER_SPACE.end - USER_SPACE.start) / __am_pgsize;
-  int ret = hcreate_r(max_pg, &h->hash);
-  assert(ret != 0);
+  VMHead *h = page_alloc(); // the rest of the page is unused
+  h->root = page_alloc();
+  h->gen = new_generation();
 
   as->ptr = h;
   as->pgsize = __am_pgsize;
   as->area = USER_SPACE;
 }
 
-void unprotect(AddrSpace *as) {
+static void pt_free(PTE *table, int level) {
+  if (level > 0) {
+    for (int i = 0; i < PT_NR_ENTRY; i ++) {
+      if (table[i] != 0) pt_free((PTE *)table[i], level - 1);
+    }
+  }
+  page_free(table);
 }
 
-void __am_switch(Context *c) {
-  if (!vme_enable) return;
+// whether the pages of `h' are the ones mapped in the host by this CPU, and
+// have not changed since
+static bool is_mapped(VMHead *h) {
+  return h == thiscpu->vm_mapped && h->gen == thiscpu->vm_gen;
+}
 
-  VMHead *head = c->vm_head;
-  VMHead *now_head = thiscpu->vm_head;
-  if (head == now_head) goto end;
-
-  PageMap *pp;
-  if (now_head != NULL) {
-    // munmap all mappings
-    list_foreach(pp, now_head->head) {
-      if (pp->is_mapped) {
-        __am_pmem_unmap(pp->va);
-        pp->is_mapped = false;
-      }
-    }
+void unprotect(AddrSpace *as) {
+  VMHead *h = as->ptr;
+  if (h == NULL) return;
+  if (is_mapped(h)) {
+    __am_pmem_unmap(USER_SPACE.start, USER_SPACE.end - USER_SPACE.start);
+    thiscpu->vm_mapped = NULL;
   }
+  pt_free(h->root, pt_levels - 1);
+  page_free(h);
+  as->ptr = NULL;
+}
 
-  if (head != NULL) {
-    // mmap all mappings
-    list_foreach(pp, head->head) {
-      assert(IN_RANGE(pp->va, USER_SPACE));
-      __am_pmem_map(pp->va, pp->pa, pp->prot);
-      pp->is_mapped = true;
+// Map all pages of `h' in the host. Pages which are contiguous both in
+// virtual and physical memory with the same protection are mapped at once.
+static void pt_map_all(VMHead *h, PTE *table, int level, uintptr_t vpn_base,
+    uintptr_t *run_vpn, PTE *run_pte, uintptr_t *run_len) {
+  for (uintptr_t i = 0; i < PT_NR_ENTRY; i ++) {
+    PTE pte = table[i];
+    if (pte == 0) continue;
+    uintptr_t vpn = vpn_base + (i << (level * pt_bits));
+    if (level > 0) {
+      pt_map_all(h, (PTE *)pte, level - 1, vpn, run_vpn, run_pte, run_len);
+      continue;
     }
+    if (*run_len != 0 && vpn == *run_vpn + *run_len &&
+        pte == *run_pte + *run_len * __am_pgsize) {
+      (*run_len) ++;
+      continue;
+    }
+    if (*run_len != 0) {
+      __am_pmem_map(USER_SPACE.start + *run_vpn * __am_pgsize, PTE_PA(*run_pte),
+          *run_len * __am_pgsize, *run_pte & PTE_PROT);
+    }
+    *run_vpn = vpn;
+    *run_pte = pte;
+    *run_len = 1;
   }
+}
 
-end:
+// Switching to a kernel thread (vm_head == NULL) keeps the user pages
+// in the host, like a lazy TLB, so that switching back is free.
+void __am_switch(Context *c) {
+  if (!vme_enable) return;
+
+  VMHead *head = c->vm_head;
   thiscpu->vm_head = head;
+  if (head == NULL || is_mapped(head)) return;
+
+  // one munmap() for the whole user space, and one mmap() for each run of pages
+  if (thiscpu->vm_mapped != NULL) {
+    __am_pmem_unmap(USER_SPACE.start, USER_SPACE.end - USER_SPACE.start);
+  }
+  uintptr_t run_vpn = 0, run_len = 0;
+  PTE run_pte = 0;
+  pt_map_all(head, head->root, pt_levels - 1, 0, &run_vpn, &run_pte, &run_len);
+  if (run_len != 0) {
+    __am_pmem_map(USER_SPACE.start + run_vpn * __am_pgsize, PTE_PA(run_pte),
+        run_len * __am_pgsize, run_pte & PTE_PROT);
+  }
+  thiscpu->vm_mapped = head;
+  thiscpu->vm_gen = head->gen;
 }
 
+// map `va' to `pa', or remove the mapping of `va' if `prot' is MMAP_NONE
 void map(AddrSpace *as, void *va, void *pa, int prot) {
   assert(IN_RANGE(va, USER_SPACE));
   assert((uintptr_t)va % __am_pgsize == 0);
   assert((uintptr_t)pa % __am_pgsize == 0);
   assert(as != NULL);
-  PageMap *pp = NULL;
   VMHead *vm_head = as->ptr;
   assert(vm_head != NULL);
-  char buf[32];
-  snprintf(buf, 32, "%x", va);
-  ENTRY item = { .key = buf };
-  ENTRY *item_find;
-  hsearch_r(item, FIND, &item_find, &vm_head->hash);
-  if (item_find == NULL) {
-    pp = pgalloc(__am_pgsize); // this will waste memory, any better idea?
-    snprintf(pp->key, 32, "%x", va);
-    item.key = pp->key;
-    item.data = pp;
-    int ret = hsearch_r(item, ENTER, &item_find, &vm_head->hash);
-    assert(ret != 0);
-    vm_head->nr_page ++;
+
+  uintptr_t vpn = (va - USER_SPACE.start) / __am_pgsize;
+  PTE *pte = pt_walk(vm_head, vpn, prot != MMAP_NONE);
+  if (prot == MMAP_NONE) {
+    if (pte == NULL || *pte == 0) return;
+    *pte = 0;
+    vm_head->nr_page --;
   } else {
-    pp = item_find->data;
+    if (*pte == 0) vm_head->nr_page ++;
+    *pte = (PTE)pa | prot | PTE_V;
   }
-  pp->va = va;
-  pp->pa = pa;
-  pp->prot = prot;
-  pp->is_mapped = false;
-  pp->next = vm_head->head;
-  vm_head->head = pp;
-
-  if (vm_head == thiscpu->vm_head) {
-    // enforce the map immediately
-    __am_pmem_map(pp->va, pp->pa, pp->prot);
-    pp->is_mapped = true;
+
+  bool mapped = is_mapped(vm_head);
+  vm_head->gen = new_generation();
+  if (mapped) {
+    // enforce the map immediately on this CPU
+    if (prot == MMAP_NONE) __am_pmem_unmap(va, __am_pgsize);
+    else __am_pmem_map(va, pa, __am_pgsize, prot);
+    thiscpu->vm_gen = vm_head->gen;
   }
 }
 
@@ -139,3 +226,7 @@ Context* ucontext(AddrSpace *as, Area kstack, void *entry) {
 int __am_in_userspace(void *addr) {
   return vme_enable && thiscpu->vm_head != NULL && IN_RANGE(addr, USER_SPACE);
 }
+
+int __am_vme_enabled() {
+  return vme_enable;
+}
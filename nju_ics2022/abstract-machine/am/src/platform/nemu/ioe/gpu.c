@@ -1,16 +1,25 @@
 #include <am.h>
 #include <nemu.h>
 
-#define SYNC_ADDR (VGACTL_ADDR + 4)
+#define SYNC_ADDR   (VGACTL_ADDR + 0x04)
+#define VMEMSZ_ADDR (VGACTL_ADDR + 0x08)
+#define CMD_ADDR    (VGACTL_ADDR + 0x0c)
+#define ARG0_ADDR   (VGACTL_ADDR + 0x10)
+#define ARG1_ADDR   (VGACTL_ADDR + 0x14)
+#define ARG2_ADDR   (VGACTL_ADDR + 0x18)
+
+#define GPU_CMD_MEMCPY 1
+#define GPU_CMD_RENDER 2
 
 void __am_gpu_init() {
 }
 
 void __am_gpu_config(AM_GPU_CONFIG_T *cfg) {
+  uint32_t size = inl(VGACTL_ADDR), vmemsz = inl(VMEMSZ_ADDR);
   *cfg = (AM_GPU_CONFIG_T) {
-    .present = true, .has_accel = false,
-    .width = 0, .height = 0,
-    .vmemsz = 0
+    .present = true, .has_accel = (vmemsz != 0),
+    .width = size >> 16, .height = size & 0xffff,
+    .vmemsz = vmemsz
   };
 }
 
@@ -23,3 +32,17 @@ void __am_gpu_fbdraw(AM_GPU_FBDRAW_T *ctl) {
 void __am_gpu_status(AM_GPU_STATUS_T *status) {
   status->ready = true;
 }
+
+// the device reads `src' by DMA, so the texture is not copied through MMIO
+void __am_gpu_memcpy(AM_GPU_MEMCPY_T *params) {
+  outl(ARG0_ADDR, params->dest);
+  outl(ARG1_ADDR, (uintptr_t)params->src);
+  outl(ARG2_ADDR, params->size);
+  outl(CMD_ADDR, GPU_CMD_MEMCPY);
+}
+
+// the frame is composited by the device, and shown at the next sync
+void __am_gpu_render(AM_GPU_RENDER_T *ren) {
+  outl(ARG0_ADDR, ren->root);
+  outl(CMD_ADDR, GPU_CMD_RENDER);
+}
@@ -0,0 +1,88 @@
+#include <am.h>
+#include <nemu.h>
+#include <klib.h>
+
+#define NIC_TX_BASE_ADDR   (NIC_ADDR + 0x00)
+#define NIC_RX_BASE_ADDR   (NIC_ADDR + 0x04)
+#define NIC_RING_SIZE_ADDR (NIC_ADDR + 0x08)
+#define NIC_TX_HEAD_ADDR   (NIC_ADDR + 0x0c)
+#define NIC_TX_TAIL_ADDR   (NIC_ADDR + 0x10)
+#define NIC_RX_HEAD_ADDR   (NIC_ADDR + 0x14)
+#define NIC_RX_TAIL_ADDR   (NIC_ADDR + 0x18)
+#define NIC_PRESENT_ADDR   (NIC_ADDR + 0x20)
+
+#define NR_DESC  16
+#define BUF_SIZE 2048
+
+// The accesses to the registers are volatile, but the ones to the rings and
+// the buffers are not, and the compiler may move them across the former. So
+// they are fenced: after reading a head, before reading what the device has
+// written, and before ringing a doorbell, after writing what it will read.
+#define barrier() asm volatile ("" ::: "memory")
+
+typedef struct {
+  uint32_t addr, len;
+} NICDesc;
+
+// The device reads and writes the rings and the buffers by DMA. Packets
+// are sent from the buffer of the caller, and received into the buffers
+// posted here, which are posted again in batches to save doorbells.
+static NICDesc tx_ring[NR_DESC], rx_ring[NR_DESC];
+static uint8_t rx_buf[NR_DESC][BUF_SIZE];
+static uint32_t tx_tail = 0, rx_tail = 0, rx_next = 0;
+static bool present = false;
+
+void __am_net_init() {
+  // the registers of an absent card read 0
+  present = (inl(NIC_PRESENT_ADDR) != 0);
+  if (!present) return;
+  for (int i = 0; i < NR_DESC; i ++) {
+    rx_ring[i] = (NICDesc) { .addr = (uintptr_t)rx_buf[i], .len = BUF_SIZE };
+  }
+  outl(NIC_TX_BASE_ADDR, (uintptr_t)tx_ring);
+  outl(NIC_RX_BASE_ADDR, (uintptr_t)rx_ring);
+  outl(NIC_RING_SIZE_ADDR, NR_DESC);
+  rx_tail = NR_DESC;
+  barrier();
+  outl(NIC_RX_TAIL_ADDR, rx_tail);
+}
+
+void __am_net_config(AM_NET_CONFIG_T *cfg) {
+  cfg->present = present;
+}
+
+void __am_net_status(AM_NET_STATUS_T *stat) {
+  uint32_t rx_head = inl(NIC_RX_HEAD_ADDR);
+  uint32_t tx_head = inl(NIC_TX_HEAD_ADDR);
+  barrier();
+  stat->rx_len = (rx_next != rx_head ? rx_ring[rx_next % NR_DESC].len : 0);
+  stat->tx_len = 0;
+  for (uint32_t i = tx_head; i != tx_tail; i ++) {
+    stat->tx_len += tx_ring[i % NR_DESC].len;
+  }
+}
+
+void __am_net_tx(AM_NET_TX_T *tx) {
+  while (tx_tail - inl(NIC_TX_HEAD_ADDR) == NR_DESC); // the ring is full
+  tx_ring[tx_tail % NR_DESC] = (NICDesc) {
+    .addr = (uintptr_t)tx->buf.start, .len = tx->buf.end - tx->buf.start };
+  tx_tail ++;
+  barrier();
+  outl(NIC_TX_TAIL_ADDR, tx_tail);
+}
+
+void __am_net_rx(AM_NET_RX_T *rx) {
+  if (rx_next == inl(NIC_RX_HEAD_ADDR)) return; // no packet
+  barrier();
+  NICDesc *d = &rx_ring[rx_next % NR_DESC];
+  size_t size = rx->buf.end - rx->buf.start;
+  memcpy(rx->buf.start, rx_buf[rx_next % NR_DESC], (d->len < size ? d->len : size));
+  d->len = BUF_SIZE;
+  rx_next ++;
+  // post the consumed buffers again once half of the ring is consumed
+  if (rx_next + NR_DESC - rx_tail >= NR_DESC / 2) {
+    rx_tail = rx_next + NR_DESC;
+    barrier();
+    outl(NIC_RX_TAIL_ADDR, rx_tail);
+  }
+}
@@ -2,17 +2,42 @@
 #include <stdatomic.h>
 #include <klib-macros.h>
 
-bool mpe_init(void (*entry)()) {
-  entry();
+#define MAX_CPU 8 // also the limit of NR_HART in the Kconfig of NEMU
+#define MPE_STACK_SIZE 8192
+
+// set by the start code, left 0 if the machine does not report it
+int __am_ncpu = 0;
+// secondary harts spin in the start code until this is set
+void (* volatile __am_mpe_entry)() = NULL;
+uint8_t __am_mpe_stack[MAX_CPU * MPE_STACK_SIZE] __attribute__((aligned(16)));
+static void (*user_entry)() = NULL;
+
+static void mpe_start() {
+  user_entry();
   panic("MPE entry returns");
 }
 
+bool mpe_init(void (*entry)()) {
+  panic_on(cpu_count() > MAX_CPU, "too many CPUs");
+  user_entry = entry;
+  atomic_thread_fence(memory_order_seq_cst);
+  __am_mpe_entry = mpe_start;
+  mpe_start();
+  return false;
+}
+
 int cpu_count() {
-  return 1;
+  return __am_ncpu > 0 ? __am_ncpu : 1;
 }
 
 int cpu_current() {
+#if defined(__riscv)
+  int id;
+  asm volatile ("mv %0, tp" : "=r"(id));
+  return id;
+#else
   return 0;
+#endif
 }
 
 int atomic_xchg(int *addr, int newval) {
@@ -0,0 +1,116 @@
+#include <am.h>
+#include <klib.h>
+#include <klib-macros.h>
+
+// Compare the string routines in klib with naive byte loops.
+// Each test processes about TOTAL bytes, the time is in microseconds.
+
+#define MAX_SIZE 4096
+#define TOTAL    (256 * 1024)
+
+static char src[MAX_SIZE + 64], dst[MAX_SIZE + 64];
+static volatile size_t sink;
+
+static void naive_memcpy(size_t n, int off) {
+  char *d = dst;
+  const char *s = src + off;
+  while (n --) *d ++ = *s ++;
+}
+
+static void naive_memset(size_t n, int off) {
+  char *d = dst + off;
+  while (n --) *d ++ = off;
+}
+
+static void naive_memmove(size_t n, int off) {
+  char *d = dst + off + 8;
+  const char *s = dst + off;
+  for (d += n, s += n; n --; ) *-- d = *-- s;
+}
+
+static void naive_memcmp(size_t n, int off) {
+  const unsigned char *p1 = (void *)(src + off), *p2 = (void *)(dst + off);
+  for (; n > 0 && *p1 == *p2; n --, p1 ++, p2 ++);
+  sink = n;
+}
+
+static void naive_strlen(size_t n, int off) {
+  const char *p = src + off;
+  while (*p) p ++;
+  sink = p - src;
+}
+
+static void naive_strcmp(size_t n, int off) {
+  const char *p1 = src + off, *p2 = dst + off;
+  for (; *p1 == *p2 && *p1; p1 ++, p2 ++);
+  sink = *p1 - *p2;
+}
+
+static void klib_memcpy(size_t n, int off) { memcpy(dst, src + off, n); }
+static void klib_memset(size_t n, int off) { memset(dst + off, off, n); }
+static void klib_memmove(size_t n, int off) { memmove(dst + off + 8, dst + off, n); }
+static void klib_memcmp(size_t n, int off) { sink = memcmp(src + off, dst + off, n); }
+static void klib_strlen(size_t n, int off) { sink = strlen(src + off); }
+static void klib_strcmp(size_t n, int off) { sink = strcmp(src + off, dst + off); }
+
+static struct {
+  const char *name;
+  void (*klib)(size_t n, int off), (*naive)(size_t n, int off);
+  bool is_str; // the operands are strings of length n
+} tests[] = {
+  { "memcpy ", klib_memcpy,  naive_memcpy,  false },
+  { "memset ", klib_memset,  naive_memset,  false },
+  { "memmove", klib_memmove, naive_memmove, false },
+  { "memcmp ", klib_memcmp,  naive_memcmp,  false },
+  { "strlen ", klib_strlen,  naive_strlen,  true  },
+  { "strcmp ", klib_strcmp,  naive_strcmp,  true  },
+};
+
+static const size_t sizes[] = { 16, 256, MAX_SIZE };
+
+static void print_num(uint64_t x, int width) {
+  char buf[24];
+  int i = 0;
+  do { buf[i ++] = '0' + x % 10; x /= 10; } while (x != 0);
+  for (; width > i; width --) putch(' ');
+  while (i > 0) putch(buf[-- i]);
+}
+
+static uint64_t measure(void (*fn)(size_t n, int off), size_t n, int off) {
+  int rounds = TOTAL / n;
+  uint64_t start = io_read(AM_TIMER_UPTIME).us;
+  for (int i = 0; i < rounds; i ++) fn(n, off);
+  return io_read(AM_TIMER_UPTIME).us - start;
+}
+
+// the operands are equal, so that the comparisons scan the whole strings
+static void prepare(size_t n, int off, bool is_str) {
+  for (int i = 0; i < LENGTH(src); i ++) src[i] = dst[i] = 'a' + i % 26;
+  if (is_str) src[off + n] = dst[off + n] = '\0';
+}
+
+int main(const char *args) {
+  ioe_init();
+  putstr("routine   size off        klib       naive   speedup\n");
+  for (int i = 0; i < LENGTH(tests); i ++) {
+    for (int j = 0; j < LENGTH(sizes); j ++) {
+      for (int off = 0; off < 2; off ++) {
+        prepare(sizes[j], off, tests[i].is_str);
+        uint64_t t_klib = measure(tests[i].klib, sizes[j], off);
+        uint64_t t_naive = measure(tests[i].naive, sizes[j], off);
+        uint64_t speedup = t_naive * 100 / (t_klib ? t_klib : 1);
+        putstr(tests[i].name);
+        print_num(sizes[j], 7);
+        print_num(off, 4);
+        print_num(t_klib, 12);
+        print_num(t_naive, 12);
+        print_num(speedup / 100, 7);
+        putch('.');
+        print_num(speedup / 10 % 10, 1);
+        print_num(speedup % 10, 1);
+        putch('\n');
+      }
+    }
+  }
+  return 0;
+}
@@ -28,11 +28,36 @@ void   srand     (unsigned int seed);
 int    rand      (void);
 void  *malloc    (size_t size);
 void   free      (void *ptr);
+void  *calloc    (size_t nmemb, size_t size);
+void  *realloc   (void *ptr, size_t size);
 int    abs       (int x);
 int    atoi      (const char *nptr);
 
+// malloc statistics in bytes, the fragmentation of free memory
+// can be measured by 1 - largest_free / free
+typedef struct {
+  size_t allocated;    // requested by malloc() and not freed yet, rounded up to the size class
+  size_t heap_size;
+  size_t used, free;   // heap memory taken or not by the allocator, with overhead
+  size_t peak_used;
+  size_t slab_free;    // free objects kept in the slabs and the per-CPU caches
+  size_t largest_free; // the largest free block
+} MallocStats;
+void   malloc_stats(MallocStats *st);
+
+// division of 64-bit integers by a divisor which is known in advance,
+// with a multiplication instead of the slow __udivdi3() on 32-bit machines
+typedef struct {
+  uint64_t magic;
+  uint8_t shift;
+  bool add;        // the magic number takes 65 bits
+} UDiv64;
+UDiv64   udiv64_init(uint64_t d); // d != 0
+uint64_t udiv64    (uint64_t n, const UDiv64 *d);
+
 // stdio.h
 int    printf    (const char *format, ...);
+int    vprintf   (const char *format, va_list ap);
 int    sprintf   (char *str, const char *format, ...);
 int    snprintf  (char *str, size_t size, const char *format, ...);
 int    vsprintf  (char *str, const char *format, va_list ap);
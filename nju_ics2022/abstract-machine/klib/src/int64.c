@@ -361,7 +361,7 @@ uint32_t __inline __builtin_clzll(uint64_t value) {
 #define __builtin_clzl __builtin_clzll
 #endif /* defined(_MSC_VER) && !defined(__clang__) */
 
-#include <am.h>
+#include <klib.h>
 
 #if !defined(__ARCH_RISCV64_MYCPU)
 /* Returns: a / b */
@@ -423,214 +423,137 @@ __umoddi3(du_int a, du_int b)
 #endif
 
 
+// The helpers below avoid __builtin_clz() and __builtin_ctz(), which become
+// calls to __clzsi2() and __ctzsi2() on targets without bit manipulation
+// instructions. The leading zeros are counted with a small table instead.
+
+static const unsigned char clz4_tab[16] = {
+  4, 3, 2, 2, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+// Precondition: x != 0
+static inline unsigned clz32(su_int x) {
+  unsigned n = 0;
+  if (x <= 0x0000ffff) { n += 16; x <<= 16; }
+  if (x <= 0x00ffffff) { n +=  8; x <<=  8; }
+  if (x <= 0x0fffffff) { n +=  4; x <<=  4; }
+  return n + clz4_tab[x >> 28];
+}
+
+// Precondition: x != 0
+static inline unsigned ctz32(su_int x) {
+  return 31 - clz32(x & -x);
+}
+
+static inline unsigned clz64(du_int x) {
+  udwords u;
+  u.all = x;
+  return (u.s.high != 0 ? clz32(u.s.high) : 32 + clz32(u.s.low));
+}
+
+/* Returns: (u1:u0) / v, *r = (u1:u0) % v */
+
+// Precondition: u1 < v, so that the quotient fits in 32 bits
+//
+// This is the division of a 2-digit number by a 1-digit number in base 2^32,
+// done with two 32-bit divisions in base 2^16 (Hacker's Delight, divlu).
+// The 32-bit divisions are carried out by the hardware.
+
+static su_int divlu(su_int u1, su_int u0, su_int v, su_int *r) {
+  const su_int b = 1u << 16;
+  unsigned s = clz32(v);
+  v <<= s;
+  su_int vn1 = v >> 16, vn0 = v & 0xffff;
+  su_int un32 = (s == 0 ? u1 : (u1 << s) | (u0 >> (32 - s)));
+  su_int un10 = u0 << s;
+  su_int un1 = un10 >> 16, un0 = un10 & 0xffff;
+
+  // estimate the quotient digits with the top digit of v,
+  // an estimate is too large by at most 2
+  su_int q1 = un32 / vn1, rhat = un32 - q1 * vn1;
+  while (q1 >= b || q1 * vn0 > b * rhat + un1) {
+    q1 --;
+    rhat += vn1;
+    if (rhat >= b) break;
+  }
+  su_int un21 = un32 * b + un1 - q1 * v;
+
+  su_int q0 = un21 / vn1;
+  rhat = un21 - q0 * vn1;
+  while (q0 >= b || q0 * vn0 > b * rhat + un0) {
+    q0 --;
+    rhat += vn1;
+    if (rhat >= b) break;
+  }
+
+  if (r) *r = (un21 * b + un0 - q0 * v) >> s;
+  return q1 * b + q0;
+}
+
+/* Returns: a / b, *rem = a % b */
+
 COMPILER_RT_ABI du_int
 __udivmoddi4(du_int a, du_int b, du_int* rem)
 {
-    const unsigned n_uword_bits = sizeof(su_int) * CHAR_BIT;
-    const unsigned n_udword_bits = sizeof(du_int) * CHAR_BIT;
-    udwords n;
+    udwords n, d, q;
     n.all = a;
-    udwords d;
     d.all = b;
-    udwords q;
-    udwords r;
-    unsigned sr;
-    /* special cases, X is unknown, K != 0 */
-    if (n.s.high == 0)
+
+    if (d.s.high == 0)
     {
-        if (d.s.high == 0)
+        su_int r;
+        if (n.s.high == 0 || d.s.low == 0)
         {
-            /* 0 X
-             * ---
-             * 0 X
-             */
+            /* 0 X / 0 K, a single hardware division (or a trap for 0) */
             if (rem)
                 *rem = n.s.low % d.s.low;
             return n.s.low / d.s.low;
         }
-        /* 0 X
-         * ---
-         * K X
-         */
-        if (rem)
-            *rem = n.s.low;
-        return 0;
-    }
-    /* n.s.high != 0 */
-    if (d.s.low == 0)
-    {
-        if (d.s.high == 0)
-        {
-            /* K X
-             * ---
-             * 0 0
-             */
-            if (rem)
-                *rem = n.s.high % d.s.low;
-            return n.s.high / d.s.low;
-        }
-        /* d.s.high != 0 */
-        if (n.s.low == 0)
-        {
-            /* K 0
-             * ---
-             * K 0
-             */
-            if (rem)
-            {
-                r.s.high = n.s.high % d.s.high;
-                r.s.low = 0;
-                *rem = r.all;
-            }
-            return n.s.high / d.s.high;
-        }
-        /* K K
-         * ---
-         * K 0
-         */
-        if ((d.s.high & (d.s.high - 1)) == 0)     /* if d is a power of 2 */
+        if ((d.s.low & (d.s.low - 1)) == 0)
         {
+            /* K X / 0 K, d is a power of 2 */
             if (rem)
-            {
-                r.s.low = n.s.low;
-                r.s.high = n.s.high & (d.s.high - 1);
-                *rem = r.all;
-            }
-            return n.s.high >> __builtin_ctz(d.s.high);
+                *rem = n.s.low & (d.s.low - 1);
+            return a >> ctz32(d.s.low);
         }
-        /* K K
-         * ---
-         * K 0
-         */
-        sr = __builtin_clz(d.s.high) - __builtin_clz(n.s.high);
-        /* 0 <= sr <= n_uword_bits - 2 or sr large */
-        if (sr > n_uword_bits - 2)
+        /* K X / 0 K, long division with 2 digits in base 2^32 */
+        q.s.high = 0;
+        if (n.s.high >= d.s.low)
         {
-           if (rem)
-                *rem = n.all;
-            return 0;
+            q.s.high = n.s.high / d.s.low;
+            n.s.high -= q.s.high * d.s.low;
         }
-        ++sr;
-        /* 1 <= sr <= n_uword_bits - 1 */
-        /* q.all = n.all << (n_udword_bits - sr); */
-        q.s.low = 0;
-        q.s.high = n.s.low << (n_uword_bits - sr);
-        /* r.all = n.all >> sr; */
-        r.s.high = n.s.high >> sr;
-        r.s.low = (n.s.high << (n_uword_bits - sr)) | (n.s.low >> sr);
+        q.s.low = divlu(n.s.high, n.s.low, d.s.low, &r);
+        if (rem)
+            *rem = r;
+        return q.all;
     }
-    else  /* d.s.low != 0 */
+
+    /* X X / K X, the quotient fits in 32 bits */
+    if (a < b)
     {
-        if (d.s.high == 0)
-        {
-            /* K X
-             * ---
-             * 0 K
-             */
-            if ((d.s.low & (d.s.low - 1)) == 0)     /* if d is a power of 2 */
-            {
-                if (rem)
-                    *rem = n.s.low & (d.s.low - 1);
-                if (d.s.low == 1)
-                    return n.all;
-                sr = __builtin_ctz(d.s.low);
-                q.s.high = n.s.high >> sr;
-                q.s.low = (n.s.high << (n_uword_bits - sr)) | (n.s.low >> sr);
-                return q.all;
-            }
-            /* K X
-             * ---
-             * 0 K
-             */
-            sr = 1 + n_uword_bits + __builtin_clz(d.s.low) - __builtin_clz(n.s.high);
-            /* 2 <= sr <= n_udword_bits - 1
-             * q.all = n.all << (n_udword_bits - sr);
-             * r.all = n.all >> sr;
-             */
-            if (sr == n_uword_bits)
-            {
-                q.s.low = 0;
-                q.s.high = n.s.low;
-                r.s.high = 0;
-                r.s.low = n.s.high;
-            }
-            else if (sr < n_uword_bits)  // 2 <= sr <= n_uword_bits - 1
-            {
-                q.s.low = 0;
-                q.s.high = n.s.low << (n_uword_bits - sr);
-                r.s.high = n.s.high >> sr;
-                r.s.low = (n.s.high << (n_uword_bits - sr)) | (n.s.low >> sr);
-            }
-            else              // n_uword_bits + 1 <= sr <= n_udword_bits - 1
-            {
-                q.s.low = n.s.low << (n_udword_bits - sr);
-                q.s.high = (n.s.high << (n_udword_bits - sr)) |
-                           (n.s.low >> (sr - n_uword_bits));
-                r.s.high = 0;
-                r.s.low = n.s.high >> (sr - n_uword_bits);
-            }
-        }
-        else
-        {
-            /* K X
-             * ---
-             * K K
-             */
-            sr = __builtin_clz(d.s.high) - __builtin_clz(n.s.high);
-            /* 0 <= sr <= n_uword_bits - 1 or sr large */
-            if (sr > n_uword_bits - 1)
-            {
-                if (rem)
-                    *rem = n.all;
-                return 0;
-            }
-            ++sr;
-            /* 1 <= sr <= n_uword_bits */
-            /*  q.all = n.all << (n_udword_bits - sr); */
-            q.s.low = 0;
-            if (sr == n_uword_bits)
-            {
-                q.s.high = n.s.low;
-                r.s.high = 0;
-                r.s.low = n.s.high;
-            }
-            else
-            {
-                q.s.high = n.s.low << (n_uword_bits - sr);
-                r.s.high = n.s.high >> sr;
-                r.s.low = (n.s.high << (n_uword_bits - sr)) | (n.s.low >> sr);
-            }
-        }
+        if (rem)
+            *rem = a;
+        return 0;
     }
-    /* Not a special case
-     * q and r are initialized with:
-     * q.all = n.all << (n_udword_bits - sr);
-     * r.all = n.all >> sr;
-     * 1 <= sr <= n_udword_bits - 1
-     */
-    su_int carry = 0;
-    for (; sr > 0; --sr)
+    /* Divide a/2 by the top 32 bits of the normalized b. The result is
+     * an estimate of the quotient which is exact or too large by 1 after
+     * the scaling (Hacker's Delight, divDU). */
+    unsigned s = clz32(d.s.high);
+    su_int v1 = (b << s) >> 32;
+    du_int u1 = a >> 1;
+    du_int q0 = ((du_int)divlu(u1 >> 32, (su_int)u1, v1, 0) << s) >> 31;
+    if (q0 != 0)
+        q0 --;
+    du_int r = a - q0 * b;
+    if (r >= b)
     {
-        /* r:q = ((r:q)  << 1) | carry */
-        r.s.high = (r.s.high << 1) | (r.s.low  >> (n_uword_bits - 1));
-        r.s.low  = (r.s.low  << 1) | (q.s.high >> (n_uword_bits - 1));
-        q.s.high = (q.s.high << 1) | (q.s.low  >> (n_uword_bits - 1));
-        q.s.low  = (q.s.low  << 1) | carry;
-        /* carry = 0;
-         * if (r.all >= d.all)
-         * {
-         *      r.all -= d.all;
-         *      carry = 1;
-         * }
-         */
-        const di_int s = (di_int)(d.all - r.all - 1) >> (n_udword_bits - 1);
-        carry = s & 1;
-        r.all -= d.all & s;
+        q0 ++;
+        r -= b;
     }
-    q.all = (q.all << 1) | carry;
     if (rem)
-        *rem = r.all;
-    return q.all;
+        *rem = r;
+    return q0;
 }
 
 // Returns: the number of leading 0-bits
@@ -638,34 +561,7 @@ __udivmoddi4(du_int a, du_int b, du_int* rem)
 // Precondition: a != 0
 
 COMPILER_RT_ABI si_int __clzsi2(si_int a) {
-  su_int x = (su_int)a;
-  si_int t = ((x & 0xFFFF0000) == 0) << 4; // if (x is small) t = 16 else 0
-  x >>= 16 - t;                            // x = [0 - 0xFFFF]
-  su_int r = t;                            // r = [0, 16]
-  // return r + clz(x)
-  t = ((x & 0xFF00) == 0) << 3;
-  x >>= 8 - t; // x = [0 - 0xFF]
-  r += t;      // r = [0, 8, 16, 24]
-  // return r + clz(x)
-  t = ((x & 0xF0) == 0) << 2;
-  x >>= 4 - t; // x = [0 - 0xF]
-  r += t;      // r = [0, 4, 8, 12, 16, 20, 24, 28]
-  // return r + clz(x)
-  t = ((x & 0xC) == 0) << 1;
-  x >>= 2 - t; // x = [0 - 3]
-  r += t;      // r = [0 - 30] and is even
-  // return r + clz(x)
-  //     switch (x)
-  //     {
-  //     case 0:
-  //         return r + 2;
-  //     case 1:
-  //         return r + 1;
-  //     case 2:
-  //     case 3:
-  //         return r;
-  //     }
-  return r + ((2 - x) & -((x & 2) == 0));
+  return clz32(a);
 }
 
 // Returns: the number of trailing 0-bits
@@ -673,59 +569,82 @@ COMPILER_RT_ABI si_int __clzsi2(si_int a) {
 // Precondition: a != 0
 
 COMPILER_RT_ABI si_int __ctzsi2(si_int a) {
-  su_int x = (su_int)a;
-  si_int t = ((x & 0x0000FFFF) == 0)
-             << 4; // if (x has no small bits) t = 16 else 0
-  x >>= t;         // x = [0 - 0xFFFF] + higher garbage bits
-  su_int r = t;    // r = [0, 16]
-  // return r + ctz(x)
-  t = ((x & 0x00FF) == 0) << 3;
-  x >>= t; // x = [0 - 0xFF] + higher garbage bits
-  r += t;  // r = [0, 8, 16, 24]
-  // return r + ctz(x)
-  t = ((x & 0x0F) == 0) << 2;
-  x >>= t; // x = [0 - 0xF] + higher garbage bits
-  r += t;  // r = [0, 4, 8, 12, 16, 20, 24, 28]
-  // return r + ctz(x)
-  t = ((x & 0x3) == 0) << 1;
-  x >>= t;
-  x &= 3; // x = [0 - 3]
-  r += t; // r = [0 - 30] and is even
-  // return r + ctz(x)
-
-  //  The branch-less return statement below is equivalent
-  //  to the following switch statement:
-  //     switch (x)
-  //    {
-  //     case 0:
-  //         return r + 2;
-  //     case 2:
-  //         return r + 1;
-  //     case 1:
-  //     case 3:
-  //         return r;
-  //     }
-  return r + ((2 - (x >> 1)) & -((x & 1) == 0));
+  return ctz32(a);
 }
 
-typedef int si_int;
-typedef long long di_int;
-typedef unsigned su_int;
-#define CHAR_BIT __CHAR_BIT__
-
-
 si_int __ctzdi2(di_int a) {
   dwords x;
   x.all = a;
-  const si_int f = -(x.s.low == 0);
-  return __ctzsi2((x.s.high & f) | (x.s.low & ~f)) +
-         (f & ((si_int)(sizeof(si_int) * CHAR_BIT)));
+  return (x.s.low != 0 ? ctz32(x.s.low) : 32 + ctz32(x.s.high));
 }
 
 si_int __clzdi2(di_int a) {
-  dwords x;
-  x.all = a;
-  const si_int f = -(x.s.high == 0);
-  return __clzsi2((x.s.high & ~f) | (x.s.low & f)) +
-         (f & ((si_int)(sizeof(si_int) * CHAR_BIT)));
+  return clz64(a);
+}
+
+/* Division by an invariant divisor */
+
+// n / d is computed as (n * m) >> (64 + shift) with a precomputed magic number
+// m = ceil(2^(64 + shift) / d), which takes a multiplication instead of the
+// long division above (libdivide, round-up method). When m needs 65 bits,
+// only its low 64 bits are stored and `add' is set.
+
+static inline du_int mulhi64(du_int a, du_int b) {
+#ifdef CRT_HAS_128BIT
+    return ((tu_int)a * b) >> 64;
+#else
+    du_int a0 = (su_int)a, a1 = a >> 32, b0 = (su_int)b, b1 = b >> 32;
+    du_int p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+    du_int mid = (p00 >> 32) + (su_int)p01 + (su_int)p10;
+    return p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+#endif
+}
+
+UDiv64 udiv64_init(uint64_t d)
+{
+    UDiv64 r;
+    unsigned l = 63 - clz64(d);
+    r.shift = l;
+    r.add = false;
+    if ((d & (d - 1)) == 0)
+    {
+        /* a power of 2, the division is just a shift */
+        r.magic = 0;
+        return r;
+    }
+    /* m = floor(2^(64 + l) / d), computed bit by bit since it is done once */
+    du_int m = 0, rem = (du_int)1 << l;
+    for (int i = 0; i < 64; i ++)
+    {
+        bool carry = rem >> 63;
+        rem <<= 1;
+        m <<= 1;
+        if (carry || rem >= d)
+        {
+            rem -= d;
+            m |= 1;
+        }
+    }
+    if (d - rem >= ((du_int)1 << l))
+    {
+        /* m + 1 needs 65 bits, use 2m + 1 with one more shift */
+        bool carry = rem >> 63;
+        rem <<= 1;
+        m <<= 1;
+        if (carry || rem >= d)
+            m |= 1;
+        r.add = true;
+    }
+    r.magic = m + 1;
+    return r;
+}
+
+uint64_t udiv64(uint64_t n, const UDiv64 *d)
+{
+    if (d->magic == 0)
+        return n >> d->shift;
+    du_int q = mulhi64(n, d->magic);
+    if (d->add)
+        q += (n - q) >> 1;
+    return q >> d->shift;
 }
@@ -0,0 +1,509 @@
+#include <am.h>
+#include <klib.h>
+#include <klib-macros.h>
+
+#if !defined(__ISA_NATIVE__) || defined(__NATIVE_USE_KLIB__)
+
+// Small objects (up to SLAB_MAX_OBJ bytes) are carved from slabs, each of
+// which holds objects of a single size class. Larger blocks, as well as the
+// slabs themselves, come from a TLSF (two-level segregated fit) allocator
+// managing the whole heap. A slab is given back to TLSF as soon as all its
+// objects are free, so freed memory can always merge into large blocks; its
+// objects are carved lazily, which makes taking a new slab O(1). With several
+// CPUs, each CPU keeps a small cache of free objects per size class, so that
+// most operations take no lock.
+
+#define ALIGN_LOG2 (sizeof(void *) == 8 ? 4 : 3)
+#define ALIGN      ((size_t)1 << ALIGN_LOG2)
+#define HDR_SIZE   (2 * sizeof(void *))
+#define MIN_SIZE   (2 * sizeof(void *)) // room for the links of a free block
+
+#define SLAB_SIZE    16384
+#define SLAB_MAX_OBJ 2048
+#define MAX_CPU      16
+#define MAG_SIZE     16
+
+static int msb(size_t x) { // index of the highest set bit, x != 0
+  int r = 0;
+  if (sizeof(x) > 4 && (x >> 16 >> 16)) { x = x >> 16 >> 16; r += 32; }
+  if (x >> 16) { x >>= 16; r += 16; }
+  if (x >> 8) { x >>= 8; r += 8; }
+  if (x >> 4) { x >>= 4; r += 4; }
+  if (x >> 2) { x >>= 2; r += 2; }
+  return r + (x >> 1);
+}
+
+static int lsb(uint32_t x) { // index of the lowest set bit, x != 0
+  static const uint8_t debruijn[32] = {
+    0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+    31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9,
+  };
+  return debruijn[((x & -x) * 0x077cb531u) >> 27];
+}
+
+// ----------- TLSF -----------
+
+typedef struct Block {
+  struct Block *prev_phys; // the block right before this one in memory
+  size_t size;             // size of the payload, bit 0 is set if free
+  struct Block *next_free, *prev_free; // overlap the payload
+} Block;
+
+#define F_FREE 1
+
+#define SL_LOG2    4
+#define SL_COUNT   (1 << SL_LOG2)
+#define FL_SHIFT   (SL_LOG2 + ALIGN_LOG2)
+#define SMALL_SIZE ((size_t)1 << FL_SHIFT) // smaller blocks are in the first level 0
+#define FL_COUNT   32
+
+static uint32_t fl_bitmap, sl_bitmap[FL_COUNT];
+static Block *free_list[FL_COUNT][SL_COUNT];
+
+static inline size_t bsize(Block *b) { return b->size & ~(ALIGN - 1); }
+static inline bool is_free(Block *b) { return b->size & F_FREE; }
+static inline void *payload(Block *b) { return (char *)b + HDR_SIZE; }
+static inline Block *to_block(void *p) { return (Block *)((char *)p - HDR_SIZE); }
+static inline Block *next_phys(Block *b) { return (Block *)((char *)payload(b) + bsize(b)); }
+
+static struct {
+  size_t heap_size, free, peak_used;
+  size_t allocated[MAX_CPU];
+} stat;
+
+static void mapping(size_t size, int *fl, int *sl) {
+  if (size < SMALL_SIZE) {
+    *fl = 0;
+    *sl = size >> ALIGN_LOG2;
+  } else {
+    int f = msb(size);
+    *fl = f - FL_SHIFT + 1;
+    *sl = (size >> (f - SL_LOG2)) - SL_COUNT;
+  }
+}
+
+static void insert_free(Block *b) {
+  int fl, sl;
+  mapping(bsize(b), &fl, &sl);
+  b->size |= F_FREE;
+  b->prev_free = NULL;
+  b->next_free = free_list[fl][sl];
+  if (b->next_free != NULL) b->next_free->prev_free = b;
+  free_list[fl][sl] = b;
+  fl_bitmap |= 1u << fl;
+  sl_bitmap[fl] |= 1u << sl;
+  stat.free += HDR_SIZE + bsize(b);
+}
+
+static void remove_free(Block *b) {
+  int fl, sl;
+  mapping(bsize(b), &fl, &sl);
+  b->size &= ~F_FREE;
+  if (b->next_free != NULL) b->next_free->prev_free = b->prev_free;
+  if (b->prev_free != NULL) b->prev_free->next_free = b->next_free;
+  else {
+    free_list[fl][sl] = b->next_free;
+    if (b->next_free == NULL) {
+      sl_bitmap[fl] &= ~(1u << sl);
+      if (sl_bitmap[fl] == 0) fl_bitmap &= ~(1u << fl);
+    }
+  }
+  stat.free -= HDR_SIZE + bsize(b);
+}
+
+// find a free block of at least `size' bytes
+static Block *find_free(size_t size) {
+  // round up to the next list, all of whose blocks are large enough
+  if (size >= SMALL_SIZE) size += ((size_t)1 << (msb(size) - SL_LOG2)) - 1;
+  int fl, sl;
+  mapping(size, &fl, &sl);
+  if (fl >= FL_COUNT) return NULL;
+  uint32_t sl_map = sl_bitmap[fl] & (~0u << sl);
+  if (sl_map == 0) {
+    uint32_t fl_map = (fl + 1 < FL_COUNT ? fl_bitmap & (~0u << (fl + 1)) : 0);
+    if (fl_map == 0) return NULL;
+    fl = lsb(fl_map);
+    sl_map = sl_bitmap[fl];
+  }
+  Block *b = free_list[fl][lsb(sl_map)];
+  remove_free(b);
+  return b;
+}
+
+// merge `b' with its free neighbours and put it into the free lists
+static void release(Block *b) {
+  Block *next = next_phys(b);
+  if (is_free(next)) {
+    remove_free(next);
+    b->size = bsize(b) + HDR_SIZE + bsize(next);
+    next_phys(b)->prev_phys = b;
+  }
+  Block *prev = b->prev_phys;
+  if (prev != NULL && is_free(prev)) {
+    remove_free(prev);
+    prev->size = bsize(prev) + HDR_SIZE + bsize(b);
+    next_phys(prev)->prev_phys = prev;
+    b = prev;
+  }
+  insert_free(b);
+}
+
+// trim the used block `b' to `size' bytes, and release the rest
+static void trim(Block *b, size_t size) {
+  if (bsize(b) < size + HDR_SIZE + MIN_SIZE) return;
+  Block *rest = (Block *)((char *)payload(b) + size);
+  rest->size = bsize(b) - size - HDR_SIZE;
+  rest->prev_phys = b;
+  next_phys(rest)->prev_phys = rest;
+  b->size = size;
+  release(rest);
+}
+
+static void update_peak() {
+  size_t used = stat.heap_size - stat.free;
+  if (used > stat.peak_used) stat.peak_used = used;
+}
+
+// No request larger than the heap can be satisfied, and rejecting them before
+// adjust() keeps the rounding here and in find_free() from wrapping around.
+static inline bool too_large(size_t size) { return size > stat.heap_size; }
+
+static size_t adjust(size_t size) {
+  size = ROUNDUP(size, ALIGN);
+  return size < MIN_SIZE ? MIN_SIZE : size;
+}
+
+static void *tlsf_alloc(size_t size) {
+  if (too_large(size)) return NULL;
+  size = adjust(size);
+  Block *b = find_free(size);
+  if (b == NULL) return NULL;
+  trim(b, size);
+  update_peak();
+  return payload(b);
+}
+
+// the returned payload is aligned to `align', which is a power of 2
+static void *tlsf_alloc_aligned(size_t size, size_t align) {
+  size = adjust(size);
+  Block *b = find_free(size + align + HDR_SIZE + MIN_SIZE);
+  if (b == NULL) return NULL;
+  uintptr_t p = (uintptr_t)payload(b), ap = ROUNDUP(p, align);
+  if (ap != p) {
+    // the leading part should be large enough to be a free block
+    if (ap - p < HDR_SIZE + MIN_SIZE) ap += align;
+    Block *nb = to_block((void *)ap);
+    nb->size = bsize(b) - (ap - p);
+    nb->prev_phys = b;
+    next_phys(nb)->prev_phys = nb;
+    b->size = ap - p - HDR_SIZE;
+    release(b);
+    b = nb;
+  }
+  trim(b, size);
+  update_peak();
+  return payload(b);
+}
+
+static void tlsf_free(void *ptr) {
+  release(to_block(ptr));
+}
+
+// resize the used block of `ptr' in place, merging it with the next block
+// if it is free, and return whether it could
+static bool tlsf_resize(void *ptr, size_t size) {
+  Block *b = to_block(ptr), *next = next_phys(b);
+  if (too_large(size)) return false;
+  size = adjust(size);
+  if (size > bsize(b)) {
+    if (!is_free(next) || bsize(b) + HDR_SIZE + bsize(next) < size) return false;
+    remove_free(next);
+    b->size = bsize(b) + HDR_SIZE + bsize(next);
+    next_phys(b)->prev_phys = b;
+  }
+  trim(b, size);
+  update_peak();
+  return true;
+}
+
+// ----------- slabs -----------
+
+typedef struct Slab {
+  struct Slab *next, *prev; // in the list of slabs with free objects
+  void *free;               // freed objects of this slab
+  uint16_t cls, nr_free, nr_obj;
+  uint16_t nr_fresh;        // objects at the end never allocated yet
+} Slab;
+
+static const uint16_t class_size[] = {
+  16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512,
+  640, 768, 896, 1024, 1280, 1536, 1792, 2048,
+};
+#define NR_CLASS LENGTH(class_size)
+
+static uint8_t size_class[SLAB_MAX_OBJ / 16 + 1]; // indexed by (size + 15) / 16
+static Slab *partial[NR_CLASS];
+// one bit for each SLAB_SIZE bytes of the heap, set if it is a slab
+static uint8_t *slab_map;
+static uintptr_t slab_base;
+
+#define SLAB_HDR ROUNDUP(sizeof(Slab), ALIGN)
+
+static inline size_t slab_index(void *p) { return ((uintptr_t)p - slab_base) / SLAB_SIZE; }
+
+static inline bool is_slab(void *p) {
+  size_t i = slab_index(p);
+  return (slab_map[i / 8] >> (i % 8)) & 1;
+}
+
+static void list_remove(Slab *s) {
+  if (s->next != NULL) s->next->prev = s->prev;
+  if (s->prev != NULL) s->prev->next = s->next;
+  else partial[s->cls] = s->next;
+}
+
+static void list_push(Slab *s) {
+  s->prev = NULL;
+  s->next = partial[s->cls];
+  if (s->next != NULL) s->next->prev = s;
+  partial[s->cls] = s;
+}
+
+static Slab *new_slab(int cls) {
+  Slab *s = tlsf_alloc_aligned(SLAB_SIZE, SLAB_SIZE);
+  if (s == NULL) return NULL;
+  size_t i = slab_index(s), size = class_size[cls];
+  slab_map[i / 8] |= 1 << (i % 8);
+  s->cls = cls;
+  s->nr_obj = s->nr_free = s->nr_fresh = (SLAB_SIZE - SLAB_HDR) / size;
+  s->free = NULL;
+  list_push(s);
+  return s;
+}
+
+static void *slab_alloc(int cls) {
+  Slab *s = partial[cls];
+  if (s == NULL && (s = new_slab(cls)) == NULL) return NULL;
+  void *obj = s->free;
+  if (obj != NULL) s->free = *(void **)obj;
+  else obj = (char *)s + SLAB_HDR + (size_t)(s->nr_obj - s->nr_fresh --) * class_size[cls];
+  if (-- s->nr_free == 0) list_remove(s);
+  return obj;
+}
+
+static void slab_free(void *obj) {
+  Slab *s = (Slab *)ROUNDDOWN(obj, SLAB_SIZE);
+  *(void **)obj = s->free;
+  s->free = obj;
+  s->nr_free ++;
+  if (s->nr_free == 1) list_push(s);
+  else if (s->nr_free == s->nr_obj) {
+    list_remove(s);
+    size_t i = slab_index(s);
+    slab_map[i / 8] &= ~(1 << (i % 8));
+    tlsf_free(s);
+  }
+}
+
+// ----------- per-CPU caches -----------
+
+typedef struct {
+  int n;
+  void *obj[MAG_SIZE];
+} Magazine;
+
+static Magazine mag[MAX_CPU][NR_CLASS];
+static int heap_lock = 0;
+static bool heap_ready = false;
+
+// the lock and the per-CPU caches are only used with several CPUs
+static inline bool is_mp() { return cpu_count() > 1; }
+static inline int this_cpu() { return is_mp() ? cpu_current() : 0; }
+
+static void lock() {
+  if (is_mp()) while (atomic_xchg(&heap_lock, 1));
+}
+
+static void unlock() {
+  if (is_mp()) atomic_xchg(&heap_lock, 0);
+}
+
+static bool init() {
+  panic_on(cpu_count() > MAX_CPU, "too many CPUs for malloc()");
+  uintptr_t start = ROUNDUP(heap.start, ALIGN), end = ROUNDDOWN(heap.end, ALIGN);
+  // On native, malloc() may be called before the heap is set up
+  // during initialization of C runtime.
+  if (heap.start == NULL || end < start + 2 * SLAB_SIZE) return false;
+
+  int i, cls = 0;
+  for (i = 0; i < LENGTH(size_class); i ++) {
+    while (class_size[cls] < i * 16) cls ++;
+    size_class[i] = cls;
+  }
+
+  slab_base = ROUNDDOWN(start, SLAB_SIZE);
+  size_t map_size = (end - slab_base) / SLAB_SIZE / 8 + 1;
+  slab_map = (uint8_t *)start;
+  memset(slab_map, 0, map_size);
+  start += ROUNDUP(map_size, ALIGN);
+
+  Block *first = (Block *)start, *sentinel = to_block((void *)end);
+  first->prev_phys = NULL;
+  first->size = (uintptr_t)sentinel - start - HDR_SIZE;
+  sentinel->prev_phys = first;
+  sentinel->size = 0;
+  stat.heap_size = end - (uintptr_t)heap.start;
+  stat.free = 0;
+  insert_free(first);
+  update_peak();
+  return true;
+}
+
+// give the objects cached by `cpu' back to their slabs
+static void drain(int cpu) {
+  int i;
+  lock();
+  for (i = 0; i < NR_CLASS; i ++) {
+    Magazine *m = &mag[cpu][i];
+    while (m->n > 0) slab_free(m->obj[-- m->n]);
+  }
+  unlock();
+}
+
+static void *alloc(int cpu, size_t size) {
+  void *ptr;
+  if (size <= SLAB_MAX_OBJ) {
+    int cls = size_class[(size + 15) / 16];
+    Magazine *m = &mag[cpu][cls];
+    if (is_mp() && m->n > 0) ptr = m->obj[-- m->n];
+    else {
+      lock();
+      ptr = slab_alloc(cls);
+      // refill half of the cache
+      if (is_mp() && ptr != NULL) {
+        void *obj;
+        while (m->n < MAG_SIZE / 2 && (obj = slab_alloc(cls)) != NULL) m->obj[m->n ++] = obj;
+      }
+      unlock();
+    }
+    if (ptr != NULL) stat.allocated[cpu] += class_size[cls];
+  } else {
+    lock();
+    ptr = tlsf_alloc(size);
+    unlock();
+    if (ptr != NULL) stat.allocated[cpu] += bsize(to_block(ptr));
+  }
+  return ptr;
+}
+
+void *malloc(size_t size) {
+  if (!heap_ready) {
+    lock();
+    if (!heap_ready) heap_ready = init();
+    unlock();
+    if (!heap_ready) return NULL;
+  }
+
+  int cpu = this_cpu();
+  void *ptr = alloc(cpu, size);
+  if (ptr == NULL && is_mp()) {
+    // the cached objects may keep slabs from going back to the heap
+    drain(cpu);
+    ptr = alloc(cpu, size);
+  }
+  return ptr;
+}
+
+void *calloc(size_t nmemb, size_t size) {
+  if (size != 0 && nmemb > (size_t)-1 / size) return NULL;
+  void *ptr = malloc(nmemb * size);
+  if (ptr != NULL) memset(ptr, 0, nmemb * size);
+  return ptr;
+}
+
+void free(void *ptr) {
+  if (ptr == NULL || !heap_ready || !IN_RANGE(ptr, heap)) return;
+
+  int cpu = this_cpu();
+  if (is_slab(ptr)) {
+    Slab *s = (Slab *)ROUNDDOWN(ptr, SLAB_SIZE);
+    int cls = s->cls;
+    stat.allocated[cpu] -= class_size[cls];
+    Magazine *m = &mag[cpu][cls];
+    if (is_mp() && m->n < MAG_SIZE) m->obj[m->n ++] = ptr;
+    else {
+      lock();
+      slab_free(ptr);
+      // return half of the cache
+      if (is_mp()) while (m->n > MAG_SIZE / 2) slab_free(m->obj[-- m->n]);
+      unlock();
+    }
+  } else {
+    stat.allocated[cpu] -= bsize(to_block(ptr));
+    lock();
+    tlsf_free(ptr);
+    unlock();
+  }
+}
+
+// the usable size of the block of `ptr'
+static size_t usable_size(void *ptr) {
+  return is_slab(ptr) ? class_size[((Slab *)ROUNDDOWN(ptr, SLAB_SIZE))->cls] : bsize(to_block(ptr));
+}
+
+void *realloc(void *ptr, size_t size) {
+  if (ptr == NULL) return malloc(size);
+  if (size == 0) {
+    free(ptr);
+    return NULL;
+  }
+
+  size_t old = usable_size(ptr);
+  if (is_slab(ptr)) {
+    if (size <= old) return ptr;
+  } else if (size > SLAB_MAX_OBJ) {
+    lock();
+    bool done = tlsf_resize(ptr, size);
+    unlock();
+    if (done) {
+      int cpu = this_cpu();
+      stat.allocated[cpu] += bsize(to_block(ptr));
+      stat.allocated[cpu] -= old;
+      return ptr;
+    }
+  }
+
+  void *p = malloc(size);
+  if (p == NULL) return NULL;
+  memcpy(p, ptr, old < size ? old : size);
+  free(ptr);
+  return p;
+}
+
+void malloc_stats(MallocStats *st) {
+  *st = (MallocStats) {};
+  if (!heap_ready) return;
+  int i, j;
+  for (i = 0; i < MAX_CPU; i ++) st->allocated += stat.allocated[i];
+
+  lock();
+  st->heap_size = stat.heap_size;
+  st->free = stat.free;
+  st->used = stat.heap_size - stat.free;
+  st->peak_used = stat.peak_used;
+  for (i = 0; i < NR_CLASS; i ++) {
+    for (Slab *s = partial[i]; s != NULL; s = s->next) st->slab_free += s->nr_free * class_size[i];
+  }
+  if (fl_bitmap != 0) {
+    int fl = msb(fl_bitmap), sl = msb(sl_bitmap[fl]);
+    for (Block *b = free_list[fl][sl]; b != NULL; b = b->next_free) {
+      if (bsize(b) > st->largest_free) st->largest_free = bsize(b);
+    }
+  }
+  for (i = 0; i < cpu_count(); i ++) {
+    for (j = 0; j < NR_CLASS; j ++) st->slab_free += mag[i][j].n * class_size[j];
+  }
+  unlock();
+}
+
+#endif
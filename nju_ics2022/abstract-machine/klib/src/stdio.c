@@ -5,24 +5,259 @@
 
 #if !defined(__ISA_NATIVE__) || defined(__NATIVE_USE_KLIB__)
 
+// All functions share one formatting engine, which writes into a sink.
+// A sink is a buffer, and it is either bounded (the output beyond its size
+// is dropped), or flushed to putch() when it is full.
+typedef struct {
+  char *buf;
+  size_t pos, size; // number of chars in buf, capacity of buf
+  bool flush;       // flush to putch() when buf is full
+  int len;          // number of chars produced so far
+} Sink;
+
+static void sink_flush(Sink *s) {
+  for (size_t i = 0; i < s->pos; i ++) putch(s->buf[i]);
+  s->pos = 0;
+}
+
+static inline void sink_putc(Sink *s, char c) {
+  if (s->pos == s->size && s->flush) sink_flush(s);
+  if (s->pos < s->size) s->buf[s->pos ++] = c;
+  s->len ++;
+}
+
+static void sink_write(Sink *s, const char *p, size_t n) {
+  s->len += n;
+  while (n > 0) {
+    if (s->pos == s->size) {
+      if (!s->flush) return;
+      sink_flush(s);
+    }
+    size_t k = s->size - s->pos;
+    if (k > n) k = n;
+    memcpy(s->buf + s->pos, p, k);
+    s->pos += k;
+    p += k;
+    n -= k;
+  }
+}
+
+static void sink_pad(Sink *s, char c, int n) {
+  for (; n > 0; n --) sink_putc(s, c);
+}
+
+static const char digit_pairs[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+// write the digits of `x' right-aligned in the buffer ending at `end',
+// return the start of the digits
+static char *utoa10(char *end, unsigned long long x) {
+  // 64-bit divisions are slow on 32-bit machines, leave them early
+  while (x > UINT32_MAX) {
+    unsigned long long q = x / 100;
+    end -= 2;
+    memcpy(end, &digit_pairs[(x - q * 100) * 2], 2);
+    x = q;
+  }
+  uint32_t y = x;
+  while (y >= 100) {
+    uint32_t q = y / 100;
+    end -= 2;
+    memcpy(end, &digit_pairs[(y - q * 100) * 2], 2);
+    y = q;
+  }
+  if (y >= 10) {
+    end -= 2;
+    memcpy(end, &digit_pairs[y * 2], 2);
+  } else {
+    *-- end = '0' + y;
+  }
+  return end;
+}
+
+static char *utoa16(char *end, unsigned long long x, bool upper) {
+  const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+  do {
+    *-- end = digits[x & 0xf];
+    x >>= 4;
+  } while (x != 0);
+  return end;
+}
+
+enum { F_LEFT = 1, F_ZERO = 2, F_PLUS = 4, F_SPACE = 8, F_ALT = 16 };
+
+static void format_num(Sink *s, unsigned long long x, bool neg, char conv,
+    int flags, int width, int prec) {
+  char buf[24], *end = buf + sizeof(buf), *p;
+  const char *prefix = "";
+  if (prec == 0 && x == 0) p = end;
+  else if (conv == 'x' || conv == 'X' || conv == 'p') p = utoa16(end, x, conv == 'X');
+  else p = utoa10(end, x);
+
+  if (neg) prefix = "-";
+  else if (conv == 'd' && (flags & F_PLUS)) prefix = "+";
+  else if (conv == 'd' && (flags & F_SPACE)) prefix = " ";
+  else if (conv == 'p' || ((flags & F_ALT) && x != 0 && conv != 'u' && conv != 'd')) {
+    prefix = (conv == 'X' ? "0X" : "0x");
+  }
+
+  int ndigit = end - p, nprefix = strlen(prefix);
+  int nzero = (prec > ndigit ? prec - ndigit : 0);
+  int npad = width - nprefix - nzero - ndigit;
+  if ((flags & F_ZERO) && !(flags & F_LEFT) && prec < 0 && npad > 0) {
+    nzero += npad;
+    npad = 0;
+  }
+  if (!(flags & F_LEFT)) sink_pad(s, ' ', npad);
+  sink_write(s, prefix, nprefix);
+  sink_pad(s, '0', nzero);
+  sink_write(s, p, ndigit);
+  if (flags & F_LEFT) sink_pad(s, ' ', npad);
+}
+
+static void format_str(Sink *s, const char *str, int flags, int width, int prec) {
+  size_t n = 0;
+  if (str == NULL) str = "(null)";
+  // do not read beyond the precision
+  if (prec >= 0) { while (n < prec && str[n] != '\0') n ++; }
+  else n = strlen(str);
+  int npad = width - (int)n;
+  if (!(flags & F_LEFT)) sink_pad(s, ' ', npad);
+  sink_write(s, str, n);
+  if (flags & F_LEFT) sink_pad(s, ' ', npad);
+}
+
+static void format(Sink *s, const char *fmt, va_list ap) {
+  while (*fmt != '\0') {
+    // copy the plain text in one go
+    const char *p = fmt;
+    while (*p != '\0' && *p != '%') p ++;
+    if (p != fmt) {
+      sink_write(s, fmt, p - fmt);
+      fmt = p;
+      continue;
+    }
+
+    const char *spec = fmt ++;
+    int flags = 0, width = 0, prec = -1, lng = 0;
+    for (;; fmt ++) {
+      if (*fmt == '-') flags |= F_LEFT;
+      else if (*fmt == '0') flags |= F_ZERO;
+      else if (*fmt == '+') flags |= F_PLUS;
+      else if (*fmt == ' ') flags |= F_SPACE;
+      else if (*fmt == '#') flags |= F_ALT;
+      else break;
+    }
+    if (*fmt == '*') {
+      width = va_arg(ap, int);
+      if (width < 0) { flags |= F_LEFT; width = -width; }
+      fmt ++;
+    } else {
+      for (; *fmt >= '0' && *fmt <= '9'; fmt ++) width = width * 10 + *fmt - '0';
+    }
+    if (*fmt == '.') {
+      fmt ++;
+      prec = 0;
+      if (*fmt == '*') {
+        prec = va_arg(ap, int);
+        if (prec < 0) prec = -1;
+        fmt ++;
+      }
+      else {
+        for (; *fmt >= '0' && *fmt <= '9'; fmt ++) prec = prec * 10 + *fmt - '0';
+      }
+    }
+    // lng: -2 for char, -1 for short, 0 for int, 1 for long, 2 for long long
+    for (;; fmt ++) {
+      if (*fmt == 'l') lng ++;
+      else if (*fmt == 'h') lng --;
+      else if (*fmt == 'z') lng = (sizeof(size_t) == sizeof(long) ? 1 : 0);
+      else break;
+    }
+
+    char conv = *fmt ++;
+    switch (conv) {
+      case 'd': case 'i': {
+        long long v = (lng >= 2 ? va_arg(ap, long long) : lng == 1 ? va_arg(ap, long) : va_arg(ap, int));
+        if (lng == -1) v = (short)v;
+        else if (lng <= -2) v = (signed char)v;
+        unsigned long long x = (v < 0 ? -(unsigned long long)v : v);
+        format_num(s, x, v < 0, 'd', flags, width, prec);
+        break;
+      }
+      case 'u': case 'x': case 'X': {
+        unsigned long long x = (lng >= 2 ? va_arg(ap, unsigned long long) :
+            lng == 1 ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int));
+        if (lng == -1) x = (unsigned short)x;
+        else if (lng <= -2) x = (unsigned char)x;
+        format_num(s, x, false, conv, flags, width, prec);
+        break;
+      }
+      case 'p': {
+        void *ptr = va_arg(ap, void *);
+        if (ptr == NULL) format_str(s, "(nil)", flags, width, -1);
+        else format_num(s, (uintptr_t)ptr, false, 'p', flags, width, prec);
+        break;
+      }
+      case 's': format_str(s, va_arg(ap, const char *), flags, width, prec); break;
+      case 'c': {
+        char c = va_arg(ap, int);
+        if (!(flags & F_LEFT)) sink_pad(s, ' ', width - 1);
+        sink_putc(s, c);
+        if (flags & F_LEFT) sink_pad(s, ' ', width - 1);
+        break;
+      }
+      case '%': sink_putc(s, '%'); break;
+      case '\0': fmt --; // fall through
+      default: sink_write(s, spec, fmt - spec); break;
+    }
+  }
+}
+
+int vprintf(const char *fmt, va_list ap) {
+  char batch[256];
+  Sink s = { .buf = batch, .size = sizeof(batch), .flush = true };
+  format(&s, fmt, ap);
+  sink_flush(&s);
+  return s.len;
+}
+
 int printf(const char *fmt, ...) {
-  panic("Not implemented");
+  va_list ap;
+  va_start(ap, fmt);
+  int ret = vprintf(fmt, ap);
+  va_end(ap);
+  return ret;
+}
+
+int vsnprintf(char *out, size_t n, const char *fmt, va_list ap) {
+  // leave room for the terminating '\0'
+  Sink s = { .buf = out, .size = (n > 0 ? n - 1 : 0), .flush = false };
+  format(&s, fmt, ap);
+  if (n > 0) out[s.pos] = '\0';
+  return s.len;
 }
 
 int vsprintf(char *out, const char *fmt, va_list ap) {
-  panic("Not implemented");
+  return vsnprintf(out, (size_t)-1 - (uintptr_t)out, fmt, ap);
 }
 
 int sprintf(char *out, const char *fmt, ...) {
-  panic("Not implemented");
+  va_list ap;
+  va_start(ap, fmt);
+  int ret = vsprintf(out, fmt, ap);
+  va_end(ap);
+  return ret;
 }
 
 int snprintf(char *out, size_t n, const char *fmt, ...) {
-  panic("Not implemented");
-}
-
-int vsnprintf(char *out, size_t n, const char *fmt, va_list ap) {
-  panic("Not implemented");
+  va_list ap;
+  va_start(ap, fmt);
+  int ret = vsnprintf(out, n, fmt, ap);
+  va_end(ap);
+  return ret;
 }
 
 #endif
@@ -4,44 +4,222 @@
 
 #if !defined(__ISA_NATIVE__) || defined(__NATIVE_USE_KLIB__)
 
+// SSE2 is only available on native, the kernels are built with -mno-sse
+#if defined(__x86_64__) && defined(__SSE2__)
+#include <emmintrin.h>
+#define HAS_SSE2
+#endif
+
+// The routines below work on machine words once the pointers are aligned.
+// An aligned word never crosses a page boundary, so reading a whole word
+// which contains the terminating '\0' is safe.
+typedef uintptr_t __attribute__((__may_alias__)) op_t;
+
+#define OPSIZ       sizeof(op_t)
+#define ONES        ((op_t)-1 / 0xff) // 0x0101...01
+#define HIGHS       (ONES << 7)       // 0x8080...80
+// non-zero iff some byte in `x' is zero
+#define HAS_ZERO(x) (((x) - ONES) & ~(x) & HIGHS)
+#define OFFSET(p)   ((uintptr_t)(p) & (OPSIZ - 1))
+
+// the bulk of strlen(), memcpy() and memset() starts at this alignment
+#ifdef HAS_SSE2
+#define VECSIZ      16
+#else
+#define VECSIZ      OPSIZ
+#endif
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define MERGE(lo, hi, sh) (((lo) >> (sh)) | ((hi) << (8 * OPSIZ - (sh))))
+#else
+#define MERGE(lo, hi, sh) (((lo) << (sh)) | ((hi) >> (8 * OPSIZ - (sh))))
+#endif
+
 size_t strlen(const char *s) {
-  panic("Not implemented");
+  const char *p = s;
+  for (; ((uintptr_t)p & (VECSIZ - 1)) != 0; p ++) {
+    if (*p == '\0') return p - s;
+  }
+#ifdef HAS_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  int mask;
+  for (; (mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i *)p), zero))) == 0; p += 16);
+  return p - s + __builtin_ctz(mask);
+#else
+  const op_t *w = (const op_t *)p;
+  for (; !HAS_ZERO(*w); w ++);
+  for (p = (const char *)w; *p != '\0'; p ++);
+  return p - s;
+#endif
+}
+
+static size_t strnlen(const char *s, size_t n) {
+  const char *p = s, *end = s + n;
+  for (; p < end && OFFSET(p) != 0; p ++) {
+    if (*p == '\0') return p - s;
+  }
+  for (; end - p >= OPSIZ && !HAS_ZERO(*(const op_t *)p); p += OPSIZ);
+  for (; p < end && *p != '\0'; p ++);
+  return p - s;
+}
+
+// copy forward, safe for overlapping buffers with dst <= src
+static void copy_fwd(unsigned char *d, const unsigned char *s, size_t n) {
+  if (n >= 2 * VECSIZ) {
+    for (; ((uintptr_t)d & (VECSIZ - 1)) != 0; n --) *d ++ = *s ++;
+#ifdef HAS_SSE2
+    for (; n >= 64; n -= 64, d += 64, s += 64) {
+      __m128i x0 = _mm_loadu_si128((const __m128i *)s);
+      __m128i x1 = _mm_loadu_si128((const __m128i *)(s + 16));
+      __m128i x2 = _mm_loadu_si128((const __m128i *)(s + 32));
+      __m128i x3 = _mm_loadu_si128((const __m128i *)(s + 48));
+      _mm_store_si128((__m128i *)d, x0);
+      _mm_store_si128((__m128i *)(d + 16), x1);
+      _mm_store_si128((__m128i *)(d + 32), x2);
+      _mm_store_si128((__m128i *)(d + 48), x3);
+    }
+#endif
+    op_t *wd = (op_t *)d;
+    if (OFFSET(s) == 0) {
+      const op_t *ws = (const op_t *)s;
+      for (; n >= 4 * OPSIZ; n -= 4 * OPSIZ, wd += 4, ws += 4) {
+        op_t w0 = ws[0], w1 = ws[1], w2 = ws[2], w3 = ws[3];
+        wd[0] = w0; wd[1] = w1; wd[2] = w2; wd[3] = w3;
+      }
+      for (; n >= OPSIZ; n -= OPSIZ) *wd ++ = *ws ++;
+      s = (const unsigned char *)ws;
+    } else {
+      // src is not aligned: load aligned words and shift them into place
+      int sh = OFFSET(s) * 8;
+      const op_t *ws = (const op_t *)ROUNDDOWN(s, OPSIZ);
+      op_t lo = *ws ++;
+      for (; n >= OPSIZ; n -= OPSIZ, s += OPSIZ) {
+        op_t hi = *ws ++;
+        *wd ++ = MERGE(lo, hi, sh);
+        lo = hi;
+      }
+    }
+    d = (unsigned char *)wd;
+  }
+  while (n --) *d ++ = *s ++;
 }
 
 char *strcpy(char *dst, const char *src) {
-  panic("Not implemented");
+  copy_fwd((unsigned char *)dst, (const unsigned char *)src, strlen(src) + 1);
+  return dst;
 }
 
 char *strncpy(char *dst, const char *src, size_t n) {
-  panic("Not implemented");
+  size_t len = strnlen(src, n);
+  copy_fwd((unsigned char *)dst, (const unsigned char *)src, len);
+  memset(dst + len, 0, n - len);
+  return dst;
 }
 
 char *strcat(char *dst, const char *src) {
-  panic("Not implemented");
+  strcpy(dst + strlen(dst), src);
+  return dst;
 }
 
 int strcmp(const char *s1, const char *s2) {
-  panic("Not implemented");
+  const unsigned char *p1 = (const unsigned char *)s1, *p2 = (const unsigned char *)s2;
+  if (OFFSET(p1) == OFFSET(p2)) {
+    for (; OFFSET(p1) != 0; p1 ++, p2 ++) {
+      if (*p1 != *p2 || *p1 == '\0') return *p1 - *p2;
+    }
+    const op_t *w1 = (const op_t *)p1, *w2 = (const op_t *)p2;
+    for (; *w1 == *w2 && !HAS_ZERO(*w1); w1 ++, w2 ++);
+    p1 = (const unsigned char *)w1;
+    p2 = (const unsigned char *)w2;
+  }
+  for (; *p1 == *p2 && *p1 != '\0'; p1 ++, p2 ++);
+  return *p1 - *p2;
 }
 
 int strncmp(const char *s1, const char *s2, size_t n) {
-  panic("Not implemented");
+  const unsigned char *p1 = (const unsigned char *)s1, *p2 = (const unsigned char *)s2;
+  if (OFFSET(p1) == OFFSET(p2)) {
+    for (; n > 0 && OFFSET(p1) != 0; n --, p1 ++, p2 ++) {
+      if (*p1 != *p2 || *p1 == '\0') return *p1 - *p2;
+    }
+    const op_t *w1 = (const op_t *)p1, *w2 = (const op_t *)p2;
+    for (; n >= OPSIZ && *w1 == *w2 && !HAS_ZERO(*w1); n -= OPSIZ, w1 ++, w2 ++);
+    p1 = (const unsigned char *)w1;
+    p2 = (const unsigned char *)w2;
+  }
+  for (; n > 0; n --, p1 ++, p2 ++) {
+    if (*p1 != *p2 || *p1 == '\0') return *p1 - *p2;
+  }
+  return 0;
 }
 
 void *memset(void *s, int c, size_t n) {
-  panic("Not implemented");
+  unsigned char *d = s;
+  if (n >= 2 * VECSIZ) {
+    op_t w = ONES * (unsigned char)c;
+    for (; ((uintptr_t)d & (VECSIZ - 1)) != 0; n --) *d ++ = c;
+#ifdef HAS_SSE2
+    __m128i x = _mm_set1_epi8(c);
+    for (; n >= 64; n -= 64, d += 64) {
+      _mm_store_si128((__m128i *)d, x);
+      _mm_store_si128((__m128i *)(d + 16), x);
+      _mm_store_si128((__m128i *)(d + 32), x);
+      _mm_store_si128((__m128i *)(d + 48), x);
+    }
+#endif
+    op_t *wd = (op_t *)d;
+    for (; n >= 4 * OPSIZ; n -= 4 * OPSIZ, wd += 4) {
+      wd[0] = w; wd[1] = w; wd[2] = w; wd[3] = w;
+    }
+    for (; n >= OPSIZ; n -= OPSIZ) *wd ++ = w;
+    d = (unsigned char *)wd;
+  }
+  while (n --) *d ++ = c;
+  return s;
 }
 
 void *memmove(void *dst, const void *src, size_t n) {
-  panic("Not implemented");
+  unsigned char *d = dst;
+  const unsigned char *s = src;
+  if ((uintptr_t)d - (uintptr_t)s >= n) {
+    // dst is before src, or they do not overlap
+    copy_fwd(d, s, n);
+    return dst;
+  }
+  d += n;
+  s += n;
+  if (OFFSET(d) == OFFSET(s)) {
+    for (; n > 0 && OFFSET(d) != 0; n --) *-- d = *-- s;
+    op_t *wd = (op_t *)d;
+    const op_t *ws = (const op_t *)s;
+    for (; n >= OPSIZ; n -= OPSIZ) *-- wd = *-- ws;
+    d = (unsigned char *)wd;
+    s = (const unsigned char *)ws;
+  }
+  while (n --) *-- d = *-- s;
+  return dst;
 }
 
 void *memcpy(void *out, const void *in, size_t n) {
-  panic("Not implemented");
+  copy_fwd(out, in, n);
+  return out;
 }
 
 int memcmp(const void *s1, const void *s2, size_t n) {
-  panic("Not implemented");
+  const unsigned char *p1 = s1, *p2 = s2;
+  if (n >= 2 * OPSIZ && OFFSET(p1) == OFFSET(p2)) {
+    for (; OFFSET(p1) != 0; n --, p1 ++, p2 ++) {
+      if (*p1 != *p2) return *p1 - *p2;
+    }
+    const op_t *w1 = (const op_t *)p1, *w2 = (const op_t *)p2;
+    for (; n >= OPSIZ && *w1 == *w2; n -= OPSIZ, w1 ++, w2 ++);
+    p1 = (const unsigned char *)w1;
+    p2 = (const unsigned char *)w2;
+  }
+  for (; n > 0; n --, p1 ++, p2 ++) {
+    if (*p1 != *p2) return *p1 - *p2;
+  }
+  return 0;
 }
 
 #endif
@@ -0,0 +1,160 @@
+#include <klib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef unsigned long long du_int;
+typedef long long di_int;
+
+du_int klib__udivmoddi4(du_int a, du_int b, du_int *rem);
+du_int klib__udivdi3(du_int a, du_int b);
+du_int klib__umoddi3(du_int a, du_int b);
+di_int klib__divdi3(di_int a, di_int b);
+di_int klib__moddi3(di_int a, di_int b);
+int klib__clzsi2(int a);
+int klib__ctzsi2(int a);
+int klib__clzdi2(di_int a);
+int klib__ctzdi2(di_int a);
+
+static int nr_fail = 0;
+
+#define CHECK(cond, fmt, ...) do { \
+    if (!(cond) && nr_fail ++ < 10) \
+      fprintf(stderr, "FAIL %s: " fmt "\n", #cond, ## __VA_ARGS__); \
+  } while (0)
+
+static du_int rand64(void) {
+  du_int x = 0;
+  for (int i = 0; i < 4; i ++) x = (x << 16) ^ (rand() & 0xffff);
+  return x;
+}
+
+// a random number with a random number of significant bits,
+// so that all the branches in __udivmoddi4() are taken
+static du_int rand_bits(void) {
+  int bits = rand() % 65;
+  return (bits == 0 ? 0 : rand64() >> (64 - bits));
+}
+
+static const du_int special[] = {
+  1, 2, 3, 7, 10, 100, 1000, 1000000, 0x7fffffff, 0x80000000, 0xffffffff,
+  0x100000000ull, 0x100000001ull, 0x1ffffffffull, 0x7fffffffffffffffull,
+  0x8000000000000000ull, 0x8000000000000001ull, 0xfffffffffffffffeull,
+  0xffffffffffffffffull,
+};
+#define NR_SPECIAL (sizeof(special) / sizeof(special[0]))
+
+static void check_div(du_int a, du_int b) {
+  du_int r, q = klib__udivmoddi4(a, b, &r);
+  CHECK(q == a / b && r == a % b, "%llx / %llx = %llx, %% = %llx", a, b, q, r);
+  di_int sa = a, sb = b;
+  if (sb == -1) return; // avoid the overflow of INT64_MIN / -1
+  CHECK(klib__divdi3(sa, sb) == sa / sb, "%lld / %lld", sa, sb);
+  CHECK(klib__moddi3(sa, sb) == sa % sb, "%lld %% %lld", sa, sb);
+}
+
+static void check_bits(du_int x) {
+  if (x == 0) return;
+  CHECK(klib__clzdi2(x) == __builtin_clzll(x), "clz %llx", x);
+  CHECK(klib__ctzdi2(x) == __builtin_ctzll(x), "ctz %llx", x);
+  unsigned lo = x;
+  if (lo == 0) return;
+  CHECK(klib__clzsi2(lo) == __builtin_clz(lo), "clz %x", lo);
+  CHECK(klib__ctzsi2(lo) == __builtin_ctz(lo), "ctz %x", lo);
+}
+
+static void check_udiv64(du_int d, int rounds) {
+  UDiv64 r = udiv64_init(d);
+  for (int i = 0; i < NR_SPECIAL; i ++) {
+    du_int n = special[i];
+    CHECK(udiv64(n, &r) == n / d, "%llx / const %llx", n, d);
+  }
+  for (int i = 0; i < rounds; i ++) {
+    du_int n = rand_bits();
+    CHECK(udiv64(n, &r) == n / d, "%llx / const %llx", n, d);
+  }
+}
+
+static void test(void) {
+  for (int i = 0; i < NR_SPECIAL; i ++) {
+    check_bits(special[i]);
+    for (int j = 0; j < NR_SPECIAL; j ++) check_div(special[i], special[j]);
+  }
+  for (int i = 0; i < 64; i ++) {
+    check_bits(1ull << i);
+    check_bits(~0ull << i);
+    check_udiv64(1ull << i, 100);
+    check_udiv64((1ull << i) + 1, 100);
+    check_udiv64(~0ull >> i, 100);
+  }
+  for (int i = 0; i < NR_SPECIAL; i ++) check_udiv64(special[i], 1000);
+  for (int i = 0; i < 4000000; i ++) {
+    du_int a = rand_bits(), b = rand_bits();
+    check_bits(a);
+    if (b != 0) check_div(a, b);
+  }
+  for (int i = 0; i < 20000; i ++) {
+    du_int d = rand_bits();
+    if (d != 0) check_udiv64(d, 100);
+  }
+}
+
+#define N 4096
+#define ROUNDS 1000
+static du_int num[N], den[N];
+static volatile du_int sink;
+
+static double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// nanoseconds per division, the compiler of the host goes to its libgcc
+// for a 64-bit division on 32-bit machines
+#define TIME(expr) ({ \
+    double start = now(); \
+    du_int s = 0; \
+    for (int round = 0; round < ROUNDS; round ++) \
+      for (int i = 0; i < N; i ++) s += (expr); \
+    sink = s; \
+    (now() - start) * 1e9 / ((double)N * ROUNDS); \
+  })
+
+static void bench(const char *name, du_int (*gen_num)(void), du_int (*gen_den)(void)) {
+  for (int i = 0; i < N; i ++) {
+    num[i] = gen_num();
+    do den[i] = gen_den(); while (den[i] == 0);
+  }
+  UDiv64 r = udiv64_init(den[0]);
+  du_int d0 = den[0];
+  double t_klib = TIME(klib__udivdi3(num[i], den[i]));
+  double t_host = TIME(num[i] / den[i]);
+  double t_const = TIME(udiv64(num[i], &r));
+  double t_host_const = TIME(num[i] / *(volatile du_int *)&d0);
+  printf("%-20s %8.2f %8.2f %10.2f %10.2f\n", name, t_klib, t_host, t_const, t_host_const);
+}
+
+static du_int gen32(void) { return rand64() >> 32; }
+static du_int gen64(void) { return rand64(); }
+static du_int gen48(void) { return rand64() >> 16; }
+static du_int gen_small(void) { return rand64() >> 54; }
+
+int main(void) {
+  srand(1);
+  test();
+  if (nr_fail) {
+    printf("%d checks failed\n", nr_fail);
+    return 1;
+  }
+  printf("all checks passed\n\n");
+
+  printf("%-20s %8s %8s %10s %10s  (ns per division)\n",
+      "numerator/divisor", "klib", "host", "klib-const", "host-const");
+  bench("32 / 32", gen32, gen32);
+  bench("64 / 10-bit", gen64, gen_small);
+  bench("64 / 32", gen64, gen32);
+  bench("64 / 48", gen64, gen48);
+  bench("64 / 64", gen64, gen64);
+  return 0;
+}
@@ -0,0 +1,117 @@
+#include <am.h>
+#include <klib.h>
+#include <klib-macros.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// The AM functions used by malloc.c, for a single CPU with a static heap
+#define HEAP_SIZE (16 << 20)
+static uint8_t heap_mem[HEAP_SIZE] __attribute__((aligned(4096)));
+Area heap = { heap_mem, heap_mem + HEAP_SIZE };
+int cpu_count(void) { return 1; }
+int cpu_current(void) { return 0; }
+int atomic_xchg(int *addr, int newval) { return __atomic_exchange_n(addr, newval, __ATOMIC_SEQ_CST); }
+void putch(char ch) { putchar(ch); }
+void halt(int code) { exit(code); }
+
+static int nr_fail = 0;
+
+#define CHECK(cond, fmt, ...) do { \
+    if (!(cond) && nr_fail ++ < 10) \
+      fprintf(stderr, "FAIL %s: " fmt "\n", #cond, ## __VA_ARGS__); \
+  } while (0)
+
+static void fill(uint8_t *p, size_t n, int seed) {
+  for (size_t i = 0; i < n; i ++) p[i] = seed + i;
+}
+
+static bool check_fill(uint8_t *p, size_t n, int seed) {
+  for (size_t i = 0; i < n; i ++) if (p[i] != (uint8_t)(seed + i)) return false;
+  return true;
+}
+
+// the requests which can not be satisfied, even after rounding up the size,
+// volatile to keep the compiler from rejecting them at compile time
+static void test_huge(void) {
+  static volatile size_t huge[] = {
+    SIZE_MAX, SIZE_MAX - 1, SIZE_MAX - 15, SIZE_MAX / 2 + 1, SIZE_MAX / 2,
+    (size_t)HEAP_SIZE + 1, (size_t)HEAP_SIZE * 2,
+  };
+  for (int i = 0; i < LENGTH(huge); i ++) {
+    CHECK(malloc(huge[i]) == NULL, "malloc(%#zx)", huge[i]);
+    CHECK(calloc(1, huge[i]) == NULL, "calloc(1, %#zx)", huge[i]);
+
+    // realloc() fails and leaves the block alone, both for a slab object
+    // and for a large block
+    size_t sizes[] = { 100, 100000 };
+    for (int j = 0; j < LENGTH(sizes); j ++) {
+      uint8_t *p = malloc(sizes[j]);
+      CHECK(p != NULL, "malloc(%zu)", sizes[j]);
+      if (p == NULL) continue;
+      fill(p, sizes[j], i);
+      CHECK(realloc(p, huge[i]) == NULL, "realloc(%zu -> %#zx)", sizes[j], huge[i]);
+      CHECK(check_fill(p, sizes[j], i), "contents after realloc(%#zx)", huge[i]);
+      free(p);
+    }
+  }
+  CHECK(calloc(huge[4], 3) == NULL, "calloc overflow");
+}
+
+#define N 2000
+static uint8_t *ptr[N];
+static size_t len[N];
+
+static size_t rand_size(void) {
+  int r = rand() % 100;
+  return r < 80 ? 1 + rand() % 512 : r < 97 ? 1 + rand() % 8192 : 1 + rand() % 200000;
+}
+
+static void test_random(int rounds) {
+  for (int k = 0; k < rounds; k ++) {
+    int i = rand() % N;
+    if (ptr[i] == NULL) {
+      len[i] = rand_size();
+      ptr[i] = (rand() % 4 ? malloc(len[i]) : calloc(1, len[i]));
+      CHECK(ptr[i] != NULL, "malloc(%zu)", len[i]);
+      if (ptr[i] == NULL) continue;
+      CHECK((uintptr_t)ptr[i] % (2 * sizeof(void *)) == 0, "alignment of %p", ptr[i]);
+      fill(ptr[i], len[i], i);
+    } else if (rand() % 3 == 0) {
+      size_t n = rand_size(), keep = (n < len[i] ? n : len[i]);
+      uint8_t *p = realloc(ptr[i], n);
+      CHECK(p != NULL, "realloc(%zu -> %zu)", len[i], n);
+      if (p == NULL) continue;
+      CHECK(check_fill(p, keep, i), "contents after realloc(%zu -> %zu)", len[i], n);
+      ptr[i] = p;
+      len[i] = n;
+      fill(ptr[i], len[i], i);
+    } else {
+      CHECK(check_fill(ptr[i], len[i], i), "contents of a block of %zu", len[i]);
+      free(ptr[i]);
+      ptr[i] = NULL;
+    }
+  }
+  for (int i = 0; i < N; i ++) {
+    free(ptr[i]);
+    ptr[i] = NULL;
+  }
+
+  // all memory is free again, in one block
+  MallocStats st;
+  malloc_stats(&st);
+  CHECK(st.allocated == 0, "%zu bytes still allocated", st.allocated);
+  CHECK(st.largest_free + 4096 >= st.free, "largest free %zu of %zu", st.largest_free, st.free);
+}
+
+int main(void) {
+  srand(1);
+  test_huge();
+  test_random(500000);
+  test_huge();
+  if (nr_fail) {
+    printf("%d checks failed\n", nr_fail);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
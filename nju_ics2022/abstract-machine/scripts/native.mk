@@ -10,13 +10,14 @@ AM_SRCS := native/trm.c \
            native/ioe/gpu.c \
            native/ioe/audio.c \
            native/ioe/disk.c \
+           native/ioe/net.c \
 
 CFLAGS  += -fpie
 ASFLAGS += -fpie -pie
 
 image:
 	@echo + LD "->" $(IMAGE_REL)
-	@g++ -pie -o $(IMAGE) -Wl,--whole-archive $(LINKAGE) -Wl,-no-whole-archive -Wl,-z -Wl,noexecstack -lSDL2 -ldl
+	@g++ -pie -o $(IMAGE) -Wl,--whole-archive $(LINKAGE) -Wl,-no-whole-archive -Wl,-z -Wl,noexecstack -lSDL2 -ldl -lpthread -lrt
 
 run: image
 	$(IMAGE)
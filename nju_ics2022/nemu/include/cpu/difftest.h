@@ -39,6 +39,8 @@ extern void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direc
 extern void (*ref_difftest_regcpy)(void *dut, bool direction);
 extern void (*ref_difftest_exec)(uint64_t n);
 extern void (*ref_difftest_raise_intr)(uint64_t NO);
+extern uint64_t (*ref_difftest_exec_until)(uint64_t pc, uint64_t max_n);
+extern uint64_t (*ref_difftest_memhash)(paddr_t *pages, size_t *nr_page, bool clear);
 
 static inline bool difftest_check_reg(const char *name, vaddr_t pc, word_t ref, word_t dut) {
   if (ref != dut) {
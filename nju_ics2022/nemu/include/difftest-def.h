@@ -33,4 +33,20 @@ enum { DIFFTEST_TO_DUT, DIFFTEST_TO_REF };
 # error Unsupport ISA
 #endif
 
+// Pages written by REF are reported by difftest_memhash() with a hash of
+// their contents. DUT hashes the same pages in the same way to detect
+// memory divergence without copying the pages.
+#define DIFFTEST_PAGE_SHIFT 12
+#define DIFFTEST_PAGE_SIZE (1ul << DIFFTEST_PAGE_SHIFT)
+
+static inline uint64_t difftest_page_hash(uint64_t addr, const uint64_t *page) {
+  uint64_t h = addr * 0x9e3779b97f4a7c15ull;
+  uint64_t i;
+  for (i = 0; i < DIFFTEST_PAGE_SIZE / sizeof(uint64_t); i ++) {
+    h = (h ^ page[i]) * 0x100000001b3ull;
+    h ^= h >> 29;
+  }
+  return h;
+}
+
 #endif
@@ -29,7 +29,17 @@ extern char isa_logo[];
 void init_isa();
 
 // reg
+#ifdef CONFIG_MULTI_HART
+// every hart owns a copy of the architectural state, `cpu' always
+// refers to the one of the hart running on the current host thread
+extern CPU_state harts[CONFIG_NR_HART];
+extern __thread CPU_state *this_hart;
+#define cpu (*this_hart)
+#define hart_id() ((int)(this_hart - harts))
+#else
 extern CPU_state cpu;
+#define hart_id() 0
+#endif
 void isa_reg_display();
 word_t isa_reg_str2val(const char *name, bool *success);
 
@@ -41,6 +51,7 @@ int isa_exec_once(struct Decode *s);
 enum { MMU_DIRECT, MMU_TRANSLATE, MMU_FAIL };
 enum { MEM_TYPE_IFETCH, MEM_TYPE_READ, MEM_TYPE_WRITE };
 enum { MEM_RET_OK, MEM_RET_FAIL, MEM_RET_CROSS_PAGE };
+enum { AMO_SWAP, AMO_ADD, AMO_XOR, AMO_AND, AMO_OR, AMO_MIN, AMO_MAX, AMO_MINU, AMO_MAXU };
 #ifndef isa_mmu_check
 int isa_mmu_check(vaddr_t vaddr, int len, int type);
 #endif
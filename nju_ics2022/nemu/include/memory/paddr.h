@@ -31,7 +31,14 @@ static inline bool in_pmem(paddr_t addr) {
   return addr - CONFIG_MBASE < CONFIG_MSIZE;
 }
 
+// instruction fetch, which is not seen by the memory tracer
+word_t paddr_ifetch(paddr_t addr, int len);
 word_t paddr_read(paddr_t addr, int len);
 void paddr_write(paddr_t addr, int len, word_t data);
 
+// atomic memory operations, performed with host atomics on pmem
+// so that they stay atomic when several harts run in parallel
+word_t paddr_amo(paddr_t addr, int len, int op, word_t data);
+bool paddr_cas(paddr_t addr, int len, word_t expected, word_t data);
+
 #endif
@@ -30,10 +30,31 @@ typedef struct {
 
 extern NEMUState nemu_state;
 
+// The state is shared by the harts on their host threads. The halt_* fields
+// are written before the state, and published by it.
+static inline int nemu_state_get() {
+  return __atomic_load_n(&nemu_state.state, __ATOMIC_ACQUIRE);
+}
+static inline void nemu_state_set(int state) {
+  __atomic_store_n(&nemu_state.state, state, __ATOMIC_RELEASE);
+}
+
 // ----------- timer -----------
 
 uint64_t get_time();
 
+// ----------- ftrace -----------
+
+void ftrace_call(vaddr_t pc, vaddr_t target);
+void ftrace_ret(vaddr_t pc, vaddr_t target);
+void ftrace_jump(vaddr_t pc, vaddr_t target);
+void ftrace_report();
+
+// ----------- mtrace -----------
+
+void mtrace_access(paddr_t addr, int len, bool is_write);
+void mtrace_report();
+
 // ----------- log -----------
 
 #define ANSI_FG_BLACK   "\33[1;30m"
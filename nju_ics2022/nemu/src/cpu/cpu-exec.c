@@ -17,6 +17,9 @@
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
 #include <locale.h>
+#ifdef CONFIG_MULTI_HART
+#include <pthread.h>
+#endif
 
 /* The assembly code of instructions executed is only output to the screen
  * when the number of instructions executed is less than this value.
@@ -25,7 +28,19 @@
  */
 #define MAX_INST_TO_PRINT 10
 
+#ifdef CONFIG_MULTI_HART
+CPU_state harts[CONFIG_NR_HART] = {};
+__thread CPU_state *this_hart = &harts[0];
+// keep the counter of each hart in its own cache line,
+// they are summed up into `g_nr_guest_inst' after every cpu_exec()
+static struct {
+  uint64_t val;
+} __attribute__((aligned(64))) hart_nr_inst[CONFIG_NR_HART] = {};
+#define NR_INST (hart_nr_inst[hart_id()].val)
+#else
 CPU_state cpu = {};
+#define NR_INST g_nr_guest_inst
+#endif
 uint64_t g_nr_guest_inst = 0;
 static uint64_t g_timer = 0; // unit: us
 static bool g_print_step = false;
@@ -41,8 +56,12 @@ static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
   IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, dnpc));
 
 #ifdef CONFIG_CC_WATCHPOINT
-  if(check_wp_is_changed() && nemu_state.state == NEMU_RUNNING) {
-    nemu_state.state = NEMU_STOP;
+  // watchpoints are evaluated in the context of hart 0
+  if(hart_id() == 0 && check_wp_is_changed()) {
+    // only a running machine stops, not one another hart has just ended
+    int running = NEMU_RUNNING;
+    __atomic_compare_exchange_n(&nemu_state.state, &running, NEMU_STOP, false,
+        __ATOMIC_RELEASE, __ATOMIC_RELAXED);
   }
 #endif
 }
@@ -78,13 +97,86 @@ static void execute(uint64_t n) {
   Decode s;
   for (;n > 0; n --) {
     exec_once(&s, cpu.pc);
-    g_nr_guest_inst ++;
+    NR_INST ++;
     trace_and_difftest(&s, cpu.pc);
-    if (nemu_state.state != NEMU_RUNNING) break;
-    IFDEF(CONFIG_DEVICE, device_update());
+    if (nemu_state_get() != NEMU_RUNNING) break;
+    // devices are only updated by the host thread running hart 0
+    IFDEF(CONFIG_DEVICE, if (hart_id() == 0) device_update());
   }
 }
 
+#ifdef CONFIG_MULTI_HART
+#ifdef CONFIG_HART_SCHED_QUANTUM
+/* Harts run in turn on their own threads for CONFIG_HART_QUANTUM
+ * instructions, then pass the token to the next hart. The interleaving
+ * of harts is fixed, so that the execution is deterministic.
+ */
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sched_cond = PTHREAD_COND_INITIALIZER;
+static int sched_turn = 0;
+
+static void hart_execute(uint64_t n) {
+  int id = hart_id();
+  while (true) {
+    pthread_mutex_lock(&sched_lock);
+    while (sched_turn != id) pthread_cond_wait(&sched_cond, &sched_lock);
+    pthread_mutex_unlock(&sched_lock);
+
+    bool done = (n == 0 || nemu_state_get() != NEMU_RUNNING);
+    if (!done) {
+      uint64_t q = (n < CONFIG_HART_QUANTUM ? n : CONFIG_HART_QUANTUM);
+      execute(q);
+      n -= q;
+    }
+
+    pthread_mutex_lock(&sched_lock);
+    sched_turn = (id + 1) % CONFIG_NR_HART;
+    pthread_cond_broadcast(&sched_cond);
+    pthread_mutex_unlock(&sched_lock);
+    if (done) break;
+  }
+}
+#else
+/* Harts run freely in parallel on their own threads. */
+#define hart_execute execute
+#endif
+
+typedef struct {
+  CPU_state *hart;
+  uint64_t n;
+} HartArg;
+
+static void *hart_thread(void *arg) {
+  HartArg *a = arg;
+  this_hart = a->hart;
+  hart_execute(a->n);
+  return NULL;
+}
+
+static void execute_harts(uint64_t n) {
+  pthread_t tid[CONFIG_NR_HART];
+  HartArg arg[CONFIG_NR_HART];
+  int i;
+  IFDEF(CONFIG_HART_SCHED_QUANTUM, sched_turn = 0);
+  // hart 0 runs on the calling thread, since devices (SDL) should be
+  // polled on the main thread
+  for (i = 1; i < CONFIG_NR_HART; i ++) {
+    arg[i] = (HartArg) { .hart = &harts[i], .n = n };
+    int ret = pthread_create(&tid[i], NULL, hart_thread, &arg[i]);
+    Assert(ret == 0, "can not create thread for hart %d", i);
+  }
+  hart_execute(n);
+  for (i = 1; i < CONFIG_NR_HART; i ++) {
+    pthread_join(tid[i], NULL);
+  }
+
+  g_nr_guest_inst = 0;
+  for (i = 0; i < CONFIG_NR_HART; i ++) {
+    g_nr_guest_inst += hart_nr_inst[i].val;
+  }
+}
+#endif
+
 static void statistic() {
   IFNDEF(CONFIG_TARGET_AM, setlocale(LC_NUMERIC, ""));
 #define NUMBERIC_FMT MUXDEF(CONFIG_TARGET_AM, "%", "%'") PRIu64
@@ -92,6 +184,15 @@ static void statistic() {
   Log("total guest instructions = " NUMBERIC_FMT, g_nr_guest_inst);
   if (g_timer > 0) Log("simulation frequency = " NUMBERIC_FMT " inst/s", g_nr_guest_inst * 1000000 / g_timer);
   else Log("Finish running in less than 1 us and can not calculate the simulation frequency");
+  IFDEF(CONFIG_FTRACE_PROFILE, ftrace_report());
+  IFDEF(CONFIG_MTRACE, mtrace_report());
+#ifdef CONFIG_MULTI_HART
+  int i;
+  for (i = 0; i < CONFIG_NR_HART; i ++) {
+    Log("hart %d: guest instructions = " NUMBERIC_FMT ", pc = " FMT_WORD,
+        i, hart_nr_inst[i].val, harts[i].pc);
+  }
+#endif
 }
 
 void assert_fail_msg() {
@@ -102,26 +203,26 @@ void assert_fail_msg() {
 /* Simulate how the CPU works. */
 void cpu_exec(uint64_t n) {
   g_print_step = (n < MAX_INST_TO_PRINT);
-  switch (nemu_state.state) {
+  switch (nemu_state_get()) {
     case NEMU_END: case NEMU_ABORT:
       printf("Program execution has ended. To restart the program, exit NEMU and run again.\n");
       return;
-    default: nemu_state.state = NEMU_RUNNING;
+    default: nemu_state_set(NEMU_RUNNING);
   }
 
   uint64_t timer_start = get_time();
 
-  execute(n);
+  MUXDEF(CONFIG_MULTI_HART, execute_harts(n), execute(n));
 
   uint64_t timer_end = get_time();
   g_timer += timer_end - timer_start;
 
-  switch (nemu_state.state) {
-    case NEMU_RUNNING: nemu_state.state = NEMU_STOP; break;
+  switch (nemu_state_get()) {
+    case NEMU_RUNNING: nemu_state_set(NEMU_STOP); break;
 
     case NEMU_END: case NEMU_ABORT:
       Log("nemu: %s at pc = " FMT_WORD,
-          (nemu_state.state == NEMU_ABORT ? ANSI_FMT("ABORT", ANSI_FG_RED) :
+          (nemu_state_get() == NEMU_ABORT ? ANSI_FMT("ABORT", ANSI_FG_RED) :
            (nemu_state.halt_ret == 0 ? ANSI_FMT("HIT GOOD TRAP", ANSI_FG_GREEN) :
             ANSI_FMT("HIT BAD TRAP", ANSI_FG_RED))),
           nemu_state.halt_pc);
@@ -25,6 +25,9 @@ void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction) =
 void (*ref_difftest_regcpy)(void *dut, bool direction) = NULL;
 void (*ref_difftest_exec)(uint64_t n) = NULL;
 void (*ref_difftest_raise_intr)(uint64_t NO) = NULL;
+// optional, only provided by some REFs
+uint64_t (*ref_difftest_exec_until)(uint64_t pc, uint64_t max_n) = NULL;
+uint64_t (*ref_difftest_memhash)(paddr_t *pages, size_t *nr_page, bool clear) = NULL;
 
 #ifdef CONFIG_DIFFTEST
 
@@ -81,6 +84,14 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
   void (*ref_difftest_init)(int) = dlsym(handle, "difftest_init");
   assert(ref_difftest_init);
 
+  ref_difftest_exec_until = dlsym(handle, "difftest_exec_until");
+  ref_difftest_memhash = dlsym(handle, "difftest_memhash");
+#ifdef CONFIG_DIFFTEST_MEMCHECK
+  if (ref_difftest_memhash == NULL) {
+    Log("%s does not report written memory, memory will not be checked", ref_so_file);
+  }
+#endif
+
   Log("Differential testing: %s", ANSI_FMT("ON", ANSI_FG_GREEN));
   Log("The result of every instruction will be compared with %s. "
       "This will help you a lot for debugging, but also significantly reduce the performance. "
@@ -89,16 +100,62 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
   ref_difftest_init(port);
   ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
   ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+  if (ref_difftest_memhash != NULL) {
+    // the image is in sync now
+    size_t n = 0;
+    ref_difftest_memhash(NULL, &n, true);
+  }
 }
 
 static void checkregs(CPU_state *ref, vaddr_t pc) {
   if (!isa_difftest_checkregs(ref, pc)) {
-    nemu_state.state = NEMU_ABORT;
     nemu_state.halt_pc = pc;
+    nemu_state_set(NEMU_ABORT);
     isa_reg_display();
   }
 }
 
+#ifdef CONFIG_DIFFTEST_MEMCHECK
+#define MAX_DIRTY_PAGE 1024
+
+static void diffmem(paddr_t *pages, size_t n, vaddr_t pc) {
+  static uint8_t ref_page[DIFFTEST_PAGE_SIZE];
+  size_t i, j;
+  for (i = 0; i < n; i ++) {
+    uint8_t *dut_page = guest_to_host(pages[i]);
+    ref_difftest_memcpy(pages[i], ref_page, DIFFTEST_PAGE_SIZE, DIFFTEST_TO_DUT);
+    for (j = 0; j < DIFFTEST_PAGE_SIZE; j ++) {
+      if (ref_page[j] != dut_page[j]) {
+        Log("memory is different after executing instruction at pc = " FMT_WORD
+            ", addr = " FMT_PADDR ", right = 0x%02x, wrong = 0x%02x",
+            pc, pages[i] + (paddr_t)j, ref_page[j], dut_page[j]);
+        return;
+      }
+    }
+  }
+}
+
+// compare the pages written by REF since the last check
+static void checkmem(vaddr_t pc) {
+  static paddr_t pages[MAX_DIRTY_PAGE];
+  if (ref_difftest_memhash == NULL) return;
+  size_t n = MAX_DIRTY_PAGE, i;
+  uint64_t ref_hash = ref_difftest_memhash(pages, &n, true);
+  if (n == 0) return;
+  Assert(n <= MAX_DIRTY_PAGE, "too many pages (%zu) are written at pc = " FMT_WORD, n, pc);
+
+  uint64_t dut_hash = 0;
+  for (i = 0; i < n; i ++) {
+    dut_hash += difftest_page_hash(pages[i], (uint64_t *)guest_to_host(pages[i]));
+  }
+  if (dut_hash != ref_hash) {
+    diffmem(pages, n, pc);
+    nemu_state.halt_pc = pc;
+    nemu_state_set(NEMU_ABORT);
+  }
+}
+#endif
+
 void difftest_step(vaddr_t pc, vaddr_t npc) {
   CPU_state ref_r;
 
@@ -126,6 +183,7 @@ void difftest_step(vaddr_t pc, vaddr_t npc) {
   ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
 
   checkregs(&ref_r, pc);
+  IFDEF(CONFIG_DIFFTEST_MEMCHECK, checkmem(pc));
 }
 #else
 void init_difftest(char *ref_so_file, long img_size, int port) { }
@@ -16,6 +16,7 @@
 #include <common.h>
 #include <utils.h>
 #include <device/alarm.h>
+#include <device/map.h>
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 #endif
@@ -27,9 +28,31 @@ void init_vga();
 void init_i8042();
 void init_audio();
 void init_disk();
+void init_nic();
 void init_sdcard();
 void init_alarm();
 
+#ifndef CONFIG_HAS_NIC
+// Without the network card, its registers are still mapped and read 0, so
+// that the guest can probe the card by its `present' register.
+#define NIC_SPACE_SIZE (9 * sizeof(uint32_t)) // the registers of nic.c
+static uint8_t *nic_space = NULL;
+
+static void no_nic_io_handler(uint32_t offset, int len, bool is_write) {
+  if (is_write) memset(nic_space, 0, NIC_SPACE_SIZE);
+}
+
+static void init_no_nic() {
+  nic_space = new_space(NIC_SPACE_SIZE);
+  memset(nic_space, 0, NIC_SPACE_SIZE);
+#ifdef CONFIG_HAS_PORT_IO
+  add_pio_map ("nic", CONFIG_NIC_CTL_PORT, nic_space, NIC_SPACE_SIZE, no_nic_io_handler);
+#else
+  add_mmio_map("nic", CONFIG_NIC_CTL_MMIO, nic_space, NIC_SPACE_SIZE, no_nic_io_handler);
+#endif
+}
+#endif
+
 void send_key(uint8_t, bool);
 void vga_update_screen();
 
@@ -48,7 +71,7 @@ void device_update() {
   while (SDL_PollEvent(&event)) {
     switch (event.type) {
       case SDL_QUIT:
-        nemu_state.state = NEMU_QUIT;
+        nemu_state_set(NEMU_QUIT);
         break;
 #ifdef CONFIG_HAS_KEYBOARD
       // If a key was pressed
@@ -83,6 +106,8 @@ void init_device() {
   IFDEF(CONFIG_HAS_KEYBOARD, init_i8042());
   IFDEF(CONFIG_HAS_AUDIO, init_audio());
   IFDEF(CONFIG_HAS_DISK, init_disk());
+  IFDEF(CONFIG_HAS_NIC, init_nic());
+  IFNDEF(CONFIG_HAS_NIC, init_no_nic());
   IFDEF(CONFIG_HAS_SDCARD, init_sdcard());
 
   IFNDEF(CONFIG_TARGET_AM, init_alarm());
@@ -21,6 +21,7 @@ SRCS-$(CONFIG_HAS_KEYBOARD) += src/device/keyboard.c
 SRCS-$(CONFIG_HAS_VGA) += src/device/vga.c
 SRCS-$(CONFIG_HAS_AUDIO) += src/device/audio.c
 SRCS-$(CONFIG_HAS_DISK) += src/device/disk.c
+SRCS-$(CONFIG_HAS_NIC) += src/device/nic.c
 SRCS-$(CONFIG_HAS_SDCARD) += src/device/sdcard.c
 
 SRCS-BLACKLIST-$(CONFIG_TARGET_AM) += src/device/alarm.c
@@ -28,5 +29,7 @@ SRCS-BLACKLIST-$(CONFIG_TARGET_AM) += src/device/alarm.c
 ifdef CONFIG_DEVICE
 ifndef CONFIG_TARGET_AM
 LIBS += -lSDL2
+# the compositor of the 2D accelerator is shared with native AM
+INC_PATH += $(AM_HOME)/am/include
 endif
 endif
@@ -0,0 +1,229 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <device/map.h>
+#include <memory/paddr.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+// The NIC moves packets between guest memory and the host by DMA. The guest
+// owns two rings of descriptors in its memory, and the indices of the rings
+// are free-running counters, so that `tail - head' is the number of pending
+// descriptors. Writing a tail register is a doorbell, which lets the device
+// process all descriptors posted since the last one at once.
+//  - TX: the guest posts packets, the device sends them and advances tx_head.
+//  - RX: the guest posts empty buffers with their capacity in `len', the
+//        device fills them, sets `len' to the packet size and advances rx_head.
+//
+// The packets go to a peer NEMU (or native AM) through a SOCK_SEQPACKET Unix
+// socket at CONFIG_NIC_SOCKET_PATH. The first instance listens on the path
+// and the second one connects to it. Without a path, the packets sent are
+// looped back to the receiver.
+
+enum {
+  reg_tx_base,   // guest physical addresses of the rings
+  reg_rx_base,
+  reg_ring_size, // number of descriptors of each ring, a power of 2
+  reg_tx_head,   // read only
+  reg_tx_tail,   // doorbell
+  reg_rx_head,   // read only
+  reg_rx_tail,   // doorbell
+  reg_drop,      // number of packets dropped, read only
+  reg_present,   // 1, read only, and 0 without the card, see device.c
+  nr_reg
+};
+
+typedef struct {
+  uint32_t addr, len;
+} NICDesc;
+
+#define LOOPBACK_NR_PKT 64
+
+static uint32_t *nic_base = NULL;
+static bool is_loopback = true;
+static int listen_fd = -1, peer_fd = -1;
+
+// packets looped back while no RX buffer is posted
+static struct { void *data; uint32_t len; } loopback[LOOPBACK_NR_PKT];
+static uint32_t loopback_head = 0, loopback_tail = 0;
+
+// The registers the device owns, which are copied to the ones seen by the
+// guest after each access, so that the guest can not write them.
+static uint32_t tx_head = 0, rx_head = 0, nr_drop = 0;
+
+static NICDesc *desc(uint32_t base, uint32_t idx) {
+  paddr_t addr = base + (idx & (nic_base[reg_ring_size] - 1)) * sizeof(NICDesc);
+  Assert(in_pmem(addr) && in_pmem(addr + sizeof(NICDesc) - 1),
+      "NIC: descriptor at " FMT_PADDR " is out of the memory", addr);
+  return (NICDesc *)guest_to_host(addr);
+}
+
+static uint8_t *dma_ptr(uint32_t addr, uint32_t len) {
+  Assert(len == 0 || (in_pmem(addr) && in_pmem(addr + len - 1)),
+      "NIC: buffer [%#x, +%#x) is out of the memory", addr, len);
+  return guest_to_host(addr);
+}
+
+// take the next posted RX buffer, or return NULL if there is none
+static NICDesc *rx_desc() {
+  if (rx_head == nic_base[reg_rx_tail]) return NULL;
+  return desc(nic_base[reg_rx_base], rx_head);
+}
+
+static void rx_done(NICDesc *d, uint32_t len) {
+  d->len = len;
+  rx_head ++;
+}
+
+static void backend_poll() {
+  NICDesc *d;
+  if (is_loopback) {
+    while (loopback_head != loopback_tail && (d = rx_desc()) != NULL) {
+      typeof(loopback[0]) *p = &loopback[loopback_head % LOOPBACK_NR_PKT];
+      uint32_t len = (p->len < d->len ? p->len : d->len);
+      memcpy(dma_ptr(d->addr, len), p->data, len);
+      rx_done(d, len);
+      free(p->data);
+      loopback_head ++;
+    }
+    return;
+  }
+
+  if (peer_fd < 0) {
+    if (listen_fd < 0) return; // the listener has gone
+    peer_fd = accept(listen_fd, NULL, NULL);
+    if (peer_fd < 0) return;
+    fcntl(peer_fd, F_SETFL, O_NONBLOCK);
+    Log("NIC: peer connected");
+  }
+  // receive into the guest buffers directly
+  while ((d = rx_desc()) != NULL) {
+    ssize_t n = recv(peer_fd, dma_ptr(d->addr, d->len), d->len, MSG_TRUNC);
+    if (n < 0) break; // EAGAIN
+    if (n == 0) {
+      Log("NIC: peer disconnected");
+      close(peer_fd);
+      peer_fd = -1;
+      break;
+    }
+    rx_done(d, (n < d->len ? n : d->len));
+  }
+}
+
+static void backend_send(const void *data, uint32_t len) {
+  if (is_loopback) {
+    NICDesc *d;
+    if (loopback_head == loopback_tail && (d = rx_desc()) != NULL) {
+      // fast path: copy to the posted buffer at once
+      if (len > d->len) len = d->len;
+      memcpy(dma_ptr(d->addr, len), data, len);
+      rx_done(d, len);
+    } else if (loopback_tail - loopback_head < LOOPBACK_NR_PKT) {
+      typeof(loopback[0]) *p = &loopback[loopback_tail % LOOPBACK_NR_PKT];
+      p->data = malloc(len);
+      assert(p->data != NULL);
+      memcpy(p->data, data, len);
+      p->len = len;
+      loopback_tail ++;
+    } else {
+      nr_drop ++;
+    }
+    return;
+  }
+
+  if (peer_fd < 0 || send(peer_fd, data, len, MSG_NOSIGNAL) != len) {
+    nr_drop ++; // no peer or the peer is too slow, like a lost packet
+  }
+}
+
+static void tx_process() {
+  while (tx_head != nic_base[reg_tx_tail]) {
+    NICDesc *d = desc(nic_base[reg_tx_base], tx_head);
+    backend_send(dma_ptr(d->addr, d->len), d->len);
+    tx_head ++;
+  }
+}
+
+static void nic_io_access(uint32_t offset, bool is_write) {
+  uint32_t size = nic_base[reg_ring_size];
+  if (is_write) {
+    if (offset == reg_ring_size * sizeof(uint32_t)) {
+      Assert(size != 0 && (size & (size - 1)) == 0, "NIC: ring size %d is not a power of 2", size);
+      return;
+    }
+    if (offset == reg_tx_tail * sizeof(uint32_t)) {
+      Assert(nic_base[reg_tx_tail] - tx_head <= size, "NIC: TX ring overflow");
+      tx_process();
+    } else if (offset == reg_rx_tail * sizeof(uint32_t)) {
+      Assert(nic_base[reg_rx_tail] - rx_head <= size, "NIC: RX ring overflow");
+    } else {
+      return;
+    }
+  } else if (offset != reg_rx_head * sizeof(uint32_t)) {
+    return;
+  }
+  // check the backend at doorbells and when the guest polls rx_head
+  if (size != 0) backend_poll();
+}
+
+static void nic_io_handler(uint32_t offset, int len, bool is_write) {
+  nic_io_access(offset, is_write);
+  // this also undoes the writes of the guest to the read only registers
+  nic_base[reg_tx_head] = tx_head;
+  nic_base[reg_rx_head] = rx_head;
+  nic_base[reg_drop] = nr_drop;
+  nic_base[reg_present] = 1;
+}
+
+static void init_backend(const char *path) {
+  if (path[0] == '\0') return;
+  is_loopback = false;
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  Assert(strlen(path) < sizeof(addr.sun_path), "NIC: socket path %s is too long", path);
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0);
+  assert(fd >= 0);
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+    peer_fd = fd;
+    Log("NIC: connected to %s", path);
+    return;
+  }
+  // no one is listening, be the first one
+  unlink(path);
+  int ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+  Assert(ret == 0, "NIC: can not bind %s: %s", path, strerror(errno));
+  ret = listen(fd, 1);
+  assert(ret == 0);
+  listen_fd = fd;
+  Log("NIC: waiting for the peer at %s", path);
+}
+
+void init_nic() {
+  uint32_t space_size = sizeof(uint32_t) * nr_reg;
+  nic_base = (uint32_t *)new_space(space_size);
+  memset(nic_base, 0, space_size);
+  nic_base[reg_present] = 1;
+#ifdef CONFIG_HAS_PORT_IO
+  add_pio_map ("nic", CONFIG_NIC_CTL_PORT, nic_base, space_size, nic_io_handler);
+#else
+  add_mmio_map("nic", CONFIG_NIC_CTL_MMIO, nic_base, space_size, nic_io_handler);
+#endif
+  init_backend(CONFIG_NIC_SOCKET_PATH);
+}
@@ -30,7 +30,7 @@ static void rtc_io_handler(uint32_t offset, int len, bool is_write) {
 
 #ifndef CONFIG_TARGET_AM
 static void timer_intr() {
-  if (nemu_state.state == NEMU_RUNNING) {
+  if (nemu_state_get() == NEMU_RUNNING) {
     extern void dev_raise_intr();
     dev_raise_intr();
   }
@@ -15,6 +15,10 @@
 
 #include <common.h>
 #include <device/map.h>
+#include <memory/paddr.h>
+#ifdef CONFIG_VGA_ACCEL
+#include <gpu-render.h>
+#endif
 
 #define SCREEN_W (MUXDEF(CONFIG_VGA_SIZE_800x600, 800, 400))
 #define SCREEN_H (MUXDEF(CONFIG_VGA_SIZE_800x600, 600, 300))
@@ -31,6 +35,17 @@ static uint32_t screen_size() {
   return screen_width() * screen_height() * sizeof(uint32_t);
 }
 
+enum {
+  reg_size,   // (width << 16) | height
+  reg_sync,
+  reg_vmemsz, // size of the video memory of the accelerator, 0 if absent
+  reg_cmd,    // writing a command starts it with the arguments below
+  reg_arg0,
+  reg_arg1,
+  reg_arg2,
+  nr_reg
+};
+
 static void *vmem = NULL;
 static uint32_t *vgactl_port_base = NULL;
 
@@ -70,19 +85,71 @@ static inline void update_screen() {
 #endif
 #endif
 
+#ifdef CONFIG_VGA_ACCEL
+// The 2D accelerator composites a tree of canvases in its video memory into
+// the frame buffer, see amgpu.h of AM. The video memory is not mapped
+// to the guest, and it is filled by DMA. The commands with bad arguments
+// from the guest are ignored.
+enum { GPU_CMD_MEMCPY = 1, GPU_CMD_RENDER = 2 };
+
+static GPURender gpu;
+
+static void gpu_cmd_memcpy(uint32_t dest, paddr_t src, uint32_t size) {
+  if (size == 0) return;
+  void *p = gpu_vmem_ptr(&gpu, dest, size);
+  if (p == NULL || !in_pmem(src) || !in_pmem(src + size - 1) || src + size - 1 < src) {
+    Log("GPU: ignore the DMA of %#x bytes from " FMT_PADDR " to %#x", size, src, dest);
+    return;
+  }
+  memcpy(p, guest_to_host(src), size);
+}
+
+static void gpu_cmd_render(uint32_t root) {
+  if (!gpu_render(&gpu, root, vmem, screen_width(), screen_height())) {
+    Log("GPU: ignore the malformed render tree at %#x", root);
+  }
+  vgactl_port_base[reg_sync] = 1;
+}
+
+static void vgactl_io_handler(uint32_t offset, int len, bool is_write) {
+  if (!is_write || offset != reg_cmd * sizeof(uint32_t)) return;
+  uint32_t *arg = &vgactl_port_base[reg_arg0];
+  switch (vgactl_port_base[reg_cmd]) {
+    case GPU_CMD_MEMCPY: gpu_cmd_memcpy(arg[0], arg[1], arg[2]); break;
+    case GPU_CMD_RENDER: gpu_cmd_render(arg[0]); break;
+    default: Log("GPU: ignore the invalid command %d", vgactl_port_base[reg_cmd]);
+  }
+}
+
+static void init_gpu() {
+  gpu.vmem = malloc(CONFIG_VGA_VMEM_SIZE);
+  gpu.vmemsz = CONFIG_VGA_VMEM_SIZE;
+  gpu.scratch = malloc(CONFIG_VGA_VMEM_SIZE);
+  gpu.scratch_end = gpu.scratch + CONFIG_VGA_VMEM_SIZE;
+  assert(gpu.vmem != NULL && gpu.scratch != NULL);
+  vgactl_port_base[reg_vmemsz] = CONFIG_VGA_VMEM_SIZE;
+}
+#endif
+
 void vga_update_screen() {
-  // TODO: call `update_screen()` when the sync register is non-zero,
-  // then zero out the sync register
+  if (vgactl_port_base[reg_sync] != 0) {
+    IFDEF(CONFIG_VGA_SHOW_SCREEN, update_screen());
+    vgactl_port_base[reg_sync] = 0;
+  }
 }
 
 void init_vga() {
-  vgactl_port_base = (uint32_t *)new_space(8);
-  vgactl_port_base[0] = (screen_width() << 16) | screen_height();
+  uint32_t space_size = sizeof(uint32_t) * nr_reg;
+  io_callback_t handler = MUXDEF(CONFIG_VGA_ACCEL, vgactl_io_handler, NULL);
+  vgactl_port_base = (uint32_t *)new_space(space_size);
+  memset(vgactl_port_base, 0, space_size);
+  vgactl_port_base[reg_size] = (screen_width() << 16) | screen_height();
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 8, NULL);
+  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, space_size, handler);
 #else
-  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8, NULL);
+  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, space_size, handler);
 #endif
+  IFDEF(CONFIG_VGA_ACCEL, init_gpu());
 
   vmem = new_space(screen_size());
   add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
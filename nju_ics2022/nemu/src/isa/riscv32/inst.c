@@ -21,9 +21,10 @@
 #define R(i) gpr(i)
 #define Mr vaddr_read
 #define Mw vaddr_write
+#define Ma vaddr_amo
 
 enum {
-  TYPE_I, TYPE_U, TYPE_S,
+  TYPE_I, TYPE_U, TYPE_S, TYPE_R, TYPE_J,
   TYPE_N, // none
 };
 
@@ -32,6 +33,8 @@ enum {
 #define immI() do { *imm = SEXT(BITS(i, 31, 20), 12); } while(0)
 #define immU() do { *imm = SEXT(BITS(i, 31, 12), 20) << 12; } while(0)
 #define immS() do { *imm = (SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7); } while(0)
+#define immJ() do { *imm = SEXT((BITS(i, 31, 31) << 20) | (BITS(i, 19, 12) << 12) | \
+    (BITS(i, 20, 20) << 11) | (BITS(i, 30, 21) << 1), 21); } while(0)
 
 static void decode_operand(Decode *s, int *dest, word_t *src1, word_t *src2, word_t *imm, int type) {
   uint32_t i = s->isa.inst.val;
@@ -43,9 +46,44 @@ static void decode_operand(Decode *s, int *dest, word_t *src1, word_t *src2, wor
     case TYPE_I: src1R();          immI(); break;
     case TYPE_U:                   immU(); break;
     case TYPE_S: src1R(); src2R(); immS(); break;
+    case TYPE_R: src1R(); src2R();         break;
+    case TYPE_J:                   immJ(); break;
   }
 }
 
+// x1 and x5 are link registers, see the return-address stack hints in the spec
+#define is_link(r) ((r) == 1 || (r) == 5)
+
+static void jump(Decode *s, int rd, int rs1, vaddr_t target) {
+  s->dnpc = target;
+#ifdef CONFIG_FTRACE
+  if (is_link(rd)) {
+    if (is_link(rs1) && rs1 != rd) ftrace_ret(s->pc, target); // coroutine
+    ftrace_call(s->pc, target);
+  }
+  else if (is_link(rs1)) ftrace_ret(s->pc, target);
+  else ftrace_jump(s->pc, target);
+#endif
+}
+
+static word_t lr(vaddr_t addr, int len) {
+  word_t val = Mr(addr, len);
+  cpu.resv.addr = addr;
+  cpu.resv.val = val;
+  cpu.resv.valid = true;
+  return val;
+}
+
+// Instead of tracking stores from other harts, SC succeeds only if the memory
+// still holds the value loaded by LR, and updates it with a host CAS.
+// This keeps LR/SC atomic when harts run on different host threads.
+static word_t sc(vaddr_t addr, int len, word_t data) {
+  bool ok = cpu.resv.valid && cpu.resv.addr == addr &&
+    vaddr_cas(addr, len, cpu.resv.val, data);
+  cpu.resv.valid = false;
+  return !ok;
+}
+
 static int decode_exec(Decode *s) {
   int dest = 0;
   word_t src1 = 0, src2 = 0, imm = 0;
@@ -59,9 +97,24 @@ static int decode_exec(Decode *s) {
 
   INSTPAT_START();
   INSTPAT("??????? ????? ????? ??? ????? 01101 11", lui    , U, R(dest) = imm);
+  INSTPAT("??????? ????? ????? ??? ????? 11011 11", jal    , J, R(dest) = s->snpc; jump(s, dest, 0, s->pc + imm));
+  INSTPAT("??????? ????? ????? 000 ????? 11001 11", jalr   , I, R(dest) = s->snpc;
+      jump(s, dest, BITS(s->isa.inst.val, 19, 15), (src1 + imm) & ~(word_t)1));
   INSTPAT("??????? ????? ????? 010 ????? 00000 11", lw     , I, R(dest) = Mr(src1 + imm, 4));
   INSTPAT("??????? ????? ????? 010 ????? 01000 11", sw     , S, Mw(src1 + imm, 4, src2));
 
+  INSTPAT("00010 ?? 00000 ????? 010 ????? 01011 11", lr.w     , R, R(dest) = lr(src1, 4));
+  INSTPAT("00011 ?? ????? ????? 010 ????? 01011 11", sc.w     , R, R(dest) = sc(src1, 4, src2));
+  INSTPAT("00001 ?? ????? ????? 010 ????? 01011 11", amoswap.w, R, R(dest) = Ma(src1, 4, AMO_SWAP, src2));
+  INSTPAT("00000 ?? ????? ????? 010 ????? 01011 11", amoadd.w , R, R(dest) = Ma(src1, 4, AMO_ADD , src2));
+  INSTPAT("00100 ?? ????? ????? 010 ????? 01011 11", amoxor.w , R, R(dest) = Ma(src1, 4, AMO_XOR , src2));
+  INSTPAT("01100 ?? ????? ????? 010 ????? 01011 11", amoand.w , R, R(dest) = Ma(src1, 4, AMO_AND , src2));
+  INSTPAT("01000 ?? ????? ????? 010 ????? 01011 11", amoor.w  , R, R(dest) = Ma(src1, 4, AMO_OR  , src2));
+  INSTPAT("10000 ?? ????? ????? 010 ????? 01011 11", amomin.w , R, R(dest) = Ma(src1, 4, AMO_MIN , src2));
+  INSTPAT("10100 ?? ????? ????? 010 ????? 01011 11", amomax.w , R, R(dest) = Ma(src1, 4, AMO_MAX , src2));
+  INSTPAT("11000 ?? ????? ????? 010 ????? 01011 11", amominu.w, R, R(dest) = Ma(src1, 4, AMO_MINU, src2));
+  INSTPAT("11100 ?? ????? ????? 010 ????? 01011 11", amomaxu.w, R, R(dest) = Ma(src1, 4, AMO_MAXU, src2));
+
   INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, NEMUTRAP(s->pc, R(10))); // R(10) is $a0
   INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv    , N, INV(s->pc));
   INSTPAT_END();
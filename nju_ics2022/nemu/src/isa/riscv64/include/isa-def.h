@@ -21,6 +21,13 @@
 typedef struct {
   word_t gpr[32];
   vaddr_t pc;
+
+  // reservation set of LR/SC, not part of the difftest registers
+  struct {
+    vaddr_t addr;
+    word_t val;
+    bool valid;
+  } resv;
 } riscv64_CPU_state;
 
 // decode
@@ -32,6 +32,13 @@ static void restart() {
 
   /* The zero register is always 0. */
   cpu.gpr[0] = 0;
+
+#ifdef CONFIG_MULTI_HART
+  /* Like SBI firmware does, pass the hart ID in $a0 and
+   * the number of harts in $a1. All harts start at the reset vector. */
+  cpu.gpr[10] = hart_id();
+  cpu.gpr[11] = CONFIG_NR_HART;
+#endif
 }
 
 void init_isa() {
@@ -39,5 +46,14 @@ void init_isa() {
   memcpy(guest_to_host(RESET_VECTOR), img, sizeof(img));
 
   /* Initialize this virtual computer system. */
+#ifdef CONFIG_MULTI_HART
+  CPU_state *boot_hart = this_hart;
+  for (int i = 0; i < CONFIG_NR_HART; i ++) {
+    this_hart = &harts[i];
+    restart();
+  }
+  this_hart = boot_hart;
+#else
   restart();
+#endif
 }
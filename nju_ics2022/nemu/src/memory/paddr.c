@@ -17,6 +17,15 @@
 #include <memory/paddr.h>
 #include <device/mmio.h>
 #include <isa.h>
+#ifdef CONFIG_MULTI_HART
+#include <pthread.h>
+
+// device models are not thread-safe, serialize MMIO accesses from all harts
+static pthread_mutex_t mmio_lock = PTHREAD_MUTEX_INITIALIZER;
+#define MMIO_LOCKED(stmt) do { pthread_mutex_lock(&mmio_lock); stmt; pthread_mutex_unlock(&mmio_lock); } while (0)
+#else
+#define MMIO_LOCKED(stmt) do { stmt; } while (0)
+#endif
 
 #if   defined(CONFIG_PMEM_MALLOC)
 static uint8_t *pmem = NULL;
@@ -36,6 +45,54 @@ static void pmem_write(paddr_t addr, int len, word_t data) {
   host_write(guest_to_host(addr), len, data);
 }
 
+#define def_pmem_amo(bits) \
+static uint##bits##_t concat(pmem_amo, bits)(uint##bits##_t *p, int op, uint##bits##_t data) { \
+  switch (op) { \
+    case AMO_SWAP: return __atomic_exchange_n(p, data, __ATOMIC_SEQ_CST); \
+    case AMO_ADD:  return __atomic_fetch_add(p, data, __ATOMIC_SEQ_CST); \
+    case AMO_XOR:  return __atomic_fetch_xor(p, data, __ATOMIC_SEQ_CST); \
+    case AMO_AND:  return __atomic_fetch_and(p, data, __ATOMIC_SEQ_CST); \
+    case AMO_OR:   return __atomic_fetch_or (p, data, __ATOMIC_SEQ_CST); \
+  } \
+  /* there are no host instructions for min/max, retry with CAS */ \
+  uint##bits##_t old = __atomic_load_n(p, __ATOMIC_RELAXED), new; \
+  do { \
+    switch (op) { \
+      case AMO_MIN:  new = ((int##bits##_t)old < (int##bits##_t)data ? old : data); break; \
+      case AMO_MAX:  new = ((int##bits##_t)old > (int##bits##_t)data ? old : data); break; \
+      case AMO_MINU: new = (old < data ? old : data); break; \
+      case AMO_MAXU: new = (old > data ? old : data); break; \
+      default: panic("bad AMO operation %d", op); \
+    } \
+  } while (!__atomic_compare_exchange_n(p, &old, new, true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)); \
+  return old; \
+}
+
+def_pmem_amo(32)
+IFDEF(CONFIG_ISA64, def_pmem_amo(64))
+
+static word_t pmem_amo(paddr_t addr, int len, int op, word_t data) {
+  void *p = guest_to_host(addr);
+  switch (len) {
+    case 4: return pmem_amo32(p, op, data);
+    IFDEF(CONFIG_ISA64, case 8: return pmem_amo64(p, op, data));
+    default: panic("bad AMO length %d", len);
+  }
+}
+
+static bool pmem_cas(paddr_t addr, int len, word_t expected, word_t data) {
+  void *p = guest_to_host(addr);
+  switch (len) {
+    case 4: { uint32_t e = expected;
+      return __atomic_compare_exchange_n((uint32_t *)p, &e, data, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED); }
+#ifdef CONFIG_ISA64
+    case 8: { uint64_t e = expected;
+      return __atomic_compare_exchange_n((uint64_t *)p, &e, data, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED); }
+#endif
+    default: panic("bad CAS length %d", len);
+  }
+}
+
 static void out_of_bound(paddr_t addr) {
   panic("address = " FMT_PADDR " is out of bound of pmem [" FMT_PADDR ", " FMT_PADDR "] at pc = " FMT_WORD,
       addr, PMEM_LEFT, PMEM_RIGHT, cpu.pc);
@@ -56,15 +113,41 @@ void init_mem() {
   Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", PMEM_LEFT, PMEM_RIGHT);
 }
 
+word_t paddr_ifetch(paddr_t addr, int len) {
+  if (likely(in_pmem(addr))) return pmem_read(addr, len);
+  out_of_bound(addr);
+  return 0;
+}
+
 word_t paddr_read(paddr_t addr, int len) {
+  IFDEF(CONFIG_MTRACE, mtrace_access(addr, len, false));
   if (likely(in_pmem(addr))) return pmem_read(addr, len);
-  IFDEF(CONFIG_DEVICE, return mmio_read(addr, len));
+#ifdef CONFIG_DEVICE
+  word_t ret;
+  MMIO_LOCKED(ret = mmio_read(addr, len));
+  return ret;
+#endif
   out_of_bound(addr);
   return 0;
 }
 
 void paddr_write(paddr_t addr, int len, word_t data) {
+  IFDEF(CONFIG_MTRACE, mtrace_access(addr, len, true));
   if (likely(in_pmem(addr))) { pmem_write(addr, len, data); return; }
-  IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
+  IFDEF(CONFIG_DEVICE, MMIO_LOCKED(mmio_write(addr, len, data)); return);
   out_of_bound(addr);
 }
+
+word_t paddr_amo(paddr_t addr, int len, int op, word_t data) {
+  IFDEF(CONFIG_MTRACE, mtrace_access(addr, len, true));
+  if (likely(in_pmem(addr))) return pmem_amo(addr, len, op, data);
+  panic("AMO at address = " FMT_PADDR " is not supported outside pmem at pc = " FMT_WORD, addr, cpu.pc);
+  return 0;
+}
+
+bool paddr_cas(paddr_t addr, int len, word_t expected, word_t data) {
+  IFDEF(CONFIG_MTRACE, mtrace_access(addr, len, true));
+  if (likely(in_pmem(addr))) return pmem_cas(addr, len, expected, data);
+  panic("SC at address = " FMT_PADDR " is not supported outside pmem at pc = " FMT_WORD, addr, cpu.pc);
+  return false;
+}
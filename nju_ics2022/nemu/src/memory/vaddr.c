@@ -17,7 +17,7 @@
 #include <memory/paddr.h>
 
 word_t vaddr_ifetch(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  return paddr_ifetch(addr, len);
 }
 
 word_t vaddr_read(vaddr_t addr, int len) {
@@ -27,3 +27,11 @@ word_t vaddr_read(vaddr_t addr, int len) {
 void vaddr_write(vaddr_t addr, int len, word_t data) {
   paddr_write(addr, len, data);
 }
+
+word_t vaddr_amo(vaddr_t addr, int len, int op, word_t data) {
+  return paddr_amo(addr, len, op, data);
+}
+
+bool vaddr_cas(vaddr_t addr, int len, word_t expected, word_t data) {
+  return paddr_cas(addr, len, expected, data);
+}
@@ -57,7 +57,7 @@ static int cmd_c(char *args) {
 
 
 static int cmd_q(char *args) {
-  nemu_state.state = NEMU_QUIT;
+  nemu_state_set(NEMU_QUIT);
   return -1;
 }
 
@@ -18,3 +18,11 @@ CXXSRC = src/utils/disasm.cc
 CXXFLAGS += $(shell llvm-config-11 --cxxflags) -fPIE
 LIBS += $(shell llvm-config-11 --libs)
 endif
+
+ifndef CONFIG_FTRACE
+SRCS-BLACKLIST-y += src/utils/ftrace.c
+endif
+
+ifndef CONFIG_MTRACE
+SRCS-BLACKLIST-y += src/utils/mtrace.c
+endif
@@ -0,0 +1,309 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <elf.h>
+
+extern uint64_t g_nr_guest_inst;
+
+typedef struct {
+  vaddr_t addr;
+  word_t size;
+  vaddr_t sec_end; // end of the section of the function
+  const char *name;
+  // profile
+  uint64_t calls, inclusive, exclusive;
+  int active; // number of frames of this function on the call stack
+} Func;
+
+typedef struct {
+  int func;
+  uint64_t entry; // instruction count when the function is entered
+  uint64_t child; // instructions spent in callees
+} Frame;
+
+typedef struct {
+  uint64_t key; // (caller + 1) << 32 | (callee + 1), 0 for empty slots
+  uint64_t count;
+} Edge;
+
+static uint8_t *elf_buf = NULL;
+static Func *funcs = NULL;
+static int nr_func = 0;
+
+static Frame *stack = NULL;
+static int depth = 0, stack_cap = 0;
+
+static Edge *edges = NULL;
+static int nr_edge = 0, edge_cap = 0;
+
+// the instruction being traced is regarded as executed
+#define NOW (g_nr_guest_inst + 1)
+
+// ----------- symbol table -----------
+
+static void add_func(const char *name, vaddr_t addr, word_t size, vaddr_t sec_end) {
+  static int cap = 0;
+  if (nr_func == cap) {
+    cap = (cap == 0 ? 256 : cap * 2);
+    funcs = realloc(funcs, sizeof(Func) * cap);
+    assert(funcs);
+  }
+  if (sec_end < addr) sec_end = addr + size; // no section or a bad one
+  funcs[nr_func ++] = (Func) { .addr = addr, .size = size, .sec_end = sec_end, .name = name };
+}
+
+#define def_load_symtab(bits) \
+static void concat(load_symtab, bits)(size_t size) { \
+  Elf##bits##_Ehdr *eh = (void *)elf_buf; \
+  Assert(eh->e_shoff + (size_t)eh->e_shnum * sizeof(Elf##bits##_Shdr) <= size, "bad section headers"); \
+  Elf##bits##_Shdr *sh = (void *)(elf_buf + eh->e_shoff); \
+  int i, j; \
+  for (i = 0; i < eh->e_shnum; i ++) { \
+    if (sh[i].sh_type != SHT_SYMTAB) continue; \
+    Assert(sh[i].sh_link < eh->e_shnum, "bad string table index"); \
+    Elf##bits##_Shdr *str = &sh[sh[i].sh_link]; \
+    Assert(sh[i].sh_offset + sh[i].sh_size <= size && \
+        str->sh_offset + str->sh_size <= size, "bad symbol table"); \
+    Elf##bits##_Sym *sym = (void *)(elf_buf + sh[i].sh_offset); \
+    int nr_sym = sh[i].sh_size / sizeof(sym[0]); \
+    for (j = 0; j < nr_sym; j ++) { \
+      if (ELF##bits##_ST_TYPE(sym[j].st_info) != STT_FUNC) continue; \
+      if (sym[j].st_name >= str->sh_size) continue; \
+      int shndx = sym[j].st_shndx; \
+      bool in_sec = shndx != SHN_UNDEF && shndx < eh->e_shnum; \
+      add_func((char *)elf_buf + str->sh_offset + sym[j].st_name, sym[j].st_value, sym[j].st_size, \
+          in_sec ? sh[shndx].sh_addr + sh[shndx].sh_size : 0); \
+    } \
+  } \
+}
+
+def_load_symtab(32)
+def_load_symtab(64)
+
+static int func_cmp(const void *a, const void *b) {
+  const Func *fa = a, *fb = b;
+  if (fa->addr != fb->addr) return fa->addr < fb->addr ? -1 : 1;
+  // keep the symbol with a size among aliases
+  return (fa->size < fb->size) - (fa->size > fb->size);
+}
+
+// sort the functions by address and make them disjoint intervals
+static void build_index() {
+  qsort(funcs, nr_func, sizeof(Func), func_cmp);
+  int i, n = 0;
+  for (i = 0; i < nr_func; i ++) {
+    if (n > 0 && funcs[n - 1].addr == funcs[i].addr) continue; // alias
+    funcs[n ++] = funcs[i];
+  }
+  nr_func = n;
+  for (i = 0; i < nr_func; i ++) {
+    // symbols from assembly code usually come without size, let them
+    // extend to the next function or to the end of their section
+    vaddr_t end = funcs[i].sec_end;
+    if (i + 1 < nr_func && funcs[i + 1].addr < end) end = funcs[i + 1].addr;
+    word_t gap = end - funcs[i].addr;
+    if (funcs[i].size == 0 || funcs[i].size > gap) funcs[i].size = gap;
+  }
+}
+
+// binary search for the function containing `pc', -1 if not found
+static int lookup(vaddr_t pc) {
+  int l = 0, r = nr_func - 1, ret = -1;
+  while (l <= r) {
+    int mid = l + (r - l) / 2;
+    if (funcs[mid].addr <= pc) { ret = mid; l = mid + 1; }
+    else r = mid - 1;
+  }
+  if (ret >= 0 && pc - funcs[ret].addr >= funcs[ret].size) ret = -1;
+  return ret;
+}
+
+static void push(int f);
+
+static const char *func_name(int f) {
+  return f >= 0 ? funcs[f].name : "???";
+}
+
+void init_ftrace(const char *elf_file) {
+  if (elf_file == NULL) {
+    Log("No ELF file is given, function tracer is disabled");
+    return;
+  }
+
+  FILE *fp = fopen(elf_file, "rb");
+  Assert(fp, "Can not open '%s'", elf_file);
+  fseek(fp, 0, SEEK_END);
+  size_t size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  elf_buf = malloc(size);
+  assert(elf_buf);
+  int ret = fread(elf_buf, size, 1, fp);
+  assert(ret == 1);
+  fclose(fp);
+
+  Assert(size >= EI_NIDENT && memcmp(elf_buf, ELFMAG, SELFMAG) == 0, "'%s' is not an ELF file", elf_file);
+  switch (elf_buf[EI_CLASS]) {
+    case ELFCLASS32: load_symtab32(size); break;
+    case ELFCLASS64: load_symtab64(size); break;
+    default: panic("bad ELF class %d", elf_buf[EI_CLASS]);
+  }
+  build_index();
+
+  // the function where the guest starts
+  push(lookup(cpu.pc));
+  stack[0].entry = 0;
+  Log("Function tracer: %d functions are loaded from %s", nr_func, elf_file);
+}
+
+// ----------- call stack -----------
+
+static void edge_insert(int caller, int callee);
+
+static void push(int f) {
+  if (depth == stack_cap) {
+    stack_cap = (stack_cap == 0 ? 256 : stack_cap * 2);
+    stack = realloc(stack, sizeof(Frame) * stack_cap);
+    assert(stack);
+  }
+  if (f >= 0) {
+    funcs[f].calls ++;
+    funcs[f].active ++;
+  }
+  if (depth > 0) edge_insert(stack[depth - 1].func, f);
+  stack[depth ++] = (Frame) { .func = f, .entry = NOW, .child = 0 };
+}
+
+static void pop(uint64_t now) {
+  Frame *fr = &stack[-- depth];
+  uint64_t inclusive = now - fr->entry;
+  if (fr->func >= 0) {
+    Func *f = &funcs[fr->func];
+    f->active --;
+    // only the outermost frame of a recursive function counts
+    if (f->active == 0) f->inclusive += inclusive;
+    f->exclusive += inclusive - fr->child;
+  }
+  if (depth > 0) stack[depth - 1].child += inclusive;
+}
+
+static int edge_slot(uint64_t key) {
+  return (key * 0x9e3779b97f4a7c15ull) >> 40 & (edge_cap - 1);
+}
+
+static void edge_insert(int caller, int callee) {
+  if (nr_edge * 2 >= edge_cap) {
+    Edge *old = edges;
+    int old_cap = edge_cap, i;
+    edge_cap = (edge_cap == 0 ? 1024 : edge_cap * 2);
+    edges = calloc(edge_cap, sizeof(Edge));
+    assert(edges);
+    nr_edge = 0;
+    for (i = 0; i < old_cap; i ++) {
+      if (old[i].key == 0) continue;
+      int j = edge_slot(old[i].key);
+      while (edges[j].key != 0) j = (j + 1) & (edge_cap - 1);
+      edges[j] = old[i];
+      nr_edge ++;
+    }
+    free(old);
+  }
+
+  uint64_t key = ((uint64_t)(caller + 1) << 32) | (uint32_t)(callee + 1);
+  int j = edge_slot(key);
+  while (edges[j].key != 0 && edges[j].key != key) j = (j + 1) & (edge_cap - 1);
+  if (edges[j].key == 0) { edges[j].key = key; nr_edge ++; }
+  edges[j].count ++;
+}
+
+// ----------- hooks called by the ISA -----------
+
+void ftrace_call(vaddr_t pc, vaddr_t target) {
+  if (funcs == NULL) return;
+  int f = lookup(target);
+  if (depth == 0) push(lookup(pc));
+  IFDEF(CONFIG_FTRACE_TRACE, log_write(FMT_WORD ": %*scall [%s@" FMT_WORD "]\n",
+        pc, depth * 2, "", func_name(f), target));
+  push(f);
+}
+
+void ftrace_ret(vaddr_t pc, vaddr_t target) {
+  if (funcs == NULL || depth == 0) return;
+  IFDEF(CONFIG_FTRACE_TRACE, log_write(FMT_WORD ": %*sret  [%s]\n",
+        pc, (depth - 1) * 2, "", func_name(stack[depth - 1].func)));
+  pop(NOW);
+}
+
+// A jump to the entry of another function is a tail call,
+// which replaces the frame of the current function.
+void ftrace_jump(vaddr_t pc, vaddr_t target) {
+  if (funcs == NULL) return;
+  int f = lookup(target);
+  if (f < 0 || funcs[f].addr != target || f == lookup(pc)) return;
+  if (depth == 0) push(lookup(pc));
+  IFDEF(CONFIG_FTRACE_TRACE, log_write(FMT_WORD ": %*stail [%s@" FMT_WORD "]\n",
+        pc, (depth - 1) * 2, "", func_name(f), target));
+  pop(NOW);
+  push(f);
+}
+
+// ----------- profile -----------
+
+#ifdef CONFIG_FTRACE_PROFILE
+static int inclusive_cmp(const void *a, const void *b) {
+  const Func *fa = &funcs[*(int *)a], *fb = &funcs[*(int *)b];
+  return (fa->inclusive < fb->inclusive) - (fa->inclusive > fb->inclusive);
+}
+
+static int edge_cmp(const void *a, const void *b) {
+  const Edge *ea = a, *eb = b;
+  return (ea->count < eb->count) - (ea->count > eb->count);
+}
+
+void ftrace_report() {
+  if (funcs == NULL) return;
+  // the functions still on the call stack are regarded as returned
+  while (depth > 0) pop(g_nr_guest_inst);
+
+  int *idx = malloc(sizeof(int) * nr_func);
+  int i, n = 0;
+  for (i = 0; i < nr_func; i ++) {
+    if (funcs[i].calls > 0) idx[n ++] = i;
+  }
+  qsort(idx, n, sizeof(int), inclusive_cmp);
+
+  uint64_t total = (g_nr_guest_inst > 0 ? g_nr_guest_inst : 1);
+  _Log("---------------- function profile (unit: instructions) ----------------\n");
+  _Log("%-32s %12s %16s %7s %16s %7s\n", "function", "calls", "inclusive", "%", "exclusive", "%");
+  for (i = 0; i < n; i ++) {
+    Func *f = &funcs[idx[i]];
+    _Log("%-32s %12" PRIu64 " %16" PRIu64 " %6.2f%% %16" PRIu64 " %6.2f%%\n", f->name, f->calls,
+        f->inclusive, f->inclusive * 100.0 / total, f->exclusive, f->exclusive * 100.0 / total);
+  }
+  free(idx);
+
+  Edge *e = malloc(sizeof(Edge) * (nr_edge + 1));
+  for (i = 0, n = 0; i < edge_cap; i ++) {
+    if (edges[i].key != 0) e[n ++] = edges[i];
+  }
+  qsort(e, n, sizeof(Edge), edge_cmp);
+  _Log("---------------- call graph ----------------\n");
+  for (i = 0; i < n; i ++) {
+    _Log("%32s -> %-32s %12" PRIu64 "\n", func_name((int)(e[i].key >> 32) - 1),
+        func_name((int)(uint32_t)e[i].key - 1), e[i].count);
+  }
+  free(e);
+}
+#endif
@@ -0,0 +1,212 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+
+bool log_enable();
+
+/* The trace file starts with a header, followed by records of
+ *   word_t pc; paddr_t addr; uint8_t info;
+ * without padding, where info[3:0] = len and info[7] = is_write.
+ * The widths of pc and addr are given in the header.
+ */
+typedef struct {
+  char magic[4]; // "NMTR"
+  uint8_t version;
+  uint8_t pc_bytes;
+  uint8_t addr_bytes;
+  uint8_t reserved;
+} MtraceHeader;
+
+#define RECORD_SIZE (sizeof(word_t) + sizeof(paddr_t) + 1)
+#define BUF_SIZE (RECORD_SIZE * 4096)
+
+static FILE *mtrace_fp = NULL;
+static uint8_t buf[BUF_SIZE];
+static int buf_len = 0;
+
+static void mtrace_flush() {
+  if (buf_len > 0) {
+    int ret = fwrite(buf, buf_len, 1, mtrace_fp);
+    assert(ret == 1);
+    buf_len = 0;
+  }
+  fflush(mtrace_fp);
+}
+
+static void stream_record(vaddr_t pc, paddr_t addr, int len, bool is_write) {
+  if (buf_len + RECORD_SIZE > BUF_SIZE) mtrace_flush();
+  uint8_t *p = buf + buf_len;
+  uint8_t info = len | (is_write << 7);
+  memcpy(p, &pc, sizeof(pc));
+  memcpy(p + sizeof(pc), &addr, sizeof(addr));
+  p[sizeof(pc) + sizeof(addr)] = info;
+  buf_len += RECORD_SIZE;
+}
+
+#ifdef CONFIG_MTRACE_CACHE
+// ----------- set-associative cache model with LRU replacement -----------
+
+enum { CACHE_HIT, CACHE_MISS, CACHE_EVICT };
+
+typedef struct {
+  const char *name;
+  int s, E, b;
+  uint64_t *tag;   // S * E entries, the valid bit is kept as bit 63
+  uint64_t *stamp; // last access time of each line
+  uint64_t clock;
+} Cache;
+
+#define VALID (1ull << 63)
+
+static void cache_init(Cache *c, const char *name, int s, int E, int b) {
+  c->name = name;
+  c->s = s; c->E = E; c->b = b;
+  c->tag = calloc((size_t)E << s, sizeof(uint64_t));
+  c->stamp = calloc((size_t)E << s, sizeof(uint64_t));
+  assert(c->tag && c->stamp);
+  c->clock = 0;
+}
+
+static int cache_access(Cache *c, paddr_t addr) {
+  uint64_t block = (uint64_t)addr >> c->b;
+  uint64_t set = block & BITMASK(c->s);
+  uint64_t tag = (block >> c->s) | VALID;
+  uint64_t *t = c->tag + set * c->E, *st = c->stamp + set * c->E;
+  int i, victim = 0;
+  c->clock ++;
+  for (i = 0; i < c->E; i ++) {
+    if (t[i] == tag) { st[i] = c->clock; return CACHE_HIT; }
+    if (st[i] < st[victim]) victim = i;
+  }
+  int ret = (t[victim] & VALID) ? CACHE_EVICT : CACHE_MISS;
+  t[victim] = tag;
+  st[victim] = c->clock;
+  return ret;
+}
+
+// ----------- statistics per PC region -----------
+
+typedef struct {
+  vaddr_t region; // pc >> CONFIG_MTRACE_REGION_SHIFT
+  bool used;
+  uint64_t cnt[2][3]; // [cache/tlb][hit/miss/evict]
+} Region;
+
+static Cache cache;
+IFDEF(CONFIG_MTRACE_TLB, static Cache tlb);
+static Region *regions = NULL;
+static int nr_region = 0, region_cap = 0;
+
+static int region_slot(Region *r, int cap, vaddr_t region) {
+  int j = ((uint64_t)region * 0x9e3779b97f4a7c15ull) >> 40 & (cap - 1);
+  while (r[j].used && r[j].region != region) j = (j + 1) & (cap - 1);
+  return j;
+}
+
+static Region *region_get(vaddr_t pc) {
+  vaddr_t region = pc >> CONFIG_MTRACE_REGION_SHIFT;
+  if (nr_region * 2 >= region_cap) {
+    Region *old = regions;
+    int old_cap = region_cap, i;
+    region_cap = (region_cap == 0 ? 256 : region_cap * 2);
+    regions = calloc(region_cap, sizeof(Region));
+    assert(regions);
+    for (i = 0; i < old_cap; i ++) {
+      if (old[i].used) regions[region_slot(regions, region_cap, old[i].region)] = old[i];
+    }
+    free(old);
+  }
+  Region *r = &regions[region_slot(regions, region_cap, region)];
+  if (!r->used) {
+    r->used = true;
+    r->region = region;
+    nr_region ++;
+  }
+  return r;
+}
+
+static void simulate(vaddr_t pc, paddr_t addr) {
+  Region *r = region_get(pc);
+  r->cnt[0][cache_access(&cache, addr)] ++;
+  IFDEF(CONFIG_MTRACE_TLB, r->cnt[1][cache_access(&tlb, addr)] ++);
+}
+
+static int region_cmp(const void *a, const void *b) {
+  const Region *ra = a, *rb = b;
+  uint64_t ma = ra->cnt[0][CACHE_MISS] + ra->cnt[0][CACHE_EVICT];
+  uint64_t mb = rb->cnt[0][CACHE_MISS] + rb->cnt[0][CACHE_EVICT];
+  return (ma < mb) - (ma > mb);
+}
+
+static void report_cache(Cache *c, int k, Region *r, int n) {
+  uint64_t total[3] = {};
+  int i, j;
+  for (i = 0; i < n; i ++) {
+    for (j = 0; j < 3; j ++) total[j] += r[i].cnt[k][j];
+  }
+  uint64_t accesses = total[0] + total[1] + total[2];
+  _Log("%s (s = %d, E = %d, b = %d): hits = %" PRIu64 ", misses = %" PRIu64 ", evictions = %" PRIu64
+      ", miss rate = %.2f%%\n", c->name, c->s, c->E, c->b, total[0], total[1] + total[2], total[2],
+      accesses ? (total[1] + total[2]) * 100.0 / accesses : 0.0);
+}
+#endif
+
+void mtrace_access(paddr_t addr, int len, bool is_write) {
+  if (mtrace_fp != NULL && log_enable()) stream_record(cpu.pc, addr, len, is_write);
+  IFDEF(CONFIG_MTRACE_CACHE, simulate(cpu.pc, addr));
+}
+
+void mtrace_report() {
+  if (mtrace_fp != NULL) mtrace_flush();
+#ifdef CONFIG_MTRACE_CACHE
+  Region *r = malloc(sizeof(Region) * (nr_region + 1));
+  int i, n = 0;
+  for (i = 0; i < region_cap; i ++) {
+    if (regions[i].used) r[n ++] = regions[i];
+  }
+  qsort(r, n, sizeof(Region), region_cmp);
+
+  report_cache(&cache, 0, r, n);
+  IFDEF(CONFIG_MTRACE_TLB, report_cache(&tlb, 1, r, n));
+  _Log("---------------- cache misses per PC region ----------------\n");
+  _Log("%-23s %14s %14s %14s" MUXDEF(CONFIG_MTRACE_TLB, " %14s", "%s") "\n",
+      "region", "hits", "misses", "evictions", MUXDEF(CONFIG_MTRACE_TLB, "TLB misses", ""));
+  for (i = 0; i < n && i < 20; i ++) {
+    vaddr_t start = r[i].region << CONFIG_MTRACE_REGION_SHIFT;
+    vaddr_t end = start + (1ul << CONFIG_MTRACE_REGION_SHIFT) - 1;
+    _Log(FMT_WORD "-" FMT_WORD " %14" PRIu64 " %14" PRIu64 " %14" PRIu64, start, end,
+        r[i].cnt[0][CACHE_HIT], r[i].cnt[0][CACHE_MISS] + r[i].cnt[0][CACHE_EVICT], r[i].cnt[0][CACHE_EVICT]);
+    IFDEF(CONFIG_MTRACE_TLB, _Log(" %14" PRIu64, r[i].cnt[1][CACHE_MISS] + r[i].cnt[1][CACHE_EVICT]));
+    _Log("\n");
+  }
+  free(r);
+#endif
+}
+
+void init_mtrace(const char *mtrace_file) {
+#ifdef CONFIG_MTRACE_CACHE
+  cache_init(&cache, "cache", CONFIG_MTRACE_CACHE_S, CONFIG_MTRACE_CACHE_E, CONFIG_MTRACE_CACHE_B);
+  IFDEF(CONFIG_MTRACE_TLB, cache_init(&tlb, "TLB", CONFIG_MTRACE_TLB_S, CONFIG_MTRACE_TLB_E, 12));
+#endif
+  if (mtrace_file == NULL) return;
+  mtrace_fp = fopen(mtrace_file, "wb");
+  Assert(mtrace_fp, "Can not open '%s'", mtrace_file);
+  MtraceHeader h = { .magic = "NMTR", .version = 1,
+    .pc_bytes = sizeof(word_t), .addr_bytes = sizeof(paddr_t) };
+  int ret = fwrite(&h, sizeof(h), 1, mtrace_fp);
+  assert(ret == 1);
+  Log("Memory trace is written to %s", mtrace_file);
+}
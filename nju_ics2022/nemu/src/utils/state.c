@@ -18,7 +18,7 @@
 NEMUState nemu_state = { .state = NEMU_STOP };
 
 int is_exit_status_bad() {
-  int good = (nemu_state.state == NEMU_END && nemu_state.halt_ret == 0) ||
-    (nemu_state.state == NEMU_QUIT);
+  int state = nemu_state_get();
+  int good = (state == NEMU_END && nemu_state.halt_ret == 0) || (state == NEMU_QUIT);
   return !good;
 }
@@ -20,19 +20,29 @@
 #define ISA_QEMU_BIN "qemu-system-mipsel"
 #define ISA_QEMU_ARGS "-machine", "mipssim",\
   "-kernel", NEMU_HOME "/resource/mips-elf/mips.dummy",
+#define ISA_BREAKPOINT_KIND 4
 #elif defined(CONFIG_ISA_riscv32)
 #define ISA_QEMU_BIN "qemu-system-riscv32"
 #define ISA_QEMU_ARGS "-bios", "none",
+#define ISA_BREAKPOINT_KIND 4
 #elif defined(CONFIG_ISA_riscv64)
 #define ISA_QEMU_BIN "qemu-system-riscv64"
 #define ISA_QEMU_ARGS 
+#define ISA_BREAKPOINT_KIND 4
 #elif defined(CONFIG_ISA_x86)
 #define ISA_QEMU_BIN "qemu-system-i386"
 #define ISA_QEMU_ARGS
+#define ISA_BREAKPOINT_KIND 1
 #else
 #error Unsupport ISA
 #endif
 
+#if defined(CONFIG_ISA_x86)
+#define ISA_GDB_PC(r) ((r).eip)
+#else
+#define ISA_GDB_PC(r) ((r).pc)
+#endif
+
 union isa_gdb_regs {
   struct {
 #if defined(CONFIG_ISA_mips32)
@@ -25,6 +25,8 @@ uint16_t gdb_decode_hex(uint8_t msb, uint8_t lsb);
 uint64_t gdb_decode_hex_str(uint8_t *bytes);
 
 uint8_t hex_encode(uint8_t digit);
+void gdb_encode_hex(uint8_t *dst, const void *src, size_t n);
+size_t gdb_decode_hex_bytes(void *dst, const uint8_t *src, size_t n);
 
 struct gdb_conn *gdb_begin_inet(const char *addr, uint16_t port);
 
@@ -32,6 +34,12 @@ void gdb_end(struct gdb_conn *conn);
 
 void gdb_send(struct gdb_conn *conn, const uint8_t *command, size_t size);
 
+void gdb_queue(struct gdb_conn *conn, const uint8_t *command, size_t size);
+
+void gdb_flush(struct gdb_conn *conn);
+
+bool gdb_noack(struct gdb_conn *conn);
+
 uint8_t *gdb_recv(struct gdb_conn *conn, size_t *size);
 
 const char * gdb_start_noack(struct gdb_conn *conn);
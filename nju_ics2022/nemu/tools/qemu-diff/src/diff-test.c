@@ -20,24 +20,31 @@
 
 bool gdb_connect_qemu(int);
 bool gdb_memcpy_to_qemu(uint32_t, void *, int);
+bool gdb_memcpy_from_qemu(uint32_t, void *, int);
 bool gdb_getregs(union isa_gdb_regs *);
 bool gdb_setregs(union isa_gdb_regs *);
 bool gdb_si();
+bool gdb_continue_to(uint64_t);
 void gdb_exit();
 
 void init_isa();
 
+// registers of QEMU, valid until QEMU executes again
+static union isa_gdb_regs qemu_r;
+static bool qemu_r_valid = false;
+
 void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
-  assert(direction == DIFFTEST_TO_REF);
-  if (direction == DIFFTEST_TO_REF) {
-    bool ok = gdb_memcpy_to_qemu(addr, buf, n);
-    assert(ok == 1);
-  }
+  bool ok;
+  if (direction == DIFFTEST_TO_REF) ok = gdb_memcpy_to_qemu(addr, buf, n);
+  else ok = gdb_memcpy_from_qemu(addr, buf, n);
+  assert(ok == 1);
 }
 
 void difftest_regcpy(void *dut, bool direction) {
-  union isa_gdb_regs qemu_r;
-  gdb_getregs(&qemu_r);
+  if (!qemu_r_valid) {
+    gdb_getregs(&qemu_r);
+    qemu_r_valid = true;
+  }
   if (direction == DIFFTEST_TO_REF) {
     memcpy(&qemu_r, dut, DIFFTEST_REG_SIZE);
     gdb_setregs(&qemu_r);
@@ -47,9 +54,28 @@ void difftest_regcpy(void *dut, bool direction) {
 }
 
 void difftest_exec(uint64_t n) {
+  // QEMU stops the guest when it receives anything while running,
+  // so the steps can not be pipelined
+  if (n > 0) qemu_r_valid = false;
   while (n --) gdb_si();
 }
 
+// execute until pc is reached, with a breakpoint instead of single steps.
+// QEMU does not report the number of instructions it executes, so `max_n'
+// does not bound the run, and the return value only tells whether QEMU
+// has executed (1) or it is already at pc (0)
+uint64_t difftest_exec_until(uint64_t pc, uint64_t max_n) {
+  if (!qemu_r_valid) {
+    gdb_getregs(&qemu_r);
+    qemu_r_valid = true;
+  }
+  if (ISA_GDB_PC(qemu_r) == pc || max_n == 0) return 0;
+  qemu_r_valid = false;
+  bool ok = gdb_continue_to(pc);
+  assert(ok == 1);
+  return 1;
+}
+
 void difftest_init(int port) {
   char buf[32];
   sprintf(buf, "tcp::%d", port);
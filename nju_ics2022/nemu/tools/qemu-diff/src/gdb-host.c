@@ -14,48 +14,167 @@
 ***************************************************************************************/
 
 #include "common.h"
+#include <inttypes.h>
 
 static struct gdb_conn *conn;
 
+// maximum payload of a packet accepted by QEMU, updated from qSupported
+static int max_payload = 3072;
+// whether QEMU accepts binary 'X' packets, probed at the first memory write
+static enum { X_UNKNOWN, X_YES, X_NO } x_support = X_UNKNOWN;
+
+// maximum number of requests in flight when they are pipelined
+#define WINDOW 32
+// room for the command, the address and the length of a memory packet
+#define HDR_LEN 32
+
+static bool recv_ok() {
+  size_t size;
+  uint8_t *reply = gdb_recv(conn, &size);
+  bool ok = !strcmp((const char*)reply, "OK");
+  free(reply);
+  return ok;
+}
+
+// Send a request.  In no-ack mode the request is only queued, and the
+// caller should collect the reply after at most WINDOW requests.
+static void request(const uint8_t *buf, size_t size) {
+  if (gdb_noack(conn)) gdb_queue(conn, buf, size);
+  else gdb_send(conn, buf, size);
+}
+
+static void query_supported() {
+  static const char cmd[] = "qSupported";
+  gdb_send(conn, (const uint8_t *)cmd, sizeof(cmd) - 1);
+  size_t size;
+  char *reply = (char *)gdb_recv(conn, &size);
+  char *p = strstr(reply, "PacketSize=");
+  if (p != NULL) {
+    int n = strtol(p + strlen("PacketSize="), NULL, 16);
+    // leave some room for the packet framing and the terminating '\0'
+    if (n > HDR_LEN * 2) max_payload = n - 8;
+  }
+  free(reply);
+}
+
 bool gdb_connect_qemu(int port) {
   // connect to gdbserver on localhost port 1234
   while ((conn = gdb_begin_inet("127.0.0.1", port)) == NULL) {
     usleep(1);
   }
 
+  query_supported();
+  // without acks, requests can be pipelined
+  gdb_start_noack(conn);
+
   return true;
 }
 
-static bool gdb_memcpy_to_qemu_small(uint32_t dest, void *src, int len) {
-  char *buf = malloc(len * 2 + 128);
-  assert(buf != NULL);
-  int p = sprintf(buf, "M0x%x,%x:", dest, len);
-  int i;
-  for (i = 0; i < len; i ++) {
-    p += sprintf(buf + p, "%c%c", hex_encode(((uint8_t *)src)[i] >> 4), hex_encode(((uint8_t *)src)[i] & 0xf));
+static bool probe_x(uint32_t dest) {
+  char buf[HDR_LEN];
+  int p = sprintf(buf, "X%x,0:", dest);
+  gdb_send(conn, (const uint8_t *)buf, p);
+  size_t size;
+  uint8_t *reply = gdb_recv(conn, &size);
+  // an empty reply means the packet is not supported
+  bool ok = (size != 0);
+  free(reply);
+  return ok;
+}
+
+static bool need_escape(uint8_t c) {
+  return c == '$' || c == '#' || c == '}' || c == '*';
+}
+
+// Build a packet to write the beginning of `src' to `dest',
+// return the size of the packet, and the number of bytes written in `n'.
+static size_t mem_write_packet(uint8_t *buf, uint32_t dest, const uint8_t *src, int len, int *n) {
+  int limit = max_payload - HDR_LEN;
+  int i, p;
+  if (x_support == X_YES) {
+    int size = 0;
+    for (i = 0; i < len; i ++) {
+      int c = need_escape(src[i]) ? 2 : 1;
+      if (size + c > limit) break;
+      size += c;
+    }
+    p = sprintf((char *)buf, "X%x,%x:", dest, i);
+    for (*n = i, i = 0; i < *n; i ++) {
+      if (need_escape(src[i])) {
+        buf[p ++] = '}';
+        buf[p ++] = src[i] ^ 0x20;
+      } else {
+        buf[p ++] = src[i];
+      }
+    }
+  } else {
+    *n = (len < limit / 2 ? len : limit / 2);
+    p = sprintf((char *)buf, "M%x,%x:", dest, *n);
+    gdb_encode_hex(buf + p, src, *n);
+    p += *n * 2;
   }
+  return p;
+}
 
-  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
+bool gdb_memcpy_to_qemu(uint32_t dest, void *src, int len) {
+  if (x_support == X_UNKNOWN) x_support = (probe_x(dest) ? X_YES : X_NO);
+
+  uint8_t *buf = malloc(max_payload + HDR_LEN);
+  assert(buf != NULL);
+  bool ok = true;
+  int inflight = 0;
+  while (len > 0) {
+    int n;
+    size_t size = mem_write_packet(buf, dest, src, len, &n);
+    request(buf, size);
+    inflight ++;
+    if (inflight == WINDOW || !gdb_noack(conn)) {
+      gdb_flush(conn);
+      for (; inflight > 0; inflight --) ok &= recv_ok();
+    }
+    dest += n;
+    src += n;
+    len -= n;
+  }
+  gdb_flush(conn);
+  for (; inflight > 0; inflight --) ok &= recv_ok();
   free(buf);
+  return ok;
+}
 
+static bool recv_mem(uint8_t *dst, int n) {
   size_t size;
   uint8_t *reply = gdb_recv(conn, &size);
-  bool ok = !strcmp((const char*)reply, "OK");
+  bool ok = (size == n * 2 && gdb_decode_hex_bytes(dst, reply, n) == n);
   free(reply);
-
   return ok;
 }
 
-bool gdb_memcpy_to_qemu(uint32_t dest, void *src, int len) {
-  const int mtu = 1500;
+bool gdb_memcpy_from_qemu(uint32_t src, void *dest, int len) {
+  const int max_n = (max_payload - HDR_LEN) / 2;
+  uint8_t *pending[WINDOW];
+  int pending_n[WINDOW];
   bool ok = true;
-  while (len > mtu) {
-    ok &= gdb_memcpy_to_qemu_small(dest, src, mtu);
-    dest += mtu;
-    src += mtu;
-    len -= mtu;
+  int inflight = 0, i;
+  while (len > 0) {
+    char buf[HDR_LEN];
+    int n = (len < max_n ? len : max_n);
+    int p = sprintf(buf, "m%x,%x", src, n);
+    request((const uint8_t *)buf, p);
+    pending[inflight] = dest;
+    pending_n[inflight] = n;
+    inflight ++;
+    if (inflight == WINDOW || !gdb_noack(conn)) {
+      gdb_flush(conn);
+      for (i = 0; i < inflight; i ++) ok &= recv_mem(pending[i], pending_n[i]);
+      inflight = 0;
+    }
+    src += n;
+    dest += n;
+    len -= n;
   }
-  ok &= gdb_memcpy_to_qemu_small(dest, src, len);
+  gdb_flush(conn);
+  for (i = 0; i < inflight; i ++) ok &= recv_mem(pending[i], pending_n[i]);
   return ok;
 }
 
@@ -64,16 +183,10 @@ bool gdb_getregs(union isa_gdb_regs *r) {
   size_t size;
   uint8_t *reply = gdb_recv(conn, &size);
 
-  int i;
-  uint8_t *p = reply;
-  uint8_t c;
-  for (i = 0; i < sizeof(union isa_gdb_regs) / sizeof(uint32_t); i ++) {
-    c = p[8];
-    p[8] = '\0';
-    r->array[i] = gdb_decode_hex_str(p);
-    p[8] = c;
-    p += 8;
-  }
+  // the registers not reported by QEMU are regarded as zero
+  size_t n = size / 2;
+  memset(r, 0, sizeof(*r));
+  gdb_decode_hex_bytes(r, reply, n < sizeof(*r) ? n : sizeof(*r));
 
   free(reply);
 
@@ -82,26 +195,15 @@ bool gdb_getregs(union isa_gdb_regs *r) {
 
 bool gdb_setregs(union isa_gdb_regs *r) {
   int len = sizeof(union isa_gdb_regs);
-  char *buf = malloc(len * 2 + 128);
+  uint8_t *buf = malloc(len * 2 + 1);
   assert(buf != NULL);
   buf[0] = 'G';
+  gdb_encode_hex(buf + 1, r, len);
 
-  void *src = r;
-  int p = 1;
-  int i;
-  for (i = 0; i < len; i ++) {
-    p += sprintf(buf + p, "%c%c", hex_encode(((uint8_t *)src)[i] >> 4), hex_encode(((uint8_t *)src)[i] & 0xf));
-  }
-
-  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
+  gdb_send(conn, buf, len * 2 + 1);
   free(buf);
 
-  size_t size;
-  uint8_t *reply = gdb_recv(conn, &size);
-  bool ok = !strcmp((const char*)reply, "OK");
-  free(reply);
-
-  return ok;
+  return recv_ok();
 }
 
 bool gdb_si() {
@@ -113,6 +215,24 @@ bool gdb_si() {
   return true;
 }
 
+// Run until the guest reaches `addr', with a temporary breakpoint.
+bool gdb_continue_to(uint64_t addr) {
+  char buf[HDR_LEN];
+  int p = sprintf(buf, "Z0,%" PRIx64 ",%d", addr, ISA_BREAKPOINT_KIND);
+  gdb_send(conn, (const uint8_t *)buf, p);
+  if (!recv_ok()) return false;
+
+  p = sprintf(buf, "vCont;c");
+  gdb_send(conn, (const uint8_t *)buf, p);
+  size_t size;
+  uint8_t *reply = gdb_recv(conn, &size);
+  free(reply);
+
+  p = sprintf(buf, "z0,%" PRIx64 ",%d", addr, ISA_BREAKPOINT_KIND);
+  gdb_send(conn, (const uint8_t *)buf, p);
+  return recv_ok();
+}
+
 void gdb_exit() {
   gdb_end(conn);
 }
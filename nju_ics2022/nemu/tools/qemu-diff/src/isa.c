@@ -20,7 +20,7 @@
 bool gdb_memcpy_to_qemu(uint32_t, void *, int);
 bool gdb_getregs(union isa_gdb_regs *);
 bool gdb_setregs(union isa_gdb_regs *);
-void difftest_exec(uint64_t n);
+bool gdb_continue_to(uint64_t);
 
 static uint8_t mbr[] = {
   // start16:
@@ -66,8 +66,9 @@ void init_isa() {
   ok = gdb_setregs(&r);
   assert(ok == 1);
 
-  // execute enough instructions to enter protected mode
-  difftest_exec(20);
+  // run until the dead loop at start32, where protected mode is entered
+  ok = gdb_continue_to(0x7c27);
+  assert(ok == 1);
 }
 
 #else
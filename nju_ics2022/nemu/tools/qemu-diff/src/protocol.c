@@ -20,6 +20,7 @@
 #include "common.h"
 #include <ctype.h>
 #include <err.h>
+#include <errno.h>
 
 #include <arpa/inet.h>
 
@@ -29,10 +30,19 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 
+#define IBUF_SIZE 65536
+
 struct gdb_conn {
-  FILE *in;
-  FILE *out;
+  int fd;
   bool ack;
+
+  // input is read in large blocks and parsed from here
+  uint8_t ibuf[IBUF_SIZE];
+  size_t ipos, ilen;
+
+  // packets are assembled here and written with a single write()
+  uint8_t *obuf;
+  size_t olen, osize;
 };
 
 
@@ -51,6 +61,27 @@ uint16_t gdb_decode_hex(uint8_t msb, uint8_t lsb) {
   return 16 * hex_nibble(msb) + hex_nibble(lsb);
 }
 
+void gdb_encode_hex(uint8_t *dst, const void *src, size_t n) {
+  static const char digits[] = "0123456789abcdef";
+  const uint8_t *p = src;
+  size_t i;
+  for (i = 0; i < n; i ++) {
+    dst[2 * i] = digits[p[i] >> 4];
+    dst[2 * i + 1] = digits[p[i] & 0xf];
+  }
+}
+
+size_t gdb_decode_hex_bytes(void *dst, const uint8_t *src, size_t n) {
+  uint8_t *p = dst;
+  size_t i;
+  for (i = 0; i < n; i ++) {
+    uint16_t byte = gdb_decode_hex(src[2 * i], src[2 * i + 1]);
+    if (byte == UINT16_MAX) break;
+    p[i] = byte;
+  }
+  return i;
+}
+
 uint64_t gdb_decode_hex_str(uint8_t *bytes) {
   uint64_t value = 0;
   uint64_t weight = 1;
@@ -63,31 +94,75 @@ uint64_t gdb_decode_hex_str(uint8_t *bytes) {
 }
 
 
+static int conn_peek(struct gdb_conn *conn) {
+  if (conn->ipos == conn->ilen) {
+    ssize_t n;
+    do {
+      n = read(conn->fd, conn->ibuf, IBUF_SIZE);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+      err(1, "recv");
+    if (n == 0)
+      return EOF;
+    conn->ipos = 0;
+    conn->ilen = n;
+  }
+  return conn->ibuf[conn->ipos];
+}
+
+static int conn_getc(struct gdb_conn *conn) {
+  int c = conn_peek(conn);
+  if (c != EOF)
+    conn->ipos ++;
+  return c;
+}
+
+static void conn_reserve(struct gdb_conn *conn, size_t size) {
+  if (conn->olen + size <= conn->osize)
+    return;
+  while (conn->olen + size > conn->osize)
+    conn->osize *= 2;
+  conn->obuf = realloc(conn->obuf, conn->osize);
+  if (conn->obuf == NULL)
+    err(1, "realloc");
+}
+
+static void conn_putc(struct gdb_conn *conn, uint8_t c) {
+  conn_reserve(conn, 1);
+  conn->obuf[conn->olen++] = c;
+}
+
+void gdb_flush(struct gdb_conn *conn) {
+  size_t done = 0;
+  while (done < conn->olen) {
+    ssize_t n = write(conn->fd, conn->obuf + done, conn->olen - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      err(1, "send");
+    if (n == 0)
+      errx(0, "send: Connection closed");
+    done += n;
+  }
+  conn->olen = 0;
+}
+
 static struct gdb_conn* gdb_begin(int fd) {
   struct gdb_conn *conn = calloc(1, sizeof(struct gdb_conn));
   if (conn == NULL)
     err(1, "calloc");
 
+  conn->fd = fd;
   conn->ack = true;
 
-  // duplicate the handle to separate read/write state
-  int fd2 = dup(fd);
-  if (fd2 < 0)
-    err(1, "dup");
-
-  // open a FILE* for reading
-  conn->in = fdopen(fd, "rb");
-  if (conn->in == NULL)
-    err(1, "fdopen");
-
-  // open a FILE* for writing
-  conn->out = fdopen(fd2, "wb");
-  if (conn->out == NULL)
-    err(1, "fdopen");
+  conn->osize = 4096;
+  conn->obuf = malloc(conn->osize);
+  if (conn->obuf == NULL)
+    err(1, "malloc");
 
   // reset line state by acking any earlier input
-  fputc('+', conn->out);
-  fflush(conn->out);
+  conn_putc(conn, '+');
+  gdb_flush(conn);
 
   return conn;
 }
@@ -130,12 +205,12 @@ struct gdb_conn* gdb_begin_inet(const char *addr, uint16_t port) {
 
 
 void gdb_end(struct gdb_conn *conn) {
-  fclose(conn->in);
-  fclose(conn->out);
+  close(conn->fd);
+  free(conn->obuf);
   free(conn);
 }
 
-static void send_packet(FILE *out, const uint8_t *command, size_t size) {
+static void send_packet(struct gdb_conn *conn, const uint8_t *command, size_t size) {
   // compute the checksum -- simple mod256 addition
   uint8_t sum = 0;
   size_t i;
@@ -146,31 +221,45 @@ static void send_packet(FILE *out, const uint8_t *command, size_t size) {
   // gdbserver.  e.g. giving "invalid hex digit" on an RLE'd address.
   // So just write raw here, and maybe let higher levels escape/RLE.
 
-  fputc('$', out); // packet start
-  fwrite(command, 1, size, out); // payload
-  fprintf(out, "#%02X", sum); // packet end, checksum
-  fflush(out);
-
-  if (ferror(out))
-    err(1, "send");
-  else if (feof(out))
-    errx(0, "send: Connection closed");
+  conn_reserve(conn, size + 4);
+  uint8_t *p = conn->obuf + conn->olen;
+  p[0] = '$'; // packet start
+  memcpy(p + 1, command, size); // payload
+  p[size + 1] = '#'; // packet end, checksum
+  gdb_encode_hex(p + size + 2, &sum, 1);
+  conn->olen += size + 4;
 }
 
 void gdb_send(struct gdb_conn *conn, const uint8_t *command, size_t size) {
   bool acked = false;
   do {
-    send_packet(conn->out, command, size);
+    send_packet(conn, command, size);
+    gdb_flush(conn);
 
     if (!conn->ack)
       break;
 
     // look for '+' ACK or '-' NACK/resend
-    acked = fgetc(conn->in) == '+';
+    int c = conn_getc(conn);
+    if (c == EOF)
+      errx(0, "recv: Connection closed");
+    acked = c == '+';
   } while (!acked);
 }
 
-static uint8_t* recv_packet(FILE *in, size_t *ret_size, bool* ret_sum_ok) {
+// Queue a packet without waiting for the reply.  Only valid in no-ack
+// mode, where the stub never asks for a retransmission.  The packets are
+// sent at the next gdb_flush() or gdb_send().
+void gdb_queue(struct gdb_conn *conn, const uint8_t *command, size_t size) {
+  assert(!conn->ack);
+  send_packet(conn, command, size);
+}
+
+bool gdb_noack(struct gdb_conn *conn) {
+  return !conn->ack;
+}
+
+static uint8_t* recv_packet(struct gdb_conn *conn, size_t *ret_size, bool* ret_sum_ok) {
   size_t i = 0;
   size_t size = 4096;
   uint8_t *reply = malloc(size);
@@ -182,9 +271,9 @@ static uint8_t* recv_packet(FILE *in, size_t *ret_size, bool* ret_sum_ok) {
   bool escape = false;
 
   // fast-forward to the first start of packet
-  while ((c = fgetc(in)) != EOF && c != '$');
+  while ((c = conn_getc(conn)) != EOF && c != '$');
 
-  while ((c = fgetc(in)) != EOF) {
+  while ((c = conn_getc(conn)) != EOF) {
     sum += c;
     switch (c) {
       case '$': // new packet?  start over...
@@ -196,8 +285,8 @@ static uint8_t* recv_packet(FILE *in, size_t *ret_size, bool* ret_sum_ok) {
       case '#': // end of packet
         sum -= c; // not part of the checksum
         {
-          uint8_t msb = fgetc(in);
-          uint8_t lsb = fgetc(in);
+          uint8_t msb = conn_getc(conn);
+          uint8_t lsb = conn_getc(conn);
           *ret_sum_ok = sum == gdb_decode_hex(msb, lsb);
         }
         *ret_size = i;
@@ -223,11 +312,11 @@ static uint8_t* recv_packet(FILE *in, size_t *ret_size, bool* ret_sum_ok) {
         // The count character can't be >126 or '$'/'#' packet markers.
 
         if (i > 0) { // need something to repeat!
-          int c2 = fgetc(in);
+          int c2 = conn_peek(conn);
           if (c2 < 29 || c2 > 126 || c2 == '$' || c2 == '#') {
             // invalid count character!
-            ungetc(c2, in);
           } else {
+            conn->ipos ++;
             int count = c2 - 29;
 
             // get a bigger buffer if needed
@@ -265,26 +354,21 @@ static uint8_t* recv_packet(FILE *in, size_t *ret_size, bool* ret_sum_ok) {
     reply[i++] = c;
   }
 
-  if (ferror(in))
-    err(1, "recv");
-  else if (feof(in))
-    errx(0, "recv: Connection closed");
-  else
-    errx(1, "recv: Unknown connection error");
+  errx(0, "recv: Connection closed");
 }
 
 uint8_t* gdb_recv(struct gdb_conn *conn, size_t *size) {
   uint8_t *reply;
   bool acked = false;
   do {
-    reply = recv_packet(conn->in, size, &acked);
+    reply = recv_packet(conn, size, &acked);
 
     if (!conn->ack)
       break;
 
     // send +/- depending on checksum result, retry if needed
-    fputc(acked ? '+' : '-', conn->out);
-    fflush(conn->out);
+    conn_putc(conn, acked ? '+' : '-');
+    gdb_flush(conn);
   } while (!acked);
 
   return reply;
@@ -14,8 +14,10 @@
 ***************************************************************************************/
 
 #include "sim.h"
+#include "memtracer.h"
 #include "../../include/common.h"
 #include <difftest-def.h>
+#include <set>
 
 #ifdef CONFIG_ISA_riscv32
 #undef DEFAULT_ISA
@@ -47,9 +49,37 @@ static sim_t* s = NULL;
 static processor_t *p = NULL;
 static state_t *state = NULL;
 
+// record the pages in DRAM written since the last difftest_memhash()
+class dirty_tracer_t : public memtracer_t {
+ public:
+  bool interested_in_range(uint64_t begin, uint64_t end, access_type type) {
+    return type == STORE;
+  }
+  void trace(uint64_t addr, size_t bytes, access_type type) {
+    if (type != STORE || addr < DRAM_BASE || addr - DRAM_BASE >= CONFIG_MSIZE) return;
+    reg_t first = addr >> DIFFTEST_PAGE_SHIFT, last = (addr + bytes - 1) >> DIFFTEST_PAGE_SHIFT;
+    for (reg_t pg = first; pg <= last; pg++) {
+      if (pg != last_page) pages.insert(pg);
+    }
+    last_page = last;
+  }
+  void clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval) {}
+  void clear() {
+    pages.clear();
+    last_page = -1;
+  }
+  std::set<reg_t> pages;
+ private:
+  reg_t last_page = -1;
+};
+
+static dirty_tracer_t dirty_tracer;
+
 void sim_t::diff_init(int port) {
   p = get_core("0");
   state = p->get_state();
+  // the TLB is flushed, and stores are no longer served by its fast path
+  p->get_mmu()->register_memtracer(&dirty_tracer);
 }
 
 void sim_t::diff_step(uint64_t n) {
@@ -79,13 +109,29 @@ void sim_t::diff_memcpy(reg_t dest, void* src, size_t n) {
   }
 }
 
+static void diff_memcpy_to_dut(void* dest, reg_t src, size_t n) {
+  mmu_t* mmu = p->get_mmu();
+  for (size_t i = 0; i < n; i++) {
+    *((uint8_t*)dest+i) = mmu->load_uint8(src+i);
+  }
+}
+
+static uint64_t diff_page_hash(reg_t addr) {
+  static uint64_t buf[DIFFTEST_PAGE_SIZE / sizeof(uint64_t)];
+  mmu_t* mmu = p->get_mmu();
+  for (size_t i = 0; i < DIFFTEST_PAGE_SIZE / sizeof(uint64_t); i++) {
+    buf[i] = mmu->load_uint64(addr + i * sizeof(uint64_t));
+  }
+  return difftest_page_hash(addr, buf);
+}
+
 extern "C" {
 
 void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
   if (direction == DIFFTEST_TO_REF) {
     s->diff_memcpy(addr, buf, n);
   } else {
-    assert(0);
+    diff_memcpy_to_dut(buf, addr, n);
   }
 }
 
@@ -101,6 +147,34 @@ void difftest_exec(uint64_t n) {
   s->diff_step(n);
 }
 
+// execute until pc is reached or max_n instructions are executed,
+// return the number of instructions executed
+uint64_t difftest_exec_until(uint64_t pc, uint64_t max_n) {
+  uint64_t n = 0;
+  while (n < max_n && (word_t)state->pc != (word_t)pc) {
+    s->diff_step(1);
+    n++;
+  }
+  return n;
+}
+
+// Return the sum of difftest_page_hash() of the pages written since the
+// last call with `clear' set. At most `*nr_page' page addresses are stored
+// into `pages', and `*nr_page' is set to the number of such pages.
+uint64_t difftest_memhash(paddr_t *pages, size_t *nr_page, bool clear) {
+  uint64_t hash = 0;
+  size_t i = 0;
+  for (reg_t pg : dirty_tracer.pages) {
+    reg_t addr = pg << DIFFTEST_PAGE_SHIFT;
+    if (i < *nr_page) pages[i] = addr;
+    hash += diff_page_hash(addr);
+    i++;
+  }
+  *nr_page = i;
+  if (clear) dirty_tracer.clear();
+  return hash;
+}
+
 void difftest_init(int port) {
   difftest_htif_args.push_back("");
   s = new sim_t(DEFAULT_ISA, DEFAULT_PRIV, DEFAULT_VARCH, 1, false, false,